@@ -0,0 +1,227 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Определение КЧД с чтением без блокировок параллельно с писателем
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Обертка над RBTree: писатели сериализуются мьютексом, а читатели проходят по
+/// дереву оптимистично, проверяя счетчик версий (seqlock); исключенные узлы
+/// возвращаются в пул по эпохам. "Реализация" методов располагается в файле
+/// concurrentrbtree.hpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef RBTREE_CONCURRENTRBTREE_H_
+#define RBTREE_CONCURRENTRBTREE_H_
+
+#include <atomic>           // std::atomic
+#include <cstdint>          // std::uint64_t
+#include <functional>       // std::less
+#include <limits>           // std::numeric_limits
+#include <memory>           // std::allocator
+#include <mutex>            // std::mutex, std::lock_guard
+#include <type_traits>      // std::is_trivially_copyable
+#include <vector>
+
+#include "rbtree.h"
+
+
+namespace xi {
+
+
+/** \brief Красно-черное дерево, которое можно читать из многих потоков без блокировок,
+ *  пока другой поток его меняет.
+ *
+ *  Писатели берут мьютекс и на время изменения делают счетчик версий нечетным. Читатель
+ *  запоминает четную версию, проходит по узлам без блокировок, копируя найденные элементы,
+ *  и сверяет версию в конце; если она сменилась, проход повторяется. После
+ *  \c OPTIMISTIC_ATTEMPTS неудачных попыток подряд читатель берет мьютекс, так что частые
+ *  записи не могут держать его бесконечно. Поиск, пересекшийся с записью, стоит повторного
+ *  спуска за O(log n); пока записей нет, читатели не пишут в общую память вовсе.
+ *
+ *  Оптимистичный читатель может увидеть дерево посреди изменения, поэтому:
+ *  - корень и связи с потомками дерева атомарны (раскладка \c SharedNodes): писатель публикует
+ *    их записью с release, читатель читает с acquire и видит узел уже построенным;
+ *  - проходы ограничены: спуск — числом шагов не больше высоты любого корректного дерева,
+ *    обход диапазона — сверкой версии каждые \c SCAN_CHECK_STEPS узлов, так что петли и
+ *    оборванные ссылки в промежуточном состоянии не приводят к зависанию;
+ *  - исключенный из дерева узел не разрушается и не возвращается в пул, пока не закончат все
+ *    читатели, начавшие до его исключения (освобождение по эпохам): читатель отмечается в
+ *    счетчике текущей эпохи, а писатель в начале записи освобождает узлы предыдущей эпохи, если
+ *    ее счетчик пуст, и открывает новую. Поэтому читатель никогда не видит узел, который
+ *    перестраивается, и ключи узлов для него неизменны;
+ *  - \c Element должен быть тривиально копируемым: найденный элемент копируется до сверки версии.
+ *
+ *  Отметка в эпохе — единственная запись читателя в общую память; счетчики разнесены по
+ *  \c READER_SLOTS кеш-линиям, и потоки распределяются по ним по кругу.
+ *
+ *  Наружу не выдаются ни узлы, ни итераторы: их время жизни нельзя согласовать с писателем.
+ *  По той же причине нет соединения, разрезания и операций над множествами — они переносят
+ *  узлы между деревьями и пулами.
+ *
+ *  \tparam Element, Compar, Allocator, Augment Параметры нижележащего \c RBTree.
+ */
+    template <typename Element,
+              typename Compar = std::less<Element>,
+              typename Allocator = std::allocator<Element>,
+              typename Augment = NoAugment>
+    class ConcurrentRBTree {
+    public:
+        typedef RBTree<Element, Compar, Allocator, Augment, SharedNodes> TTree;
+        typedef typename TTree::Node TTreeNode;
+
+    public:
+        /** \brief Создает пустое дерево с компаратором \c compar и аллокатором \c alloc. */
+        explicit ConcurrentRBTree(const Compar& compar = Compar(), const Allocator& alloc = Allocator());
+
+        /** \brief Разрушает дерево вместе с узлами, ждущими конца своей эпохи. Читателей в этот
+         *  момент быть не должно.
+         */
+        ~ConcurrentRBTree();
+
+    public:
+        // Изменение, по одному писателю за раз
+
+        /** \brief Вставляет элемент \c key; если он уже есть, генерирует \c std::logic_error,
+         *  как \c RBTree::insert().
+         */
+        void insert(const Element& key) { write([&key](TTree& tree) { tree.insert(key); }); }
+
+        /** \brief Вставляет элемент \c key, если его еще нет; возвращает истину, если вставил. */
+        bool tryInsert(const Element& key);
+
+#ifdef RBTREE_WITH_DELETION
+        /** \brief Удаляет элемент \c key; если его нет, генерирует \c std::logic_error. */
+        void remove(const Element& key);
+#endif
+
+        /** \brief Удаляет все элементы. Узлы вернутся в пул, когда закончат текущие читатели. */
+        void clear();
+
+    public:
+        // Чтение без блокировок
+
+        /** \brief Возвращает истину, если элемент, эквивалентный \c key, есть в дереве. */
+        bool contains(const Element& key) const;
+
+        /** \brief Копирует в \c out элемент, эквивалентный \c key, и возвращает истину;
+         *  если такого нет, возвращает ложь и \c out не меняет.
+         */
+        bool find(const Element& key, Element& out) const;
+
+        /** \brief Возвращает по возрастанию все элементы из полуинтервала [lo, hi) — согласованный
+         *  снимок на один момент времени.
+         */
+        std::vector<Element> findRange(const Element& lo, const Element& hi) const;
+
+        /** \brief Возвращает истину, если дерево пусто. */
+        bool isEmpty() const;
+
+    protected:
+        /** \brief Выполняет \c fn(_tree) под мьютексом, делая версию нечетной на время изменения.
+         *
+         *  Перед этим освобождает узлы прошлой эпохи, если ее читатели закончили (\c reclaim()).
+         *  Если \c fn генерирует исключение, версия все равно становится четной: дерево к этому
+         *  моменту уже согласовано (строгая гарантия \c RBTree).
+         */
+        template <typename Fn>
+        void write(Fn fn);
+
+        /** \brief Откладывает разрушение исключенного из дерева поддерева \c nd до конца текущей
+         *  эпохи. Вызывается только писателем.
+         */
+        void retire(TTreeNode* nd);
+
+        /** \brief Если читателей прошлой эпохи не осталось, возвращает в пул отложенные в ней узлы
+         *  и открывает следующую эпоху. Вызывается только писателем.
+         */
+        void reclaim();
+
+        /** \brief Разрушает цепочку отложенных поддеревьев, начинающуюся с \c nd. */
+        void releaseRetired(TTreeNode* nd);
+
+        /** \brief Отмечает читателя в текущей эпохе и возвращает счетчик, который надо уменьшить
+         *  по окончании чтения.
+         */
+        std::atomic<std::size_t>& enterEpoch() const;
+
+        /** \brief Возвращает номер счетчика читателей, закрепленного за текущим потоком. */
+        static std::size_t readerSlot();
+
+        /** \brief Выполняет \c attempt(root, seq), пока версия до и после не совпадет, или,
+         *  после \c OPTIMISTIC_ATTEMPTS неудач, под мьютексом.
+         *
+         *  \c attempt получает корень и версию, на которой начата попытка, и возвращает ложь, если
+         *  сам заметил несогласованность (тогда попытка считается неудачной); его результаты
+         *  должны сбрасываться в начале каждой попытки.
+         */
+        template <typename Attempt>
+        void read(Attempt attempt) const;
+
+        /** \brief Спускается от \c nd к элементу, эквивалентному \c key. Возвращает узел или
+         *  \c nullptr, а в \c bounded — ложь, если спуск длиннее высоты корректного дерева.
+         */
+        const TTreeNode* descend(const TTreeNode* nd, const Element& key, bool& bounded) const;
+
+        /** \brief Дописывает в \c res элементы [lo, hi) поддерева \c nd по порядку, сверяя версию
+         *  \c seq каждые \c SCAN_CHECK_STEPS узлов; возвращает ложь, если версия сменилась или
+         *  обход вышел за пределы корректного дерева.
+         */
+        bool scan(const TTreeNode* nd, const Element& lo, const Element& hi, std::uint64_t seq,
+                  std::vector<Element>& res) const;
+
+    protected:
+        ConcurrentRBTree(const ConcurrentRBTree&);              ///< КК не доступен.
+        ConcurrentRBTree& operator= (const ConcurrentRBTree&);  ///< Оператор присваивания недоступен.
+
+    protected:
+        /** \brief Число оптимистичных попыток чтения до взятия мьютекса. */
+        static const int OPTIMISTIC_ATTEMPTS = 8;
+
+        /** \brief Через сколько узлов обход диапазона сверяет версию. */
+        static const std::size_t SCAN_CHECK_STEPS = 64;
+
+        /** \brief Число независимых счетчиков читателей каждой эпохи. */
+        static const std::size_t READER_SLOTS = 16;
+
+        /** \brief Предельная высота корректного КЧД: 2 log2(n + 1) < 2 * число бит size_t. */
+        static const int MAX_HEIGHT = 2 * std::numeric_limits<std::size_t>::digits;
+
+        static_assert(std::is_trivially_copyable<Element>::value,
+                      "ConcurrentRBTree readers copy elements before they validate the version");
+
+        /** \brief Счетчики читателей четной и нечетной эпох, занимающие кеш-линию целиком. */
+        struct ReaderSlot {
+            std::atomic<std::size_t> count[2];
+            char pad[64 - 2 * sizeof(std::atomic<std::size_t>)];
+        };
+
+    protected:
+        TTree _tree;                                ///< Само дерево; меняется только под \c _writeLock.
+        mutable std::mutex _writeLock;              ///< Сериализует писателей и отчаявшихся читателей.
+        std::atomic<std::uint64_t> _seq;            ///< Версия; нечетна, пока идет запись.
+
+        std::atomic<std::uint64_t> _epoch;          ///< Номер текущей эпохи.
+        mutable ReaderSlot _readers[READER_SLOTS];  ///< Читатели по четности эпохи, в которой начали.
+
+        /** \brief Исключенные из дерева поддеревья, ждущие освобождения, по четности эпохи
+         *  исключения; цепочка идет через указатели на родителя, которые читатели не трогают.
+         */
+        TTreeNode* _retired[2];
+    }; // class ConcurrentRBTree
+
+
+} // namespace xi
+
+
+
+// Подключаем "реализационную" часть
+#include "concurrentrbtree.hpp"
+
+
+#endif // RBTREE_CONCURRENTRBTREE_H_
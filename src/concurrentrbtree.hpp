@@ -0,0 +1,348 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Реализация КЧД с чтением без блокировок параллельно с писателем
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// "Реализация" (шаблонов) методов, описанных в файле concurrentrbtree.h
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdexcept>        // std::logic_error
+#include <thread>           // std::this_thread::yield
+
+
+namespace xi {
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    ConcurrentRBTree<Element, Compar, Allocator, Augment>::ConcurrentRBTree(const Compar& compar,
+                                                                           const Allocator& alloc)
+        : _tree(compar, alloc)
+        , _seq(0)
+        , _epoch(0)
+    {
+        for (std::size_t i = 0; i < READER_SLOTS; ++i)
+        {
+            _readers[i].count[0].store(0, std::memory_order_relaxed);
+            _readers[i].count[1].store(0, std::memory_order_relaxed);
+        }
+        _retired[0] = _retired[1] = nullptr;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    ConcurrentRBTree<Element, Compar, Allocator, Augment>::~ConcurrentRBTree()
+    {
+        releaseRetired(_retired[0]);
+        releaseRetired(_retired[1]);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    bool ConcurrentRBTree<Element, Compar, Allocator, Augment>::tryInsert(const Element& key)
+    {
+        bool inserted = false;
+        write([&key, &inserted](TTree& tree) { inserted = tree.tryInsert(key).second; });
+        return inserted;
+    }
+
+
+#ifdef RBTREE_WITH_DELETION
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    void ConcurrentRBTree<Element, Compar, Allocator, Augment>::remove(const Element& key)
+    {
+        write([this, &key](TTree& tree) {
+            TTreeNode* nd = tree.findNode(key);
+            if (nd == nullptr)
+                throw std::logic_error("No such node!");
+
+            // читатели могут стоять на узле, поэтому он только исключается из дерева
+            tree.unlinkNode(nd);
+            retire(nd);
+        });
+    }
+
+#endif // RBTREE_WITH_DELETION
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    void ConcurrentRBTree<Element, Compar, Allocator, Augment>::clear()
+    {
+        write([this](TTree& tree) {
+            TTreeNode* root = tree._root;
+            tree._root = nullptr;
+            tree._leftmost = tree._rightmost = nullptr;
+            retire(root);
+        });
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    bool ConcurrentRBTree<Element, Compar, Allocator, Augment>::contains(const Element& key) const
+    {
+        bool found = false;
+        read([this, &key, &found](const TTreeNode* root, std::uint64_t) {
+            bool bounded;
+            found = descend(root, key, bounded) != nullptr;
+            return bounded;
+        });
+        return found;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    bool ConcurrentRBTree<Element, Compar, Allocator, Augment>::find(const Element& key, Element& out) const
+    {
+        // копию делаем внутри попытки: после сверки версии узел может быть уже переписан
+        bool found = false;
+        Element copy = key;
+        read([this, &key, &found, &copy](const TTreeNode* root, std::uint64_t) {
+            bool bounded;
+            const TTreeNode* nd = descend(root, key, bounded);
+            found = nd != nullptr;
+            if (found)
+                copy = nd->getKey();
+            return bounded;
+        });
+
+        if (found)
+            out = copy;
+        return found;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    std::vector<Element>
+    ConcurrentRBTree<Element, Compar, Allocator, Augment>::findRange(const Element& lo, const Element& hi) const
+    {
+        std::vector<Element> res;
+        read([this, &lo, &hi, &res](const TTreeNode* root, std::uint64_t seq) {
+            res.clear();
+            return scan(root, lo, hi, seq, res);
+        });
+        return res;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    bool ConcurrentRBTree<Element, Compar, Allocator, Augment>::isEmpty() const
+    {
+        bool empty = true;
+        read([&empty](const TTreeNode* root, std::uint64_t) {
+            empty = root == nullptr;
+            return true;
+        });
+        return empty;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    template <typename Fn>
+    void ConcurrentRBTree<Element, Compar, Allocator, Augment>::write(Fn fn)
+    {
+        std::lock_guard<std::mutex> lock(_writeLock);
+        reclaim();
+
+        // нечетная версия должна стать видна раньше любой записи в узлы
+        const std::uint64_t seq = _seq.load(std::memory_order_relaxed);
+        _seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        // версия закрывается и при исключении: RBTree бросает их, не оставляя дерево разобранным
+        struct Publish {
+            std::atomic<std::uint64_t>& seq;
+            std::uint64_t next;
+            ~Publish() { seq.store(next, std::memory_order_release); }
+        } publish = { _seq, seq + 2 };
+
+        fn(_tree);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    template <typename Attempt>
+    void ConcurrentRBTree<Element, Compar, Allocator, Augment>::read(Attempt attempt) const
+    {
+        // пока отметка в эпохе жива, ни один узел, до которого можно дойти, не будет разрушен
+        struct Leave {
+            std::atomic<std::size_t>& count;
+            ~Leave() { count.fetch_sub(1, std::memory_order_release); }
+        } leave = { enterEpoch() };
+
+        for (int i = 0; i < OPTIMISTIC_ATTEMPTS; ++i)
+        {
+            const std::uint64_t seq = _seq.load(std::memory_order_acquire);
+            if (seq & 1)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            const bool consistent = attempt(_tree.getRoot(), seq);
+
+            // все чтения узлов должны завершиться до повторного чтения версии
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (consistent && _seq.load(std::memory_order_relaxed) == seq)
+                return;
+        }
+
+        // писатели не дают пройти: читаем под мьютексом, там дерево не меняется
+        std::lock_guard<std::mutex> lock(_writeLock);
+        attempt(_tree.getRoot(), _seq.load(std::memory_order_relaxed));
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    void ConcurrentRBTree<Element, Compar, Allocator, Augment>::retire(TTreeNode* nd)
+    {
+        if (nd == nullptr)
+            return;
+
+        // цепочка идет через родителя: у исключенного поддерева его больше нет
+        const std::size_t parity = _epoch.load(std::memory_order_relaxed) & 1;
+        nd->setParent(_retired[parity]);
+        _retired[parity] = nd;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    void ConcurrentRBTree<Element, Compar, Allocator, Augment>::reclaim()
+    {
+        // читатели бывают только текущей и прошлой эпох; прошлая — той же четности, что следующая
+        const std::uint64_t epoch = _epoch.load(std::memory_order_relaxed);
+        const std::size_t prev = (epoch + 1) & 1;
+        for (std::size_t i = 0; i < READER_SLOTS; ++i)
+        {
+            if (_readers[i].count[prev].load(std::memory_order_seq_cst) != 0)
+                return;
+        }
+
+        releaseRetired(_retired[prev]);
+        _retired[prev] = nullptr;
+        _epoch.store(epoch + 1, std::memory_order_seq_cst);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    void ConcurrentRBTree<Element, Compar, Allocator, Augment>::releaseRetired(TTreeNode* nd)
+    {
+        while (nd)
+        {
+            TTreeNode* next = nd->parent();
+            nd->setParent(nullptr);
+            _tree.deleteNode(nd);
+            nd = next;
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    std::atomic<std::size_t>& ConcurrentRBTree<Element, Compar, Allocator, Augment>::enterEpoch() const
+    {
+        // отметка и повторное чтение эпохи упорядочены с ее сменой (все seq_cst): если эпоха не
+        // изменилась, писатель, сменивший ее позже, увидит отметку и не тронет узлы этой эпохи
+        ReaderSlot& slot = _readers[readerSlot()];
+        for (;;)
+        {
+            const std::uint64_t epoch = _epoch.load(std::memory_order_seq_cst);
+            std::atomic<std::size_t>& count = slot.count[epoch & 1];
+            count.fetch_add(1, std::memory_order_seq_cst);
+            if (_epoch.load(std::memory_order_seq_cst) == epoch)
+                return count;
+
+            count.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    std::size_t ConcurrentRBTree<Element, Compar, Allocator, Augment>::readerSlot()
+    {
+        static std::atomic<std::size_t> nextSlot(0);
+        static thread_local const std::size_t slot =
+            nextSlot.fetch_add(1, std::memory_order_relaxed) % READER_SLOTS;
+        return slot;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    const typename ConcurrentRBTree<Element, Compar, Allocator, Augment>::TTreeNode*
+    ConcurrentRBTree<Element, Compar, Allocator, Augment>::descend(const TTreeNode* nd, const Element& key,
+                                                                   bool& bounded) const
+    {
+        // как RBTree::findNode(): ищем самый левый узел не меньше key, равенство проверяем в конце
+        const TTreeNode* candidate = nullptr;
+        int steps = 0;
+        while (nd && steps++ < MAX_HEIGHT)
+        {
+            if (_tree.keyLess(nd->getKey(), key))
+                nd = nd->getRight();
+            else
+            {
+                candidate = nd;
+                nd = nd->getLeft();
+            }
+        }
+
+        bounded = nd == nullptr;
+        if (bounded && candidate && !_tree.keyLess(key, candidate->getKey()))
+            return candidate;
+
+        return nullptr;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    bool ConcurrentRBTree<Element, Compar, Allocator, Augment>::scan(const TTreeNode* nd, const Element& lo,
+                                                                     const Element& hi, std::uint64_t seq,
+                                                                     std::vector<Element>& res) const
+    {
+        // симметричный обход без ссылок на родителей: стек хранит узлы не меньше lo, в левые
+        // поддеревья которых мы уже спустились
+        const TTreeNode* stack[MAX_HEIGHT];
+        int depth = 0;
+        std::size_t steps = 0;
+
+        for (;;)
+        {
+            // спуск к самому левому узлу не меньше lo
+            while (nd)
+            {
+                if (++steps % SCAN_CHECK_STEPS == 0)
+                {
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (_seq.load(std::memory_order_relaxed) != seq)
+                        return false;
+                }
+
+                if (_tree.keyLess(nd->getKey(), lo))
+                    nd = nd->getRight();
+                else
+                {
+                    if (depth == MAX_HEIGHT)
+                        return false;
+                    stack[depth++] = nd;
+                    nd = nd->getLeft();
+                }
+            }
+
+            if (depth == 0)
+                return true;
+
+            const TTreeNode* top = stack[--depth];
+            if (!_tree.keyLess(top->getKey(), hi))
+                return true;
+
+            res.push_back(top->getKey());
+            nd = top->getRight();
+        }
+    }
+
+
+} // namespace xi
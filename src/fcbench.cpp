@@ -0,0 +1,159 @@
+////////////////////////////////////////////////////////////////////////////////
+// Module Name:  fcbench.cpp
+// Authors:      Sergey Shershakov
+// Version:      0.1.0
+// Date:         01.05.2017
+//
+// This is a part of the course "Algorithms and Data Structures"
+// provided by  the School of Software Engineering of the Faculty
+// of Computer Science at the Higher School of Economics.
+//
+// Сравнение пропускной способности RBTree под одним мьютексом и
+// FlatCombiningRBTree при многих писателях. Это инструмент измерения, а не
+// подтверждение выигрыша: комбинирование может окупиться, только когда потоки
+// на разных ядрах действительно борются за мьютекс. На одном ядре его нет:
+// ждущий поток тратит свой квант на ожидание, и при 8 потоках и больше
+// комбинирование медленнее мьютекса.
+//
+// Запуск: rbtree_fc_bench [потоков] [операций на поток] [диапазон ключей]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rbtree.h"
+#include "flatcombiningrbtree.h"
+
+
+using namespace std;
+
+
+/** \brief RBTree под одним мьютексом — точка отсчета. */
+class LockedTree {
+public:
+    bool tryInsert(int key)
+    {
+        lock_guard<mutex> lock(_lock);
+        return _tree.tryInsert(key).second;
+    }
+
+    bool tryRemove(int key)
+    {
+        lock_guard<mutex> lock(_lock);
+        if (!_tree.find(key))
+            return false;
+        _tree.remove(key);
+        return true;
+    }
+
+    bool contains(int key)
+    {
+        lock_guard<mutex> lock(_lock);
+        return _tree.find(key) != nullptr;
+    }
+
+protected:
+    mutex _lock;
+    xi::RBTree<int> _tree;
+};
+
+
+/** \brief FlatCombiningRBTree с тем же интерфейсом. */
+class CombiningTree {
+public:
+    bool tryInsert(int key) { return _tree.tryInsert(key); }
+
+    bool tryRemove(int key) { return _tree.tryRemove(key); }
+
+    bool contains(int key) { return _tree.contains(key); }
+
+protected:
+    xi::FlatCombiningRBTree<int> _tree;
+};
+
+
+/** \brief Гоняет \c threads потоков по \c ops операций (50% поиск, 25% вставка, 25% удаление)
+ *  над ключами [0, range) и возвращает миллионы операций в секунду.
+ */
+template <typename Tree>
+double run(Tree& tree, unsigned threads, unsigned ops, unsigned range)
+{
+    // половина диапазона заполнена заранее, чтобы поиски и удаления находили ключи
+    for (unsigned k = 0; k < range; k += 2)
+        tree.tryInsert(static_cast<int>(k));
+
+    atomic<unsigned> ready(0);
+    atomic<bool> go(false);
+    atomic<unsigned> sink(0);
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.push_back(thread([&tree, &ready, &go, &sink, t, ops, range]() {
+            unsigned rnd = 2654435761u * (t + 1);
+            ++ready;
+            while (!go.load())
+                this_thread::yield();
+
+            // результаты копятся, иначе компилятор выбросит поиск под мьютексом целиком
+            unsigned hits = 0;
+            for (unsigned i = 0; i < ops; ++i)
+            {
+                rnd = rnd * 1103515245u + 12345u;
+                int key = static_cast<int>((rnd >> 8) % range);
+                switch ((rnd >> 4) & 3)
+                {
+                case 0:  hits += tree.tryInsert(key); break;
+                case 1:  hits += tree.tryRemove(key); break;
+                default: hits += tree.contains(key);  break;
+                }
+            }
+            sink += hits;
+        }));
+    }
+
+    while (ready.load() != threads)
+        this_thread::yield();
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    go.store(true);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    return threads * static_cast<double>(ops) / sec / 1e6;
+}
+
+
+int main(int argc, char* argv[])
+{
+    unsigned threads = argc > 1 ? static_cast<unsigned>(atoi(argv[1])) : thread::hardware_concurrency();
+    unsigned ops = argc > 2 ? static_cast<unsigned>(atoi(argv[2])) : 1000000;
+    unsigned range = argc > 3 ? static_cast<unsigned>(atoi(argv[3])) : 100000;
+    if (threads == 0)
+        threads = 1;
+
+    cout << "threads: " << threads << ", ops/thread: " << ops << ", keys: " << range << endl;
+
+    // 1, 2, 4, ... и в конце ровно threads
+    vector<unsigned> counts;
+    for (unsigned t = 1; t < threads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(threads);
+
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        LockedTree locked;
+        CombiningTree combining;
+        double lockedRate = run(locked, counts[i], ops, range);
+        double combiningRate = run(combining, counts[i], ops, range);
+        cout << counts[i] << " threads: mutex " << lockedRate << " Mops/s, flat combining "
+             << combiningRate << " Mops/s" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,178 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Определение КЧД с плоским комбинированием операций писателей
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Обертка над RBTree: потоки публикуют запросы в слоты, а поток, захвативший блокировку,
+/// выполняет все опубликованные запросы пачкой. "Реализация" методов располагается в файле
+/// flatcombiningrbtree.hpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef RBTREE_FLATCOMBININGRBTREE_H_
+#define RBTREE_FLATCOMBININGRBTREE_H_
+
+#include <atomic>           // std::atomic
+#include <cstddef>          // std::size_t
+#include <exception>        // std::exception_ptr
+#include <functional>       // std::less
+#include <memory>           // std::allocator
+#include <mutex>            // std::mutex
+#include <vector>
+
+#include "rbtree.h"
+
+
+namespace xi {
+
+
+/** \brief Красно-черное дерево для многих потоков с плоским комбинированием (flat combining).
+ *
+ *  Вместо того чтобы каждый поток брал мьютекс дерева, поток записывает запрос (операцию и ключ)
+ *  в свободный слот и ждет. Поток, которому удалось взять мьютекс, становится комбинатором: он
+ *  собирает все опубликованные запросы, сортирует их по ключам и выполняет подряд, после чего
+ *  отмечает каждый слот выполненным. Дерево и мьютекс все это время остаются в кэше одного
+ *  ядра, а запросы по соседним ключам идут друг за другом по одним и тем же узлам; ждущие же
+ *  потоки читают только свой слот, занимающий отдельную линию кэша.
+ *
+ *  Все запросы пачки параллельны друг другу, поэтому любой их порядок — допустимая
+ *  линеаризация, в том числе для запросов с равными ключами. Исключение, брошенное
+ *  операцией (например, \c std::logic_error при повторной вставке), передается потоку,
+ *  который ее запросил.
+ *
+ *  Если потоков больше, чем слотов (\c MAX_SLOTS), лишние выполняют свою операцию прямо под
+ *  мьютексом, а затем комбинируют чужие.
+ *
+ *  Окупается это, только когда потоки на разных ядрах постоянно застают мьютекс занятым. Без
+ *  такой борьбы операция идет напрямую и стоит как под простым мьютексом, а на одном ядре
+ *  ждущие потоки тратят свои кванты на ожидание и проигрывают ему (см. fcbench.cpp).
+ *
+ *  \tparam Element, Compar, Allocator, Augment Параметры нижележащего \c RBTree.
+ */
+    template <typename Element,
+              typename Compar = std::less<Element>,
+              typename Allocator = std::allocator<Element>,
+              typename Augment = NoAugment>
+    class FlatCombiningRBTree {
+    public:
+        typedef RBTree<Element, Compar, Allocator, Augment> TTree;
+
+    public:
+        /** \brief Создает пустое дерево с компаратором \c compar и аллокатором \c alloc. */
+        explicit FlatCombiningRBTree(const Compar& compar = Compar(), const Allocator& alloc = Allocator());
+
+    public:
+        /** \brief Вставляет элемент \c key; если он уже есть, генерирует \c std::logic_error,
+         *  как \c RBTree::insert().
+         */
+        void insert(const Element& key) { execute(OP_INSERT, key); }
+
+        /** \brief Вставляет элемент \c key, если его еще нет; возвращает истину, если вставил. */
+        bool tryInsert(const Element& key) { return execute(OP_TRY_INSERT, key); }
+
+#ifdef RBTREE_WITH_DELETION
+        /** \brief Удаляет элемент \c key; если его нет, генерирует \c std::logic_error. */
+        void remove(const Element& key) { execute(OP_REMOVE, key); }
+
+        /** \brief Удаляет элемент \c key, если он есть; возвращает истину, если удалил. */
+        bool tryRemove(const Element& key) { return execute(OP_TRY_REMOVE, key); }
+#endif
+
+        /** \brief Возвращает истину, если элемент, эквивалентный \c key, есть в дереве. */
+        bool contains(const Element& key) const { return execute(OP_FIND, key); }
+
+        /** \brief Выполняет \c fn(tree) под мьютексом дерева, например для обхода. */
+        template <typename Fn>
+        void withTree(Fn fn) const
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            fn(static_cast<const TTree&>(_tree));
+        }
+
+    protected:
+        /** \brief Операции, которые можно запросить через слот. */
+        enum OpCode {
+            OP_FIND,
+            OP_INSERT,
+            OP_TRY_INSERT,
+            OP_REMOVE,
+            OP_TRY_REMOVE
+        };
+
+        /** \brief Состояния слота. */
+        enum SlotState {
+            SLOT_FREE,                              ///< Никем не занят.
+            SLOT_CLAIMED,                           ///< Занят потоком, запрос еще пишется.
+            SLOT_PENDING,                           ///< Запрос опубликован и ждет комбинатора.
+            SLOT_DONE                               ///< Выполнен; результат еще не забран.
+        };
+
+        static const std::size_t CACHE_LINE = 64;   ///< Предполагаемый размер линии кэша.
+
+        /** \brief Слот запроса; отступ в линию кэша не дает полям соседних слотов делить линию. */
+        struct Slot {
+            std::atomic<int> state;                 ///< Одно из \c SlotState.
+            OpCode op;                              ///< Запрошенная операция.
+            const Element* key;                     ///< Ключ; живет у ждущего потока.
+            bool result;                            ///< Результат: найден / вставлен / удален.
+            std::exception_ptr error;               ///< Исключение операции, если было.
+            char pad[CACHE_LINE];
+
+            Slot() : state(SLOT_FREE), op(OP_FIND), key(nullptr), result(false) {}
+        }; // struct Slot
+
+        /** \brief Выполняет запрос \c op над \c key и возвращает результат или бросает исключение
+         *  операции.
+         *
+         *  Если мьютекс свободен, запрос выполняется сразу, а затем и опубликованные чужие. Иначе
+         *  запрос публикуется в слоте и ждет комбинатора — или сам становится им.
+         */
+        bool execute(OpCode op, const Element& key) const;
+
+        /** \brief Выполняет опубликованные запросы пачками, пока они появляются, но не больше
+         *  \c COMBINE_ROUNDS раз. Вызывается под \c _lock.
+         */
+        void combine() const;
+
+        /** \brief Собирает в \c _batch опубликованные запросы из первых \c inUse слотов; память
+         *  под пачку зарезервирована, так что ничего не выделяется.
+         */
+        void collectPending(std::size_t inUse) const;
+
+        /** \brief Выполняет запрос \c op над \c key; результат — найден / вставлен / удален. */
+        bool apply(OpCode op, const Element& key) const;
+
+    protected:
+        FlatCombiningRBTree(const FlatCombiningRBTree&);             ///< КК не доступен.
+        FlatCombiningRBTree& operator= (const FlatCombiningRBTree&); ///< Оператор присваивания недоступен.
+
+    protected:
+        static const std::size_t MAX_SLOTS = 64;    ///< Число слотов запросов.
+        static const int COMBINE_ROUNDS = 4;        ///< Предельное число пачек за один захват.
+        static const int SPIN_LIMIT = 128;          ///< Проверок слота между попытками взять мьютекс.
+
+        mutable TTree _tree;                        ///< Само дерево; меняется только под \c _lock.
+        mutable std::mutex _lock;                   ///< Держит комбинатор.
+        mutable Slot _slots[MAX_SLOTS];             ///< Слоты запросов.
+        mutable std::vector<Slot*> _batch;          ///< Буфер пачки комбинатора (под \c _lock).
+
+        /** \brief Граница занимавшихся когда-либо слотов: комбинатор просматривает только их. */
+        mutable std::atomic<std::size_t> _slotsInUse;
+    }; // class FlatCombiningRBTree
+
+
+} // namespace xi
+
+
+
+// Подключаем "реализационную" часть
+#include "flatcombiningrbtree.hpp"
+
+
+#endif // RBTREE_FLATCOMBININGRBTREE_H_
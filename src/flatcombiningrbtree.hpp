@@ -0,0 +1,200 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Реализация КЧД с плоским комбинированием операций писателей
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// "Реализация" (шаблонов) методов, описанных в файле flatcombiningrbtree.h
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>        // std::sort
+#include <thread>           // std::this_thread
+
+
+namespace xi {
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    FlatCombiningRBTree<Element, Compar, Allocator, Augment>::FlatCombiningRBTree(const Compar& compar,
+                                                                                 const Allocator& alloc)
+        : _tree(compar, alloc)
+        , _slotsInUse(0)
+    {
+        // комбинатор не должен ничего выделять: исключение оставило бы слоты невыполненными
+        _batch.reserve(MAX_SLOTS);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    bool FlatCombiningRBTree<Element, Compar, Allocator, Augment>::execute(OpCode op, const Element& key) const
+    {
+        // мьютекс свободен — конкуренции нет, и публиковать запрос незачем
+        {
+            std::unique_lock<std::mutex> lock(_lock, std::try_to_lock);
+            if (lock.owns_lock())
+            {
+                bool res = apply(op, key);
+                combine();
+                return res;
+            }
+        }
+
+        // поиск свободного слота начинается со "своего": номера потокам раздаются подряд, так что
+        // при k потоках заняты в основном первые k слотов, и комбинатор просматривает только их
+        static std::atomic<unsigned> threadCount(0);
+        static thread_local unsigned ownSlot = threadCount.fetch_add(1) % MAX_SLOTS;
+
+        Slot* slot = nullptr;
+        for (std::size_t i = 0; i < MAX_SLOTS && !slot; ++i)
+        {
+            std::size_t idx = (ownSlot + i) % MAX_SLOTS;
+            Slot& s = _slots[idx];
+            int expected = SLOT_FREE;
+            if (s.state.load(std::memory_order_relaxed) == SLOT_FREE
+                && s.state.compare_exchange_strong(expected, SLOT_CLAIMED, std::memory_order_acquire))
+            {
+                slot = &s;
+
+                std::size_t inUse = _slotsInUse.load(std::memory_order_relaxed);
+                while (inUse <= idx
+                       && !_slotsInUse.compare_exchange_weak(inUse, idx + 1, std::memory_order_relaxed))
+                {
+                }
+            }
+        }
+
+        // все слоты заняты: выполняем свою операцию сами, а заодно и чужие
+        if (!slot)
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            bool res = apply(op, key);
+            combine();
+            return res;
+        }
+
+        slot->op = op;
+        slot->key = &key;
+        slot->state.store(SLOT_PENDING, std::memory_order_release);
+
+        while (slot->state.load(std::memory_order_acquire) != SLOT_DONE)
+        {
+            // первая же пачка комбинатора забирает все опубликованные запросы, в т. ч. наш
+            std::unique_lock<std::mutex> lock(_lock, std::try_to_lock);
+            if (lock.owns_lock())
+            {
+                combine();
+                continue;
+            }
+
+            for (int i = 0; i < SPIN_LIMIT; ++i)
+                if (slot->state.load(std::memory_order_acquire) == SLOT_DONE)
+                    break;
+            std::this_thread::yield();
+        }
+
+        // результат имеет смысл, только если операция не бросила исключение
+        std::exception_ptr error = slot->error;
+        slot->error = nullptr;
+        const bool res = error ? false : slot->result;
+        slot->state.store(SLOT_FREE, std::memory_order_release);
+
+        if (error)
+            std::rethrow_exception(error);
+        return res;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    void FlatCombiningRBTree<Element, Compar, Allocator, Augment>::combine() const
+    {
+        const KeyLess<Compar> less(_tree.getCompar());
+        for (int round = 0; round < COMBINE_ROUNDS; ++round)
+        {
+            // слот публикуется после того, как учтен в _slotsInUse, поэтому граница не упустит его
+            const std::size_t inUse = _slotsInUse.load(std::memory_order_acquire);
+            collectPending(inUse);
+            if (_batch.empty())
+                return;
+
+            // по возрастанию ключей пачка идет по дереву "гребенкой": соседние запросы проходят
+            // по уже прогретым узлам
+            try
+            {
+                std::sort(_batch.begin(), _batch.end(), [&less](const Slot* a, const Slot* b) {
+                    return less(*a->key, *b->key);
+                });
+            }
+            catch (...)
+            {
+                // прерванная сортировка могла потерять или повторить указатели, а потерянный слот
+                // ждал бы вечно: пачка собирается заново и выполняется в порядке слотов
+                collectPending(inUse);
+            }
+
+            for (std::size_t i = 0; i < _batch.size(); ++i)
+            {
+                Slot* s = _batch[i];
+                try
+                {
+                    s->result = apply(s->op, *s->key);
+                }
+                catch (...)
+                {
+                    s->result = false;
+                    s->error = std::current_exception();
+                }
+                s->state.store(SLOT_DONE, std::memory_order_release);
+            }
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    void FlatCombiningRBTree<Element, Compar, Allocator, Augment>::collectPending(std::size_t inUse) const
+    {
+        _batch.clear();
+        for (std::size_t i = 0; i < inUse; ++i)
+            if (_slots[i].state.load(std::memory_order_acquire) == SLOT_PENDING)
+                _batch.push_back(&_slots[i]);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment>
+    bool FlatCombiningRBTree<Element, Compar, Allocator, Augment>::apply(OpCode op, const Element& key) const
+    {
+        switch (op)
+        {
+        case OP_FIND:
+            return _tree.find(key) != nullptr;
+
+        case OP_INSERT:
+            _tree.insert(key);
+            return true;
+
+        case OP_TRY_INSERT:
+            return _tree.tryInsert(key).second;
+
+#ifdef RBTREE_WITH_DELETION
+        case OP_REMOVE:
+            _tree.remove(key);
+            return true;
+
+        case OP_TRY_REMOVE:
+            if (!_tree.find(key))
+                return false;
+            _tree.remove(key);
+            return true;
+#endif
+
+        default:
+            return false;
+        }
+    }
+
+
+} // namespace xi
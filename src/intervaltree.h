@@ -0,0 +1,177 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Определение дерева интервалов на основе красно-черного дерева
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Дерево интервалов — это RBTree, упорядоченное по началам интервалов, с аугментацией
+/// "максимальный конец в поддереве". "Реализация" методов располагается в файле
+/// intervaltree.hpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef RBTREE_INTERVALTREE_H_
+#define RBTREE_INTERVALTREE_H_
+
+#include <limits>           // std::numeric_limits
+#include <memory>           // std::allocator
+#include <utility>          // std::pair
+#include <vector>
+
+#include "rbtree.h"
+
+
+namespace xi {
+
+
+/** \brief Замкнутый интервал [low, high] значений типа \c T. */
+    template <typename T>
+    struct Interval {
+        T low;                                      ///< Начало интервала.
+        T high;                                     ///< Конец интервала (включительно).
+
+        /** \brief Возвращает истину, если интервал пересекается с [lo, hi]. */
+        bool overlaps(const T& lo, const T& hi) const { return !(hi < low) && !(high < lo); }
+    }; // struct Interval
+
+
+/** \brief Порядок интервалов: по началу, при равных началах — по концу. */
+    template <typename T>
+    struct IntervalLess {
+        bool operator()(const Interval<T>& a, const Interval<T>& b) const
+        {
+            if (a.low < b.low)
+                return true;
+            if (b.low < a.low)
+                return false;
+            return a.high < b.high;
+        }
+    }; // struct IntervalLess
+
+
+/** \brief Политика аугментации: наибольший конец интервалов поддерева.
+ *
+ *  Нейтральный элемент — \c std::numeric_limits<T>::lowest(), поэтому \c T должен быть
+ *  арифметическим или иметь соответствующую специализацию \c std::numeric_limits.
+ */
+    template <typename T>
+    struct MaxEndAugment {
+        typedef T value_type;
+
+        static value_type identity() { return std::numeric_limits<T>::lowest(); }
+        static value_type fromElement(const Interval<T>& e) { return e.high; }
+        static value_type combine(const value_type& a, const value_type& b) { return a < b ? b : a; }
+    }; // struct MaxEndAugment
+
+
+/** \brief Дерево интервалов: множество замкнутых интервалов с запросами пересечения и протыкания.
+ *
+ *  Интервалы хранятся в \c RBTree по порядку \c IntervalLess, а каждый узел хранит наибольший
+ *  конец интервалов своего поддерева (\c MaxEndAugment). Этот агрегат поддерживается самим
+ *  деревом при вставке, удалении, поворотах и восстановлении после удаления. Запрос спускается
+ *  только в поддеревья, которые могут содержать пересечения: поддерево с максимальным концом
+ *  левее запроса отсекается целиком, а правые поддеревья узлов, начинающихся правее запроса,
+ *  не посещаются. Поиск одного пересечения выполняется за O(log n). Перечисление всех \c k
+ *  пересечений обходит не более O(k log n) узлов и никогда не больше n.
+ *
+ *  Одинаковые интервалы хранятся один раз. Если нужно различать совпадающие интервалы,
+ *  их следует сделать различными, например за счет идентификатора в \c T.
+ *
+ *  \tparam T Тип концов интервалов; нужны \c operator< и \c std::numeric_limits<T>::lowest().
+ *  \tparam Allocator Аллокатор узлов, как у \c RBTree.
+ */
+    template <typename T, typename Allocator = std::allocator<Interval<T> > >
+    class IntervalTree {
+    public:
+        typedef Interval<T> TInterval;
+        typedef RBTree<TInterval, IntervalLess<T>, Allocator, MaxEndAugment<T> > TTree;
+        typedef typename TTree::Node TTreeNode;
+
+    public:
+        IntervalTree() {}
+
+        /** \brief Создает пустое дерево, узлы которого размещаются аллокатором \c alloc. */
+        explicit IntervalTree(const Allocator& alloc) : _tree(alloc) {}
+
+    public:
+        // Изменение множества интервалов
+
+        /** \brief Добавляет интервал [lo, hi].
+         *
+         *  Если \c hi меньше \c lo, генерирует \c std::invalid_argument. Если такой интервал уже
+         *  есть, генерирует \c std::logic_error, как \c RBTree::insert().
+         */
+        void insert(const T& lo, const T& hi);
+
+        /** \brief Удаляет интервал [lo, hi]. Если его нет, генерирует \c std::logic_error. */
+        void remove(const T& lo, const T& hi);
+
+        /** \brief Возвращает истину, если интервал [lo, hi] есть в дереве. */
+        bool contains(const T& lo, const T& hi) const
+        {
+            TInterval iv = { lo, hi };
+            std::pair<typename TTree::ConstIterator, typename TTree::ConstIterator> eq = _tree.equalRange(iv);
+            return eq.first != eq.second;
+        }
+
+        /** \brief Возвращает истину, если дерево пусто. */
+        bool isEmpty() const { return _tree.isEmpty(); }
+
+    public:
+        // Запросы
+
+        /** \brief Возвращает какой-нибудь интервал, пересекающийся с [lo, hi], или \c nullptr
+         *  за O(log n).
+         */
+        const TInterval* findAnyOverlapping(const T& lo, const T& hi) const;
+
+        /** \brief Вызывает \c visitor(interval) для каждого интервала, пересекающегося с [lo, hi],
+         *  в порядке возрастания интервалов.
+         */
+        template <typename Visitor>
+        void forEachOverlapping(const T& lo, const T& hi, Visitor visitor) const
+        {
+            if (!(hi < lo))
+                forEachOverlappingPrv(_tree.getRoot(), lo, hi, visitor);
+        }
+
+        /** \brief Возвращает все интервалы, пересекающиеся с [lo, hi], в порядке возрастания. */
+        std::vector<TInterval> findOverlapping(const T& lo, const T& hi) const;
+
+        /** \brief Возвращает все интервалы, содержащие точку \c t ("протыкающий" запрос). */
+        std::vector<TInterval> findContaining(const T& t) const { return findOverlapping(t, t); }
+
+        /** \brief Возвращает нижележащее КЧД, например для обхода всех интервалов по порядку. */
+        const TTree& getTree() const { return _tree; }
+
+    protected:
+        /** \brief Обходит поддерево \c nd, отсекая ветви без пересечений с [lo, hi].
+         *
+         *  Глубина рекурсии не превышает высоты дерева.
+         */
+        template <typename Visitor>
+        static void forEachOverlappingPrv(const TTreeNode* nd, const T& lo, const T& hi, Visitor& visitor);
+
+    protected:
+        IntervalTree(const IntervalTree&);          ///< КК не доступен.
+        IntervalTree& operator= (const IntervalTree&);  ///< Оператор присваивания недоступен.
+
+    protected:
+        TTree _tree;                                ///< Интервалы с аугментацией по концам.
+    }; // class IntervalTree
+
+
+} // namespace xi
+
+
+
+// Подключаем "реализационную" часть
+#include "intervaltree.hpp"
+
+
+#endif // RBTREE_INTERVALTREE_H_
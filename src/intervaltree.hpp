@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Реализация дерева интервалов на основе красно-черного дерева
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// "Реализация" (шаблонов) методов, описанных в файле intervaltree.h
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdexcept>        // std::invalid_argument
+
+
+namespace xi {
+
+
+    template <typename T, typename Allocator>
+    void IntervalTree<T, Allocator>::insert(const T& lo, const T& hi)
+    {
+        if (hi < lo)
+            throw std::invalid_argument("Interval end precedes its start");
+
+        TInterval iv = { lo, hi };
+        _tree.insert(iv);
+    }
+
+
+    template <typename T, typename Allocator>
+    void IntervalTree<T, Allocator>::remove(const T& lo, const T& hi)
+    {
+        TInterval iv = { lo, hi };
+        _tree.remove(iv);
+    }
+
+
+    template <typename T, typename Allocator>
+    const typename IntervalTree<T, Allocator>::TInterval*
+    IntervalTree<T, Allocator>::findAnyOverlapping(const T& lo, const T& hi) const
+    {
+        if (hi < lo)
+            return nullptr;
+
+        // если в левом поддереве есть конец не левее lo, то либо пересечение есть в нем,
+        // либо его нет и справа: все интервалы справа начинаются не раньше, чем в левом
+        const TTreeNode* nd = _tree.getRoot();
+        while (nd && !nd->getKey().overlaps(lo, hi))
+        {
+            if (nd->getLeft() && !(nd->getLeft()->getAugment() < lo))
+                nd = nd->getLeft();
+            else
+                nd = nd->getRight();
+        }
+
+        return nd ? &nd->getKey() : nullptr;
+    }
+
+
+    template <typename T, typename Allocator>
+    std::vector<typename IntervalTree<T, Allocator>::TInterval>
+    IntervalTree<T, Allocator>::findOverlapping(const T& lo, const T& hi) const
+    {
+        std::vector<TInterval> res;
+        forEachOverlapping(lo, hi, [&res](const TInterval& iv) { res.push_back(iv); });
+        return res;
+    }
+
+
+    template <typename T, typename Allocator>
+    template <typename Visitor>
+    void IntervalTree<T, Allocator>::forEachOverlappingPrv(const TTreeNode* nd, const T& lo, const T& hi,
+                                                           Visitor& visitor)
+    {
+        while (nd)
+        {
+            // все концы поддерева левее запроса
+            if (nd->getAugment() < lo)
+                return;
+
+            forEachOverlappingPrv(nd->getLeft(), lo, hi, visitor);
+
+            // этот узел и все его правое поддерево начинаются правее запроса
+            if (hi < nd->getKey().low)
+                return;
+
+            if (!(nd->getKey().high < lo))
+                visitor(nd->getKey());
+
+            // правое поддерево — итерацией, чтобы рекурсия шла только влево
+            nd = nd->getRight();
+        }
+    }
+
+
+} // namespace xi
@@ -0,0 +1,251 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Определение персистентного КЧД с копированием пути
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Персистентное КЧД: изменение копирует только узлы на пути от корня, остальные
+/// разделяются с прежними версиями, поэтому снимок дерева стоит O(1). "Реализация"
+/// методов располагается в файле persistentrbtree.hpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef RBTREE_PERSISTENTRBTREE_H_
+#define RBTREE_PERSISTENTRBTREE_H_
+
+#include <atomic>           // std::atomic
+#include <cstddef>          // std::size_t
+#include <functional>       // std::less
+#include <limits>           // std::numeric_limits
+#include <memory>           // std::allocator, std::allocator_traits
+
+
+namespace xi {
+
+
+/** \brief Персистентное красно-черное дерево: множество с мгновенными снимками.
+ *
+ *  Узлы не имеют ссылок на родителей и не меняются, пока ими владеет больше одной версии
+ *  дерева. Вставка и удаление спускаются от корня, копируя каждый разделяемый узел на пути
+ *  (а при перебалансировке — и задетых братьев и племянников), и меняют уже собственные копии
+ *  обычными поворотами и перекрашиваниями. Так каждое изменение создает O(log n) узлов, а
+ *  нетронутые поддеревья остаются общими со всеми снимками.
+ *
+ *  Снимок — это копия дерева (конструктор копирования или \c snapshot()): он стоит O(1) и
+ *  лишь увеличивает счетчик ссылок корня. Узлы освобождаются, когда на них не остается ссылок
+ *  ни из одной версии. Счетчики атомарны, поэтому разные версии можно читать, менять и
+ *  уничтожать в разных потоках одновременно; одну и ту же версию, как и стандартные
+ *  контейнеры, нельзя менять параллельно с любым другим обращением к ней.
+ *
+ *  В отличие от \c RBTree, узлы берутся прямо у аллокатора, а не из \c NodePool: пул не защищен
+ *  от гонок, а последняя ссылка на узел может исчезнуть в любом потоке.
+ *
+ *  Указатели на элементы, полученные из версии, действительны, пока эта версия не изменена
+ *  и не уничтожена; снимки, сделанные до изменения, продолжают видеть прежние элементы.
+ *
+ *  \tparam Element Тип элементов; должен быть копируемым.
+ *  \tparam Compar Строгий слабый порядок на элементах, как у \c RBTree.
+ *  \tparam Allocator Аллокатор узлов; его копии в разных версиях должны быть равны.
+ */
+    template <typename Element,
+              typename Compar = std::less<Element>,
+              typename Allocator = std::allocator<Element> >
+    class PersistentRBTree {
+    public:
+        /** \brief Тип цвета узла дерева. */
+        enum Color
+        {
+            BLACK,
+            RED
+        };
+
+        /** \brief Узел персистентного КЧД, возможно, общий для нескольких версий дерева. */
+        class Node {
+            friend class PersistentRBTree<Element, Compar, Allocator>;
+
+        public:
+            /** \brief Возвращает константную ссылку на хранимый элемент. */
+            const Element& getKey() const { return _key; }
+
+            /** \brief Возвращает левого потомка. */
+            const Node* getLeft() const { return _left; }
+
+            /** \brief Возвращает правого потомка. */
+            const Node* getRight() const { return _right; }
+
+            /** \brief Возвращает цвет узла. */
+            Color getColor() const { return _color; }
+
+            /** \brief Возвращает истину, если узел принадлежит нескольким версиям дерева
+             *  (или поддеревьям разных узлов).
+             */
+            bool isShared() const { return _refs.load(std::memory_order_acquire) > 1; }
+
+        protected:
+            Node(const Element& key, Node* left, Node* right, Color col)
+                : _key(key), _left(left), _right(right), _refs(1), _color(col)
+            {
+            }
+
+        protected:
+            Node(const Node&);                      ///< КК не доступен.
+            Node& operator= (const Node&);          ///< Оператор присваивания недоступен.
+
+        protected:
+            Element _key;                           ///< Хранимый элемент.
+            Node*   _left;                          ///< Левый потомок (владеющая ссылка).
+            Node*   _right;                         ///< Правый потомок (владеющая ссылка).
+            std::atomic<std::size_t> _refs;         ///< Число владеющих ссылок на узел.
+            Color   _color;                         ///< Цвет узла.
+        }; // class Node
+
+    public:
+        /** \brief Создает пустое дерево с компаратором \c compar и аллокатором \c alloc. */
+        explicit PersistentRBTree(const Compar& compar = Compar(), const Allocator& alloc = Allocator());
+
+        /** \brief Снимок дерева \c other за O(1): все узлы становятся общими. */
+        PersistentRBTree(const PersistentRBTree& other);
+
+        /** \brief Забирает узлы \c other, оставляя его пустым. */
+        PersistentRBTree(PersistentRBTree&& other);
+
+        ~PersistentRBTree();
+
+        /** \brief Делает дерево снимком \c other за O(1) плюс освобождение прежних узлов. */
+        PersistentRBTree& operator= (const PersistentRBTree& other);
+
+        /** \brief Забирает узлы \c other, оставляя его пустым. */
+        PersistentRBTree& operator= (PersistentRBTree&& other);
+
+    public:
+        // Изменение
+
+        /** \brief Вставляет элемент \c key за O(log n), копируя узлы на пути.
+         *
+         *  Если такой элемент уже есть, генерирует \c std::logic_error, как \c RBTree::insert().
+         */
+        void insert(const Element& key);
+
+        /** \brief Вставляет элемент \c key, если его еще нет; возвращает истину, если вставил. */
+        bool tryInsert(const Element& key);
+
+        /** \brief Удаляет элемент \c key за O(log n), копируя узлы на пути.
+         *
+         *  Если такого элемента нет, генерирует \c std::logic_error.
+         */
+        void remove(const Element& key);
+
+        /** \brief Делает дерево пустым; узлы, не нужные больше ни одной версии, освобождаются. */
+        void clear();
+
+    public:
+        // Чтение
+
+        /** \brief Возвращает снимок дерева; то же, что копия. */
+        PersistentRBTree snapshot() const { return *this; }
+
+        /** \brief Возвращает указатель на элемент, эквивалентный \c key, или \c nullptr. */
+        const Element* find(const Element& key) const;
+
+        /** \brief Возвращает истину, если элемент, эквивалентный \c key, есть в дереве. */
+        bool contains(const Element& key) const { return find(key) != nullptr; }
+
+        /** \brief Вызывает \c visitor(element) для всех элементов по возрастанию. */
+        template <typename Visitor>
+        void forEach(Visitor visitor) const { forEachPrv(_root, visitor); }
+
+        /** \brief Возвращает число элементов. */
+        std::size_t getSize() const { return _size; }
+
+        /** \brief Возвращает истину, если дерево пусто. */
+        bool isEmpty() const { return _root == nullptr; }
+
+        /** \brief Возвращает корень дерева (например, для проверки свойств КЧД). */
+        const Node* getRoot() const { return _root; }
+
+    protected:
+        /** \brief Вставляет \c key; если он уже есть, возвращает ложь, ничего не меняя. */
+        bool insertPrv(const Element& key);
+
+        /** \brief Проходит от корня к \c key, копируя разделяемые узлы, и записывает в \c links
+         *  адреса ссылок на узлы пути (начиная с \c &_root). Возвращает длину пути, последняя
+         *  ссылка которого указывает на узел \c key или равна \c nullptr.
+         *
+         *  Элемент \c key уже должен быть (или точно не быть) в дереве: проверка делается
+         *  заранее, без копирования.
+         */
+        int copyPath(const Element& key, Node** links[]);
+
+        /** \brief Восстанавливает свойства КЧД после вставки красного узла в конец пути. */
+        void insertFixUp(Node** links[], int depth);
+
+        /** \brief Восстанавливает свойства КЧД после удаления черного узла, на место которого
+         *  встала ссылка \c links[depth - 1] ("дважды черная").
+         */
+        void deleteFixUp(Node** links[], int depth);
+
+        /** \brief Делает узел по ссылке \c link собственным для этой версии: если он разделяемый,
+         *  заменяет его копией. Родитель ссылки должен быть уже собственным.
+         */
+        void unshare(Node*& link);
+
+        /** \brief Поворачивает поддерево с корнем \c nd влево (\c left) или вправо и возвращает
+         *  новый корень. Оба участвующих узла должны быть собственными.
+         */
+        static Node* rotate(Node* nd, bool left);
+
+        /** \brief Возвращает истину, если узел красный; пустой узел считается черным. */
+        static bool isRed(const Node* nd) { return nd && nd->_color == RED; }
+
+        /** \brief Создает узел с одной ссылкой на него. */
+        Node* createNode(const Element& key, Node* left, Node* right, Color col);
+
+        /** \brief Забирает ссылку на \c nd (если он не пуст); последняя ссылка освобождает узел
+         *  и, рекурсивно, ссылки на его потомков.
+         */
+        void release(Node* nd);
+
+        /** \brief Добавляет ссылку на \c nd, если он не пуст, и возвращает его. */
+        static Node* acquire(Node* nd)
+        {
+            if (nd)
+                nd->_refs.fetch_add(1, std::memory_order_relaxed);
+            return nd;
+        }
+
+        /** \brief Обходит поддерево \c nd по порядку. */
+        template <typename Visitor>
+        static void forEachPrv(const Node* nd, Visitor& visitor);
+
+    protected:
+        // аллокатор, перепривязанный к узлам
+        typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Node> NodeAlloc;
+        typedef std::allocator_traits<NodeAlloc> NodeAllocTraits;
+
+        /** \brief Предельная длина пути в КЧД: 2 log2(n + 1) < 2 * число бит size_t; еще одно
+         *  место нужно на случай, когда удаление поворотом опускает родителя на уровень ниже.
+         */
+        static const int MAX_PATH = 2 * std::numeric_limits<std::size_t>::digits + 2;
+
+    protected:
+        Node*       _root;                          ///< Корень этой версии (владеющая ссылка).
+        std::size_t _size;                          ///< Число элементов.
+        Compar      _compar;                        ///< Компаратор сравнения двух элементов.
+        NodeAlloc   _alloc;                         ///< Аллокатор узлов.
+    }; // class PersistentRBTree
+
+
+} // namespace xi
+
+
+
+// Подключаем "реализационную" часть
+#include "persistentrbtree.hpp"
+
+
+#endif // RBTREE_PERSISTENTRBTREE_H_
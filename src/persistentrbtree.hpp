@@ -0,0 +1,401 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Реализация персистентного КЧД с копированием пути
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// "Реализация" (шаблонов) методов, описанных в файле persistentrbtree.h
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <new>              // placement new
+#include <stdexcept>        // std::logic_error
+
+
+namespace xi {
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    PersistentRBTree<Element, Compar, Allocator>::PersistentRBTree(const Compar& compar, const Allocator& alloc)
+        : _root(nullptr)
+        , _size(0)
+        , _compar(compar)
+        , _alloc(alloc)
+    {
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    PersistentRBTree<Element, Compar, Allocator>::PersistentRBTree(const PersistentRBTree& other)
+        : _root(acquire(other._root))
+        , _size(other._size)
+        , _compar(other._compar)
+        , _alloc(other._alloc)
+    {
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    PersistentRBTree<Element, Compar, Allocator>::PersistentRBTree(PersistentRBTree&& other)
+        : _root(other._root)
+        , _size(other._size)
+        , _compar(other._compar)
+        , _alloc(other._alloc)
+    {
+        other._root = nullptr;
+        other._size = 0;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    PersistentRBTree<Element, Compar, Allocator>::~PersistentRBTree()
+    {
+        release(_root);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    PersistentRBTree<Element, Compar, Allocator>&
+    PersistentRBTree<Element, Compar, Allocator>::operator= (const PersistentRBTree& other)
+    {
+        // сначала ссылка на новый корень, потом отказ от старого: так безопасно и самоприсваивание
+        Node* root = acquire(other._root);
+        release(_root);
+        _root = root;
+        _size = other._size;
+        _compar = other._compar;
+        return *this;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    PersistentRBTree<Element, Compar, Allocator>&
+    PersistentRBTree<Element, Compar, Allocator>::operator= (PersistentRBTree&& other)
+    {
+        if (this != &other)
+        {
+            release(_root);
+            _root = other._root;
+            _size = other._size;
+            _compar = other._compar;
+            other._root = nullptr;
+            other._size = 0;
+        }
+        return *this;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void PersistentRBTree<Element, Compar, Allocator>::insert(const Element& key)
+    {
+        if (!insertPrv(key))
+            throw std::logic_error("Tree already has such key!");
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    bool PersistentRBTree<Element, Compar, Allocator>::tryInsert(const Element& key)
+    {
+        return insertPrv(key);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void PersistentRBTree<Element, Compar, Allocator>::remove(const Element& key)
+    {
+        // проверка без копирования: отсутствующий элемент не должен расщеплять общие узлы
+        if (!find(key))
+            throw std::logic_error("No such node!");
+
+        Node** links[MAX_PATH];
+        int depth = copyPath(key, links);
+
+        // у узла с двумя потомками забираем элемент следующего и удаляем уже следующий узел
+        Node* z = *links[depth - 1];
+        if (z->_left && z->_right)
+        {
+            Node** link = &z->_right;
+            for (;;)
+            {
+                unshare(*link);
+                links[depth++] = link;
+                if (!(*link)->_left)
+                    break;
+                link = &(*link)->_left;
+            }
+            z->_key = (*link)->_key;
+        }
+
+        // удаляемый узел собственный и имеет не больше одного потомка, который встает на его место
+        Node* y = *links[depth - 1];
+        Color yColor = y->_color;
+        *links[depth - 1] = y->_left ? y->_left : y->_right;
+        y->_left = y->_right = nullptr;
+        release(y);
+        --_size;
+
+        if (yColor == BLACK)
+            deleteFixUp(links, depth);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void PersistentRBTree<Element, Compar, Allocator>::clear()
+    {
+        release(_root);
+        _root = nullptr;
+        _size = 0;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    const Element* PersistentRBTree<Element, Compar, Allocator>::find(const Element& key) const
+    {
+        const Node* nd = _root;
+        while (nd)
+        {
+            if (_compar(key, nd->_key))
+                nd = nd->_left;
+            else if (_compar(nd->_key, key))
+                nd = nd->_right;
+            else
+                return &nd->_key;
+        }
+
+        return nullptr;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    bool PersistentRBTree<Element, Compar, Allocator>::insertPrv(const Element& key)
+    {
+        if (find(key))
+            return false;
+
+        Node** links[MAX_PATH];
+        int depth = copyPath(key, links);
+
+        *links[depth - 1] = createNode(key, nullptr, nullptr, RED);
+        ++_size;
+
+        insertFixUp(links, depth);
+        return true;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    int PersistentRBTree<Element, Compar, Allocator>::copyPath(const Element& key, Node** links[])
+    {
+        int depth = 0;
+        Node** link = &_root;
+        for (;;)
+        {
+            links[depth++] = link;
+            if (!*link)
+                return depth;
+
+            // родитель уже собственный, поэтому счетчик ссылок узла точно говорит, общий ли он
+            unshare(*link);
+            Node* nd = *link;
+            if (_compar(key, nd->_key))
+                link = &nd->_left;
+            else if (_compar(nd->_key, key))
+                link = &nd->_right;
+            else
+                return depth;
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void PersistentRBTree<Element, Compar, Allocator>::insertFixUp(Node** links[], int depth)
+    {
+        // links[i] — ссылка на текущий красный узел; у красного родителя всегда есть дед
+        int i = depth - 1;
+        while (i >= 2 && isRed(*links[i - 1]))
+        {
+            Node* par = *links[i - 1];
+            Node* grand = *links[i - 2];
+            bool parLeft = grand->_left == par;
+            Node*& uncle = parLeft ? grand->_right : grand->_left;
+
+            // красный дядя: перекрашиваем и поднимаемся на два уровня
+            if (isRed(uncle))
+            {
+                unshare(uncle);
+                uncle->_color = BLACK;
+                par->_color = BLACK;
+                grand->_color = RED;
+                i -= 2;
+                continue;
+            }
+
+            // внутренний внук сначала поворотом становится внешним
+            if ((par->_left == *links[i]) != parLeft)
+                *links[i - 1] = rotate(par, parLeft);
+
+            Node* top = rotate(grand, !parLeft);
+            *links[i - 2] = top;
+            top->_color = BLACK;
+            grand->_color = RED;
+            break;
+        }
+
+        _root->_color = BLACK;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void PersistentRBTree<Element, Compar, Allocator>::deleteFixUp(Node** links[], int depth)
+    {
+        // *links[i] — "дважды черный" x (возможно, пустой); все узлы пути над ним собственные
+        int i = depth - 1;
+        while (i > 0 && !isRed(*links[i]))
+        {
+            Node* par = *links[i - 1];
+            bool xLeft = links[i] == &par->_left;
+
+            // брат x не пуст, иначе черные высоты не сходились бы и до удаления
+            Node*& sibling = xLeft ? par->_right : par->_left;
+            unshare(sibling);
+
+            // красный брат: поворотом делаем брата черным, родитель опускается на уровень
+            if (isRed(sibling))
+            {
+                sibling->_color = BLACK;
+                par->_color = RED;
+                Node* top = rotate(par, xLeft);
+                *links[i - 1] = top;
+                links[i + 1] = links[i];
+                links[i] = xLeft ? &top->_left : &top->_right;
+                ++i;
+
+                // ссылка sibling по-прежнему ведет из par — теперь к новому брату
+                unshare(sibling);
+            }
+
+            // оба племянника черные: брат краснеет, недостача поднимается к родителю
+            if (!isRed(sibling->_left) && !isRed(sibling->_right))
+            {
+                sibling->_color = RED;
+                --i;
+                continue;
+            }
+
+            // дальний племянник черный: ближний красный поворотом становится братом
+            if (!isRed(xLeft ? sibling->_right : sibling->_left))
+            {
+                Node*& nearNephew = xLeft ? sibling->_left : sibling->_right;
+                unshare(nearNephew);
+                nearNephew->_color = BLACK;
+                sibling->_color = RED;
+                sibling = rotate(sibling, !xLeft);
+            }
+
+            Node*& farNephew = xLeft ? sibling->_right : sibling->_left;
+            unshare(farNephew);
+            sibling->_color = par->_color;
+            par->_color = BLACK;
+            farNephew->_color = BLACK;
+            *links[i - 1] = rotate(par, xLeft);
+            return;
+        }
+
+        // красный x (или корень) просто чернеет; x мог остаться общим — это потомок удаленного
+        Node*& x = *links[i];
+        if (x)
+        {
+            unshare(x);
+            x->_color = BLACK;
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void PersistentRBTree<Element, Compar, Allocator>::unshare(Node*& link)
+    {
+        Node* nd = link;
+        if (nd->_refs.load(std::memory_order_acquire) == 1)
+            return;
+
+        // потомков копия получает только после того, как создана: иначе их ссылки утекли бы
+        Node* copy = createNode(nd->_key, nullptr, nullptr, nd->_color);
+        copy->_left = acquire(nd->_left);
+        copy->_right = acquire(nd->_right);
+        link = copy;
+        release(nd);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    typename PersistentRBTree<Element, Compar, Allocator>::Node*
+    PersistentRBTree<Element, Compar, Allocator>::rotate(Node* nd, bool left)
+    {
+        if (left)
+        {
+            Node* y = nd->_right;
+            nd->_right = y->_left;
+            y->_left = nd;
+            return y;
+        }
+
+        Node* y = nd->_left;
+        nd->_left = y->_right;
+        y->_right = nd;
+        return y;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    typename PersistentRBTree<Element, Compar, Allocator>::Node*
+    PersistentRBTree<Element, Compar, Allocator>::createNode(const Element& key, Node* left, Node* right, Color col)
+    {
+        Node* nd = NodeAllocTraits::allocate(_alloc, 1);
+        try
+        {
+            new (nd) Node(key, left, right, col);
+        }
+        catch (...)
+        {
+            NodeAllocTraits::deallocate(_alloc, nd, 1);
+            throw;
+        }
+        return nd;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void PersistentRBTree<Element, Compar, Allocator>::release(Node* nd)
+    {
+        // рекурсия только по левым потомкам, поэтому ее глубина не больше высоты дерева
+        while (nd && nd->_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            Node* left = nd->_left;
+            Node* right = nd->_right;
+            nd->~Node();
+            NodeAllocTraits::deallocate(_alloc, nd, 1);
+
+            release(left);
+            nd = right;
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    template <typename Visitor>
+    void PersistentRBTree<Element, Compar, Allocator>::forEachPrv(const Node* nd, Visitor& visitor)
+    {
+        while (nd)
+        {
+            forEachPrv(nd->_left, visitor);
+            visitor(nd->_key);
+            nd = nd->_right;
+        }
+    }
+
+
+} // namespace xi
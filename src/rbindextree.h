@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Определение красно-черного дерева на 32-битных индексах узлов
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Альтернативное хранение КЧД: узлы лежат подряд в одном векторе, а связи
+/// между ними — 32-битные индексы в этом векторе вместо указателей.
+/// "Реализация" соответствующих методов располагается в файле rbindextree.hpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef RBTREE_RBINDEXTREE_H_
+#define RBTREE_RBINDEXTREE_H_
+
+#include <cstddef>          // std::size_t
+#include <cstdint>          // std::uint32_t
+#include <functional>       // std::less
+#include <vector>
+
+
+namespace xi {
+
+
+/** \brief Красно-черное дерево, узлы которого адресуются 32-битными индексами.
+ *
+ *  Все узлы хранятся в одном \c std::vector, а связи \c _left, \c _right и \c _parent — индексы
+ *  в нем. По сравнению с \c RBTree узел для небольших ключей вдвое меньше (три связи занимают
+ *  12 байт вместо 24), а все дерево не содержит ни одного указателя: его можно перемещать
+ *  и, при тривиально копируемом \c Element, сохранять и восстанавливать одним \c memcpy
+ *  массива узлов (см. \c getNodes() и \c assignNodes()).
+ *
+ *  Индекс 0 занят сторожевым черным nil-узлом, поэтому корректные индексы узлов начинаются с 1,
+ *  а \c NIL (равный 0) обозначает отсутствие узла. Удаленные узлы образуют список свободных
+ *  и переиспользуются при следующих вставках, индексы остальных узлов при этом не меняются.
+ *
+ *  \tparam Element Тип элементов (ключей); должен иметь конструктор по умолчанию (им
+ *  инициализируется сторожевой узел).
+ *  \tparam Compar Функтор порядка элементов, по умолчанию \c std::less.
+ */
+    template <typename Element, typename Compar = std::less<Element> >
+    class RBIndexTree {
+    public:
+        /** \brief Тип индекса узла. */
+        typedef std::uint32_t Index;
+
+        /** \brief Индекс сторожевого узла, обозначающий отсутствие узла. */
+        static const Index NIL = 0;
+
+        /** \brief Тип цвета узла дерева. */
+        enum Color {
+            BLACK,
+            RED
+        };
+
+        /** \brief Узел дерева: ключ, три индексные связи и цвет. */
+        struct Node {
+            Element       _key;                     ///< Несомая узлом информация.
+            Index         _left;                    ///< Левый потомок.
+            Index         _right;                   ///< Правый потомок.
+            Index         _parent;                  ///< Родитель узла.
+            std::uint8_t  _color;                   ///< Цвет узла.
+        }; // struct RBIndexTree::Node
+
+    public:
+        RBIndexTree();                              ///< Конструктор по умолчанию.
+
+    public:
+        // Основные операции над деревом
+
+        /** \brief Вставляет элемент \c key в дерево и возвращает индекс его узла.
+         *
+         *  Дубликаты не допустимы: если элемент уже есть, генерируется \c std::logic_error.
+         */
+        Index insert(const Element& key);
+
+        /** \brief Удаляет узел элемента \c key с последующей перебалансировкой.
+         *
+         *  Если элемента нет в дереве, генерируется \c std::logic_error. Индексы остальных
+         *  узлов не меняются.
+         */
+        void remove(const Element& key);
+
+        /** \brief Возвращает индекс узла элемента \c key или \c NIL, если его нет. */
+        Index find(const Element& key) const;
+
+        /** \brief Возвращает истину, если дерево пусто. */
+        bool isEmpty() const { return _root == NIL; }
+
+        /** \brief Возвращает число элементов дерева. */
+        std::size_t getSize() const { return _size; }
+
+        /** \brief Резервирует место под \c n узлов, чтобы вставки не перераспределяли вектор. */
+        void reserve(std::size_t n) { _nodes.reserve(n + 1); }
+
+    public:
+        // Навигация по индексам
+
+        /** \brief Возвращает индекс корня или \c NIL для пустого дерева. */
+        Index getRoot() const { return _root; }
+
+        /** \brief Возвращает индекс левого потомка узла \c nd. */
+        Index getLeft(Index nd) const { return _nodes[nd]._left; }
+
+        /** \brief Возвращает индекс правого потомка узла \c nd. */
+        Index getRight(Index nd) const { return _nodes[nd]._right; }
+
+        /** \brief Возвращает индекс родителя узла \c nd. */
+        Index getParent(Index nd) const { return _nodes[nd]._parent; }
+
+        /** \brief Возвращает цвет узла \c nd. */
+        Color getColor(Index nd) const { return static_cast<Color>(_nodes[nd]._color); }
+
+        /** \brief Возвращает ключ узла \c nd. */
+        const Element& getKey(Index nd) const { return _nodes[nd]._key; }
+
+    public:
+        // Сырое представление
+
+        /** \brief Возвращает массив всех узлов, включая сторожевой (0) и свободные. */
+        const Node* getNodes() const { return _nodes.data(); }
+
+        /** \brief Возвращает длину массива узлов, возвращаемого \c getNodes(). */
+        std::size_t getNodesNum() const { return _nodes.size(); }
+
+        /** \brief Возвращает голову списка свободных узлов (связанных через \c _left). */
+        Index getFreeHead() const { return _freeHead; }
+
+        /** \brief Заменяет содержимое дерева сырым представлением, полученным от другого
+         *  дерева через \c getNodes(), \c getNodesNum(), \c getRoot(), \c getFreeHead() и \c getSize().
+         */
+        void assignNodes(const Node* nodes, std::size_t num, Index root, Index freeHead, std::size_t size);
+
+    protected:
+        /** \brief Возвращает изменяемую ссылку на узел \c nd. Действительна до следующего \c newNode(). */
+        Node& node(Index nd) { return _nodes[nd]; }
+
+        /** \brief Берет узел из списка свободных или добавляет новый в конец вектора. */
+        Index newNode(const Element& key);
+
+        /** \brief Возвращает узел \c nd в список свободных. */
+        void freeNode(Index nd);
+
+        /** \brief Выполняет перебалансировку дерева после добавления нового узла \c nd. */
+        void rebalance(Index nd);
+
+        /** \brief Выполняет перебалансировку папы, дяди и дедушки узла \c nd.
+         *  \returns Новый узел, для которого могут нарушаться правила.
+         */
+        Index rebalanceDUG(Index nd);
+
+        /** \brief Восстанавливает свойства КЧД после удаления черного узла, на место которого встал \c nd. */
+        void deleteFixUp(Index nd);
+
+        /** \brief Ставит поддерево \c v на место поддерева \c u у родителя \c u. */
+        void transplant(Index u, Index v);
+
+        /** \brief Вращает поддерево относительно узла \c nd влево. Правый потомок обязан быть. */
+        void rotLeft(Index nd);
+
+        /** \brief Вращает поддерево относительно узла \c nd вправо. Левый потомок обязан быть. */
+        void rotRight(Index nd);
+
+    protected:
+        Compar _compar;                             ///< Компаратор сравнения двух элементов.
+
+        std::vector<Node> _nodes;                   ///< Все узлы; в [0] — сторожевой nil-узел.
+        Index       _root;                          ///< Корень дерева или \c NIL.
+        Index       _freeHead;                      ///< Голова списка свободных узлов или \c NIL.
+        std::size_t _size;                          ///< Число элементов в дереве.
+    }; // class RBIndexTree
+
+
+} // namespace xi
+
+
+
+// Подключаем "реализационную" часть
+#include "rbindextree.hpp"
+
+
+#endif // RBTREE_RBINDEXTREE_H_
@@ -0,0 +1,409 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Реализация красно-черного дерева на 32-битных индексах узлов
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// "Реализация" (шаблонов) методов, описанных в файле rbindextree.h
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <limits>           // std::numeric_limits
+#include <stdexcept>        // std::logic_error, std::length_error
+
+
+namespace xi {
+
+
+    template <typename Element, typename Compar>
+    const typename RBIndexTree<Element, Compar>::Index RBIndexTree<Element, Compar>::NIL;
+
+
+    template <typename Element, typename Compar>
+    RBIndexTree<Element, Compar>::RBIndexTree()
+        : _root(NIL)
+        , _freeHead(NIL)
+        , _size(0)
+    {
+        // сторожевой узел: всегда черный, его родитель временно используется при удалении
+        Node nil = { Element(), NIL, NIL, NIL, BLACK };
+        _nodes.push_back(nil);
+    }
+
+
+    template <typename Element, typename Compar>
+    void RBIndexTree<Element, Compar>::assignNodes(const Node* nodes, std::size_t num,
+                                                   Index root, Index freeHead, std::size_t size)
+    {
+        if (num == 0)
+            throw std::invalid_argument("Node array must contain the nil node");
+
+        _nodes.assign(nodes, nodes + num);
+        _root = root;
+        _freeHead = freeHead;
+        _size = size;
+    }
+
+
+    template <typename Element, typename Compar>
+    typename RBIndexTree<Element, Compar>::Index
+    RBIndexTree<Element, Compar>::newNode(const Element& key)
+    {
+        Node fresh = { key, NIL, NIL, NIL, RED };
+
+        if (_freeHead != NIL)
+        {
+            Index nd = _freeHead;
+            _freeHead = _nodes[nd]._left;
+            _nodes[nd] = fresh;
+            return nd;
+        }
+
+        if (_nodes.size() > std::numeric_limits<Index>::max())
+            throw std::length_error("Too many nodes for 32-bit indices");
+
+        _nodes.push_back(fresh);
+        return static_cast<Index>(_nodes.size() - 1);
+    }
+
+
+    template <typename Element, typename Compar>
+    void RBIndexTree<Element, Compar>::freeNode(Index nd)
+    {
+        Node& n = node(nd);
+        n._key = Element();                         // отпускаем ресурсы ключа сразу
+        n._parent = n._right = NIL;
+        n._color = BLACK;
+        n._left = _freeHead;
+        _freeHead = nd;
+    }
+
+
+    template <typename Element, typename Compar>
+    typename RBIndexTree<Element, Compar>::Index
+    RBIndexTree<Element, Compar>::find(const Element& key) const
+    {
+        Index cur = _root;
+        while (cur != NIL)
+        {
+            const Node& n = _nodes[cur];
+            if (_compar(key, n._key))
+                cur = n._left;
+            else if (_compar(n._key, key))
+                cur = n._right;
+            else
+                return cur;
+        }
+
+        return NIL;
+    }
+
+
+    template <typename Element, typename Compar>
+    typename RBIndexTree<Element, Compar>::Index
+    RBIndexTree<Element, Compar>::insert(const Element& key)
+    {
+        // ищем место присоединения; дубликат распознаем на том же спуске
+        Index parent = NIL;
+        Index cur = _root;
+        bool toLeft = false;
+        while (cur != NIL)
+        {
+            parent = cur;
+            const Node& n = _nodes[cur];
+            if (_compar(key, n._key))
+            {
+                cur = n._left;
+                toLeft = true;
+            }
+            else if (_compar(n._key, key))
+            {
+                cur = n._right;
+                toLeft = false;
+            }
+            else
+                throw std::logic_error("Tree already has such key!");
+        }
+
+        // вектор может перераспределиться, поэтому ссылки на узлы берем только после
+        Index nd = newNode(key);
+        node(nd)._parent = parent;
+
+        if (parent == NIL)
+            _root = nd;
+        else if (toLeft)
+            node(parent)._left = nd;
+        else
+            node(parent)._right = nd;
+
+        ++_size;
+        rebalance(nd);
+
+        return nd;
+    }
+
+
+    template <typename Element, typename Compar>
+    void RBIndexTree<Element, Compar>::rebalance(Index nd)
+    {
+        // пока папа красный, чиним семейство "папа, дядя, дедушка"
+        while (node(node(nd)._parent)._color == RED)
+            nd = rebalanceDUG(nd);
+
+        node(_root)._color = BLACK;
+    }
+
+
+    template <typename Element, typename Compar>
+    typename RBIndexTree<Element, Compar>::Index
+    RBIndexTree<Element, Compar>::rebalanceDUG(Index nd)
+    {
+        // красный папа не может быть корнем, так что дедушка есть
+        Index dad = node(nd)._parent;
+        Index grandpa = node(dad)._parent;
+        bool dadIsLeft = (node(grandpa)._left == dad);
+        Index uncle = dadIsLeft ? node(grandpa)._right : node(grandpa)._left;
+
+        // красный дядя: перекрашиваем и продолжаем с дедушкой
+        if (node(uncle)._color == RED)
+        {
+            node(dad)._color = BLACK;
+            node(uncle)._color = BLACK;
+            node(grandpa)._color = RED;
+            return grandpa;
+        }
+
+        // черный дядя: выпрямляем излом и поворачиваем дедушку
+        if (dadIsLeft)
+        {
+            if (node(dad)._right == nd)
+            {
+                nd = dad;
+                rotLeft(nd);
+            }
+            dad = node(nd)._parent;
+            node(dad)._color = BLACK;
+            node(grandpa)._color = RED;
+            rotRight(grandpa);
+        }
+        else
+        {
+            if (node(dad)._left == nd)
+            {
+                nd = dad;
+                rotRight(nd);
+            }
+            dad = node(nd)._parent;
+            node(dad)._color = BLACK;
+            node(grandpa)._color = RED;
+            rotLeft(grandpa);
+        }
+
+        return nd;
+    }
+
+
+    template <typename Element, typename Compar>
+    void RBIndexTree<Element, Compar>::transplant(Index u, Index v)
+    {
+        Index par = node(u)._parent;
+        if (par == NIL)
+            _root = v;
+        else if (node(par)._left == u)
+            node(par)._left = v;
+        else
+            node(par)._right = v;
+
+        // родителя ставим и сторожевому узлу: им пользуется deleteFixUp()
+        node(v)._parent = par;
+    }
+
+
+    template <typename Element, typename Compar>
+    void RBIndexTree<Element, Compar>::remove(const Element& key)
+    {
+        Index z = find(key);
+        if (z == NIL)
+            throw std::logic_error("No such node!");
+
+        // узлы не копируют ключи, а перевешиваются: индексы остальных узлов остаются в силе
+        Index y = z;
+        std::uint8_t removedColor = node(y)._color;
+        Index x;
+
+        if (node(z)._left == NIL)
+        {
+            x = node(z)._right;
+            transplant(z, x);
+        }
+        else if (node(z)._right == NIL)
+        {
+            x = node(z)._left;
+            transplant(z, x);
+        }
+        else
+        {
+            // преемник — самый левый в правом поддереве
+            y = node(z)._right;
+            while (node(y)._left != NIL)
+                y = node(y)._left;
+
+            removedColor = node(y)._color;
+            x = node(y)._right;
+
+            if (node(y)._parent == z)
+                node(x)._parent = y;
+            else
+            {
+                transplant(y, x);
+                node(y)._right = node(z)._right;
+                node(node(y)._right)._parent = y;
+            }
+
+            transplant(z, y);
+            node(y)._left = node(z)._left;
+            node(node(y)._left)._parent = y;
+            node(y)._color = node(z)._color;
+        }
+
+        if (removedColor == BLACK)
+            deleteFixUp(x);
+
+        freeNode(z);
+        node(NIL)._parent = NIL;
+        --_size;
+    }
+
+
+    template <typename Element, typename Compar>
+    void RBIndexTree<Element, Compar>::deleteFixUp(Index nd)
+    {
+        while (nd != _root && node(nd)._color == BLACK)
+        {
+            Index dad = node(nd)._parent;
+            if (nd == node(dad)._left)
+            {
+                Index bro = node(dad)._right;
+                if (node(bro)._color == RED)
+                {
+                    node(bro)._color = BLACK;
+                    node(dad)._color = RED;
+                    rotLeft(dad);
+                    bro = node(dad)._right;
+                }
+
+                if (node(node(bro)._left)._color == BLACK && node(node(bro)._right)._color == BLACK)
+                {
+                    node(bro)._color = RED;
+                    nd = dad;
+                }
+                else
+                {
+                    if (node(node(bro)._right)._color == BLACK)
+                    {
+                        node(node(bro)._left)._color = BLACK;
+                        node(bro)._color = RED;
+                        rotRight(bro);
+                        bro = node(dad)._right;
+                    }
+                    node(bro)._color = node(dad)._color;
+                    node(dad)._color = BLACK;
+                    node(node(bro)._right)._color = BLACK;
+                    rotLeft(dad);
+                    nd = _root;
+                }
+            }
+            else
+            {
+                // симметрично
+                Index bro = node(dad)._left;
+                if (node(bro)._color == RED)
+                {
+                    node(bro)._color = BLACK;
+                    node(dad)._color = RED;
+                    rotRight(dad);
+                    bro = node(dad)._left;
+                }
+
+                if (node(node(bro)._left)._color == BLACK && node(node(bro)._right)._color == BLACK)
+                {
+                    node(bro)._color = RED;
+                    nd = dad;
+                }
+                else
+                {
+                    if (node(node(bro)._left)._color == BLACK)
+                    {
+                        node(node(bro)._right)._color = BLACK;
+                        node(bro)._color = RED;
+                        rotLeft(bro);
+                        bro = node(dad)._left;
+                    }
+                    node(bro)._color = node(dad)._color;
+                    node(dad)._color = BLACK;
+                    node(node(bro)._left)._color = BLACK;
+                    rotRight(dad);
+                    nd = _root;
+                }
+            }
+        }
+
+        node(nd)._color = BLACK;
+    }
+
+
+    template <typename Element, typename Compar>
+    void RBIndexTree<Element, Compar>::rotLeft(Index nd)
+    {
+        Index y = node(nd)._right;
+        if (y == NIL)
+            throw std::invalid_argument("Can't rotate left since the right child is nil");
+
+        node(nd)._right = node(y)._left;
+        if (node(y)._left != NIL)
+            node(node(y)._left)._parent = nd;
+
+        Index par = node(nd)._parent;
+        node(y)._parent = par;
+        if (par == NIL)
+            _root = y;
+        else if (node(par)._left == nd)
+            node(par)._left = y;
+        else
+            node(par)._right = y;
+
+        node(y)._left = nd;
+        node(nd)._parent = y;
+    }
+
+
+    template <typename Element, typename Compar>
+    void RBIndexTree<Element, Compar>::rotRight(Index nd)
+    {
+        Index y = node(nd)._left;
+        if (y == NIL)
+            throw std::invalid_argument("Can't rotate right since the left child is nil");
+
+        node(nd)._left = node(y)._right;
+        if (node(y)._right != NIL)
+            node(node(y)._right)._parent = nd;
+
+        Index par = node(nd)._parent;
+        node(y)._parent = par;
+        if (par == NIL)
+            _root = y;
+        else if (node(par)._right == nd)
+            node(par)._right = y;
+        else
+            node(par)._left = y;
+
+        node(y)._right = nd;
+        node(nd)._parent = y;
+    }
+
+
+} // namespace xi
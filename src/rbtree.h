@@ -19,13 +19,538 @@
 #ifndef RBTREE_WITH_DELETION
 #define RBTREE_WITH_DELETION
 
+#include <atomic>           // std::atomic
+#include <cstddef>          // std::size_t
+#include <cstdint>          // std::uintptr_t
+#include <cstring>          // std::memcpy
+#include <functional>       // std::less
+#include <iterator>         // std::bidirectional_iterator_tag, std::reverse_iterator
+#include <limits>           // std::numeric_limits
+#include <memory>           // std::allocator, std::allocator_traits
+#include <stdexcept>        // std::logic_error
+#include <thread>           // std::thread::hardware_concurrency
+#include <type_traits>      // std::aligned_storage
+#include <utility>          // std::pair
+#include <vector>
+
 
 namespace xi {
 
 
+/** \brief Пул памяти под узлы дерева.
+ *
+ *  Память запрашивается у аллокатора \c Allocator (перепривязанного к ячейке пула) слэбами —
+ *  блоками по нескольку ячеек размером с \c T, размер
+ *  очередного слэба растет вдвое до \c MAX_SLAB_SIZE. Освобожденные ячейки попадают в список
+ *  свободных и отдаются при следующих запросах, поэтому при установившемся чередовании вставок
+ *  и удалений куча не трогается вовсе. Все слэбы возвращаются разом в \c clear() или деструкторе.
+ *
+ *  Пул работает только с сырой памятью: конструирование и разрушение объектов в ячейках —
+ *  забота владельца пула.
+ *
+ *  Пулы, которыми владеют через \c std::shared_ptr, можно объединять (\c unite()): слэбы одного
+ *  переходят к другому, а опустевший пул запоминает наследника и держит его живым. Так ячейки
+ *  могут переходить между владельцами пулов (деревьями после \c RBTree::join() и
+ *  \c RBTree::split()), а память освобождается, когда не останется ни одного владельца.
+ *  Объединенный пул не защищен от гонок: его владельцев нельзя менять одновременно из разных потоков.
+ */
+    template <typename T, typename Allocator = std::allocator<T> >
+    class NodePool {
+    public:
+        explicit NodePool(const Allocator& alloc = Allocator());
+        ~NodePool();                                ///< Освобождает все слэбы.
+
+    public:
+        /** \brief Возвращает неинициализированную ячейку под один объект \c T. */
+        void* acquire()
+        {
+            if (_free)
+            {
+                Cell* cell = _free;
+                _free = next(cell);
+                return cell;
+            }
+
+            if (_cur == _end)
+                grow();
+
+            return _cur++;
+        }
+
+        /** \brief Возвращает в пул ячейку \c p, объект в которой уже разрушен. */
+        void release(void* p)
+        {
+            Cell* cell = static_cast<Cell*>(p);
+            setNext(cell, _free);
+            if (!_free)
+                _freeTail = cell;
+            _free = cell;
+        }
+
+        /** \brief Разом освобождает все слэбы. Объекты в занятых ячейках должны быть уже разрушены. */
+        void clear();
+
+        /** \brief Забирает себе все слэбы и свободные ячейки пула \c other, который становится пустым.
+         *
+         *  Стоит O(число слэбов) без обращений к куче, кроме роста реестра слэбов; занятые ячейки
+         *  \c other остаются на месте и потом возвращаются уже в этот пул. Аллокаторы пулов
+         *  должны быть равны.
+         */
+        void absorb(NodePool& other);
+
+        /** \brief Возвращает пул, который сейчас распоряжается памятью пула \c p, и перенаправляет
+         *  на него сам \c p, чтобы следующий вызов не проходил цепочку наследников заново.
+         */
+        static NodePool& owner(std::shared_ptr<NodePool>& p)
+        {
+            while (p->_heir)
+                p = p->_heir;
+            return *p;
+        }
+
+        /** \brief Объединяет пулы \c a и \c b (с их прежними наследниками); после вызова оба
+         *  указывают на один пул.
+         */
+        static void unite(std::shared_ptr<NodePool>& a, std::shared_ptr<NodePool>& b);
+
+        /** \brief Возвращает копию аллокатора, переданного при создании пула. */
+        Allocator getAllocator() const { return Allocator(_alloc); }
+
+    protected:
+        /** \brief Ячейка пула: либо память под объект, либо звено списка свободных.
+         *
+         *  Выравнивается только как \c T: звено списка читается и пишется побайтно, поэтому ячейки
+         *  упакованных объектов (см. \c CompactNodes) не раздуваются до выравнивания указателя.
+         */
+        struct Cell {
+            typename std::aligned_storage<(sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*)),
+                                          std::alignment_of<T>::value>::type storage;
+        };
+
+        /** \brief Возвращает следующую за \c cell свободную ячейку. */
+        static Cell* next(const Cell* cell)
+        {
+            Cell* res;
+            std::memcpy(&res, cell, sizeof(res));
+            return res;
+        }
+
+        /** \brief Делает \c nxt следующей за \c cell свободной ячейкой. */
+        static void setNext(Cell* cell, Cell* nxt) { std::memcpy(cell, &nxt, sizeof(nxt)); }
+
+        // аллокатор, перепривязанный к ячейкам
+        typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Cell> CellAlloc;
+        typedef std::allocator_traits<CellAlloc> CellAllocTraits;
+
+        /** \brief Запрашивает у кучи очередной слэб и делает его текущим. */
+        void grow();
+
+    protected:
+        NodePool(const NodePool&);                  ///< КК не доступен.
+        NodePool& operator= (const NodePool&);      ///< Оператор присваивания недоступен.
+
+    protected:
+        static const std::size_t MIN_SLAB_SIZE = 32;    ///< Число ячеек в первом слэбе.
+        static const std::size_t MAX_SLAB_SIZE = 4096;  ///< Предельное число ячеек в слэбе.
+
+        CellAlloc   _alloc;                         ///< Источник памяти под слэбы.
+
+        std::vector<std::pair<Cell*, std::size_t> > _slabs; ///< Выделенные слэбы и их размеры.
+
+        /** \brief Пул, поглотивший этот в \c unite(); пока он задан, собственных слэбов у этого нет. */
+        std::shared_ptr<NodePool> _heir;
+
+        Cell*       _free;                          ///< Голова списка свободных ячеек.
+        Cell*       _freeTail;                      ///< Хвост списка свободных (действителен, если он не пуст).
+        Cell*       _cur;                           ///< Первая ни разу не выданная ячейка текущего слэба.
+        Cell*       _end;                           ///< Конец текущего слэба.
+        std::size_t _nextSlabSize;                  ///< Размер следующего слэба.
+    }; // class NodePool
+
+
+
+/** \brief Вспомогательный шаблон для SFINAE-проверок наличия вложенных типов. */
+    template <typename T>
+    struct VoidType {
+        typedef void type;
+    };
+
+
+/** \brief Признак трехзначного компаратора.
+ *
+ *  Компаратор объявляет себя трехзначным, определяя вложенный тип \c is_three_way. Тогда вызов
+ *  <tt>compar(a, b)</tt> должен возвращать отрицательное число, ноль или положительное число, если
+ *  \c a соответственно меньше, эквивалентен или больше \c b, и дерево на каждом уровне спуска
+ *  обходится одним его вызовом. Обычные компараторы — строгие предикаты "меньше", как \c std::less.
+ */
+    template <typename Compar, typename = void>
+    struct IsThreeWayCompar : std::false_type {
+    };
+
+    template <typename Compar>
+    struct IsThreeWayCompar<Compar, typename VoidType<typename Compar::is_three_way>::type>
+        : std::true_type {
+    };
+
+
+/** \brief Признак прозрачного компаратора: он объявляет вложенный тип \c is_transparent и умеет
+ *  сравнивать элементы с ключами других типов. Тогда поиск и удаление принимают такие ключи
+ *  напрямую, без построения временного элемента.
+ */
+    template <typename Compar, typename = void>
+    struct IsTransparentCompar : std::false_type {
+    };
+
+    template <typename Compar>
+    struct IsTransparentCompar<Compar, typename VoidType<typename Compar::is_transparent>::type>
+        : std::true_type {
+    };
+
+
+/** \brief Строгий предикат "меньше" поверх компаратора дерева: трехзначный компаратор (см.
+ *  \c IsThreeWayCompar) сравнивается с нулем, обычный вызывается как есть. Нужен там, где ключи
+ *  сравниваются в обход \c RBTree, например в алгоритмах STL.
+ */
+    template <typename Compar>
+    class KeyLess {
+    public:
+        explicit KeyLess(const Compar& compar = Compar()) : _compar(compar) {}
+
+        template <typename A, typename B>
+        bool operator()(const A& a, const B& b) const
+        {
+            return less(a, b, typename IsThreeWayCompar<Compar>::type());
+        }
+
+        /** \brief Возвращает исходный компаратор. */
+        const Compar& getCompar() const { return _compar; }
+
+    protected:
+        template <typename A, typename B>
+        bool less(const A& a, const B& b, std::false_type) const { return _compar(a, b); }
+
+        template <typename A, typename B>
+        bool less(const A& a, const B& b, std::true_type) const { return _compar(a, b) < 0; }
+
+    protected:
+        Compar _compar;                             ///< Исходный компаратор.
+    }; // class KeyLess
+
+
+
+/** \brief Политика аугментации по умолчанию: узлы не хранят ничего сверх ключа, связей и цвета. */
+    struct NoAugment {
+    };
+
+
+/** \brief Политика аугментации "порядковые статистики": агрегат узла — размер его поддерева.
+ *
+ *  Дает \c select(), \c rank() и \c countInRange() за O(log n) ценой одного \c std::size_t
+ *  на узел и подъема до корня при вставке и удалении.
+ */
+    struct OrderStatAugment {
+        typedef std::size_t value_type;
+
+        static value_type identity() { return 0; }
+
+        template <typename Element>
+        static value_type fromElement(const Element&) { return 1; }
+
+        static value_type combine(value_type a, value_type b) { return a + b; }
+    };
+
+
+/** \brief Агрегат поддерева, хранимый в узле по политике аугментации \c Augment.
+ *
+ *  Политика — класс с вложенным типом \c value_type и статическими методами:
+ *   - \c identity() — нейтральный агрегат (пустого поддерева);
+ *   - \c fromElement(e) — агрегат одного элемента;
+ *   - \c combine(a, b) — агрегат последовательности "a, затем b"; должен быть ассоциативным,
+ *     а коммутативность не требуется: порядок всегда "левое поддерево, узел, правое поддерево".
+ *
+ *  Так задаются сумма, минимум, максимум, число элементов (\c OrderStatAugment), побитовое "или"
+ *  и т.п. Узел дерева наследуется от этого класса, а дерево пересчитывает агрегат методом
+ *  \c pullAug() после каждого изменения структуры. Для \c NoAugment класс пуст и за счет
+ *  оптимизации пустой базы не увеличивает узел.
+ */
+    template <typename Augment>
+    class NodeAugment {
+    public:
+        typedef typename Augment::value_type value_type;
+
+        /** \brief Возвращает агрегат всех элементов поддерева с корнем в этом узле. */
+        const value_type& getAugment() const { return _aug; }
+
+    protected:
+        NodeAugment() : _aug(Augment::identity()) {}
+
+        /** \brief Пересчитывает агрегат по агрегатам детей \c lf, \c rg и собственному элементу \c key. */
+        template <typename Element>
+        void pullAug(const NodeAugment* lf, const NodeAugment* rg, const Element& key)
+        {
+            value_type res = Augment::fromElement(key);
+            if (lf)
+                res = Augment::combine(lf->_aug, res);
+            if (rg)
+                res = Augment::combine(res, rg->_aug);
+            _aug = res;
+        }
+
+        /** \brief Обнуляет вклад узла, который остается в дереве только до конца удаления. */
+        void clearAug() { _aug = Augment::identity(); }
+
+    protected:
+        value_type _aug;                            ///< Агрегат поддерева.
+    }; // class NodeAugment
+
+    template <>
+    class NodeAugment<NoAugment> {
+    public:
+        typedef void value_type;
+
+    protected:
+        template <typename Element>
+        void pullAug(const NodeAugment*, const NodeAugment*, const Element&) {}
+
+        void clearAug() {}
+    }; // class NodeAugment<NoAugment>
+
+
+/** \brief Раскладка узла по умолчанию: ключ, затем байты цвета и флагов, затем три связи.
+ *
+ *  Цвет и флаги занимают выравнивание после небольшого ключа, так что узел \c RBTree<int>
+ *  занимает 32 байта, а с 8-байтовым ключом — 40.
+ */
+    struct LooseNodes {
+        /** \brief Тип связи с потомком (и указателя на корень дерева). */
+        template <typename NodeT>
+        struct Link {
+            typedef NodeT* type;
+        };
+    };
+
+
+/** \brief Компактная раскладка узла: связи первыми, ключ за ними.
+ *
+ *  Цвет и лишний черный хранятся в двух младших битах указателя на родителя, признак записи в
+ *  очереди отложенных нарушений — в младшем бите правой связи: все они свободны, т.к. узел
+ *  выровнен хотя бы на 4 байта. Связи упакованы по 4 байта, поэтому узел с 4-байтовым ключом
+ *  занимает 28 байт вместо 32, с 8-байтовым — 32 вместо 40. Связи при этом могут оказаться не
+ *  выровнены на 8 байт, что стоит лишних тактов на платформах без дешевого невыровненного доступа.
+ */
+    struct CompactNodes {
+    };
+
+
+/** \brief Связь, которую другие потоки читают без блокировок, пока ее меняет писатель.
+ *
+ *  Ведет себя как \c NodeT*, но читается и пишется атомарно: запись публикует узел (release),
+ *  а чтение (acquire) видит его уже построенным. На x86 это обычные пересылки.
+ */
+    template <typename NodeT>
+    class AtomicLink {
+    public:
+        AtomicLink() : _p(nullptr) {}
+        explicit AtomicLink(NodeT* p) : _p(p) {}
+
+        AtomicLink& operator= (const AtomicLink& other) { return *this = static_cast<NodeT*>(other); }
+
+        AtomicLink& operator= (NodeT* p)
+        {
+            _p.store(p, std::memory_order_release);
+            return *this;
+        }
+
+        operator NodeT*() const { return _p.load(std::memory_order_acquire); }
+        NodeT* operator->() const { return *this; }
+
+    protected:
+        AtomicLink(const AtomicLink&);              ///< КК не доступен.
+
+    protected:
+        std::atomic<NodeT*> _p;                     ///< Сам указатель.
+    }; // class AtomicLink
+
+
+/** \brief Раскладка узла для деревьев, которые читают без блокировок (\c ConcurrentRBTree).
+ *
+ *  Поля те же, что в \c LooseNodes, но связи с потомками и корень дерева — \c AtomicLink, так что
+ *  читатель, идущий по ним параллельно с писателем, не устраивает гонок. Родителя, цвет и агрегаты
+ *  читает и пишет только писатель.
+ */
+    struct SharedNodes {
+        template <typename NodeT>
+        struct Link {
+            typedef AtomicLink<NodeT> type;
+        };
+    };
+
+
+/** \brief Хранилище ключа, цвета, флагов и связей узла \c NodeT с элементом \c Element в раскладке
+ *  \c Layout (\c LooseNodes, \c SharedNodes или \c CompactNodes). Узел дерева наследуется от него и обращается к
+ *  родителю, цвету и флагам только через его методы.
+ *
+ *  Флаги — биты \c 1 и \c 2; их смысл задает дерево.
+ */
+    template <typename Layout, typename NodeT, typename Element>
+    class NodeFields {
+    public:
+        typedef typename Layout::template Link<NodeT>::type Link;
+
+    protected:
+        template <typename... Args>
+        NodeFields(NodeT* left, NodeT* right, NodeT* parent, unsigned color, Args&&... args)
+            : _key(std::forward<Args>(args)...)
+            , _color(static_cast<std::uint8_t>(color)), _flags(0)
+            , _parent(parent), _left(left), _right(right)
+        {
+        }
+
+        NodeT* parent() const { return _parent; }
+        void setParent(NodeT* par) { _parent = par; }
+
+        unsigned colorBit() const { return _color; }
+        void setColorBit(unsigned color) { _color = static_cast<std::uint8_t>(color); }
+
+        bool hasFlag(unsigned flag) const { return (_flags & flag) != 0; }
+
+        void setFlag(unsigned flag, bool on)
+        {
+            if (on)
+                _flags |= flag;
+            else
+                _flags &= ~flag;
+        }
+
+    protected:
+        Element _key;                               ///< Несомая узлом информация.
+        std::uint8_t _color;                        ///< Цвет элемента.
+        std::uint8_t _flags;                        ///< Флаги ослабленной балансировки.
+
+        NodeT*  _parent;                            ///< Родитель узла.
+        Link    _left;                              ///< Левый потомок.
+        Link    _right;                             ///< Правый потомок.
+    }; // class NodeFields
+
+
+#pragma pack(push, 4)
+
+/** \brief Связь, в младшем бите которой лежит флаг узла-владельца.
+ *
+ *  Ведет себя как \c NodeT*: присваивание меняет только указатель, флаг остается за владельцем.
+ *  Упакована, как и содержащие ее связи компактного узла.
+ */
+    template <typename NodeT>
+    class TaggedLink {
+    public:
+        explicit TaggedLink(NodeT* p) : _bits(reinterpret_cast<std::uintptr_t>(p)) {}
+
+        TaggedLink& operator= (const TaggedLink& other) { return *this = static_cast<NodeT*>(other); }
+
+        TaggedLink& operator= (NodeT* p)
+        {
+            _bits = reinterpret_cast<std::uintptr_t>(p) | (_bits & TAG);
+            return *this;
+        }
+
+        operator NodeT*() const { return reinterpret_cast<NodeT*>(_bits & ~TAG); }
+        NodeT* operator->() const { return *this; }
+
+        bool tag() const { return (_bits & TAG) != 0; }
+        void setTag(bool on) { _bits = on ? (_bits | TAG) : (_bits & ~TAG); }
+
+    protected:
+        TaggedLink(const TaggedLink&);              ///< Связи не копируются вместе с флагом.
+
+    protected:
+        static const std::uintptr_t TAG = 1;
+
+        std::uintptr_t _bits;                       ///< Указатель и флаг в младшем бите.
+    }; // class TaggedLink
+
+
+/** \brief Связи компактного узла, упакованные по 4 байта (см. \c CompactNodes). */
+    template <typename NodeT>
+    class CompactNodeLinks {
+    protected:
+        CompactNodeLinks(NodeT* left, NodeT* right, NodeT* parent, unsigned color)
+            : _left(left), _right(right)
+            , _parentColor(reinterpret_cast<std::uintptr_t>(parent) | color)
+        {
+        }
+
+    protected:
+        // цвет (BLACK = 0, RED = 1) — младший бит указателя на родителя, лишний черный — следующий
+        static const std::uintptr_t COLOR_MASK = 1;
+        static const std::uintptr_t EXTRA_MASK = 2;
+        static const std::uintptr_t TAG_MASK = 3;   ///< Цвет и лишний черный.
+
+        NodeT*  _left;                              ///< Левый потомок.
+        TaggedLink<NodeT> _right;                   ///< Правый потомок и признак записи в очереди.
+        std::uintptr_t _parentColor;                ///< Родитель узла, цвет и лишний черный.
+    }; // class CompactNodeLinks
+
+#pragma pack(pop)
+
+
+    template <typename NodeT, typename Element>
+    class NodeFields<CompactNodes, NodeT, Element> : public CompactNodeLinks<NodeT> {
+    public:
+        typedef NodeT* Link;
+
+    protected:
+        typedef CompactNodeLinks<NodeT> TLinks;
+
+        template <typename... Args>
+        NodeFields(NodeT* left, NodeT* right, NodeT* parent, unsigned color, Args&&... args)
+            : TLinks(left, right, parent, color)
+            , _key(std::forward<Args>(args)...)
+        {
+        }
+
+        NodeT* parent() const { return reinterpret_cast<NodeT*>(this->_parentColor & ~TLinks::TAG_MASK); }
+
+        void setParent(NodeT* par)
+        {
+            static_assert(alignof(NodeT) > TLinks::TAG_MASK, "node alignment must leave the tag bits free");
+            this->_parentColor = reinterpret_cast<std::uintptr_t>(par) | (this->_parentColor & TLinks::TAG_MASK);
+        }
+
+        unsigned colorBit() const { return static_cast<unsigned>(this->_parentColor & TLinks::COLOR_MASK); }
+
+        void setColorBit(unsigned color)
+        {
+            this->_parentColor = (this->_parentColor & ~TLinks::COLOR_MASK) | color;
+        }
+
+        // флаг 1 (лишний черный) — за позицией в дереве, рядом с цветом; флаг 2 (запись в очереди) —
+        // в правой связи
+        bool hasFlag(unsigned flag) const
+        {
+            return flag == 1 ? (this->_parentColor & TLinks::EXTRA_MASK) != 0 : this->_right.tag();
+        }
+
+        void setFlag(unsigned flag, bool on)
+        {
+            if (flag != 1)
+                this->_right.setTag(on);
+            else if (on)
+                this->_parentColor |= TLinks::EXTRA_MASK;
+            else
+                this->_parentColor &= ~TLinks::EXTRA_MASK;
+        }
+
+    protected:
+        using TLinks::_left;
+        using TLinks::_right;
+
+        Element _key;                               ///< Несомая узлом информация.
+    }; // class NodeFields<CompactNodes>
+
+
 
 // Предварительное описание
-    template <typename Element, typename Compar>
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
     class RBTree;
 
 
@@ -34,12 +559,15 @@ namespace xi {
  *
  *  Реализация этого интерфейса и передача его
  */
-    template <typename Element, typename Compar>
+    template <typename Element, typename Compar,
+              typename Allocator = std::allocator<Element>,
+              typename Augment = NoAugment,
+              typename Layout = LooseNodes>
     class IRBTreeDumper {
     public:
         // Объявление типов дерева и узла для упрощения доступа
-        typedef RBTree<Element, Compar> TTree;
-        typedef typename RBTree<Element, Compar>::Node TTreeNode;
+        typedef RBTree<Element, Compar, Allocator, Augment, Layout> TTree;
+        typedef typename TTree::Node TTreeNode;
     public:
         /** \brief Типы событий, на которые реагируем дампер. */
         enum RBTreeDumperEvent {
@@ -71,17 +599,39 @@ namespace xi {
     }; // class RBTreeDumper
 
 
-    template<typename, typename>
+    template<typename, typename, typename>
     class RBTreeTest;
 
+    template <typename, typename, typename, typename>
+    class ConcurrentRBTree;
+
 
 /** \brief Главный класс красно-черного дерева.
  *
  *  \tparam Element Определяет тип элементов, хранимых в дереве (тж. ключ, key).
  *  \tparam Compar Функтор, выполняющий сравнение элементов для определения порядка. По умолчанию
- *  реализуется стандартным компаратором \c std::less.
+ *  реализуется стандартным компаратором \c std::less. Все сравнения ключей идут только через него;
+ *  он может быть и трехзначным (см. \c IsThreeWayCompar).
+ *  \tparam Allocator Аллокатор в духе \c std::allocator_traits, из которого пул дерева берет
+ *  память под узлы (аллокатор перепривязывается к ячейке узла). По умолчанию \c std::allocator.
+ *  \tparam Augment Политика аугментации — дополнительных данных поддерева в каждом узле. По
+ *  умолчанию \c NoAugment; \c OrderStatAugment включает порядковые статистики.
+ *
+ *  \tparam Layout Раскладка полей узла: \c LooseNodes (по умолчанию) или \c CompactNodes, где
+ *  цвет хранится в младших битах указателя на родителя, а связи упакованы; узел \c RBTree<int>
+ *  сокращается с 32 до 28 байт, с 8-байтовым ключом — с 40 до 32. \c SharedNodes делает корень и
+ *  связи с потомками атомарными для \c ConcurrentRBTree. Раскладка входит в тип дерева, поэтому
+ *  деревья с разными раскладками уживаются в одной программе.
+ *
+ *  Константные методы не меняют дерево и могут выполняться одновременно из разных потоков, но не
+ *  одновременно с изменяющими. Чтение без блокировок параллельно с писателем дает обертка
+ *  \c ConcurrentRBTree (concurrentrbtree.h).
  */
-    template <typename Element, typename Compar = std::less<Element> >
+    template <typename Element,
+              typename Compar = std::less<Element>,
+              typename Allocator = std::allocator<Element>,
+              typename Augment = NoAugment,
+              typename Layout = LooseNodes>
     class RBTree {
     public:
         // Типы на экспорт
@@ -98,15 +648,19 @@ namespace xi {
          *  для самого узла и его потомков. Это сделано с целью инкапсуляции, а само дерево объявлено
          *  по отношению к данному классу дружественным, чтобы оно имело доступ к своим узлам.
          */
-        class Node {
+        class Node : public NodeAugment<Augment>, public NodeFields<Layout, Node, Element> {
             // Дерево имеет полный доступ к реализации узла!
-            friend class RBTree<Element, Compar>;
+            friend class RBTree<Element, Compar, Allocator, Augment, Layout>;
 
             // Специальный подход, позволяющий следующему (шаблонному) классу иметь доступ
             // к закрытым членам для их тестирования.
-            template<typename, typename>
+            template<typename, typename, typename>
             friend class RBTreeTest;
 
+            // Обертка для чтения без блокировок сцепляет исключенные узлы через родителя.
+            template <typename, typename, typename, typename>
+            friend class ConcurrentRBTree;
+
         public:
 
             /** \brief Определяет варианты принадлежности узла относительно родителя. */
@@ -115,6 +669,20 @@ namespace xi {
                 RIGHT,              ///< правый потомок
                 NONE                ///< вообще не потомок
             };
+
+        protected:
+            typedef NodeFields<Layout, Node, Element> TFields;
+
+            /** \brief Флаги ослабленной балансировки (где они хранятся, решает раскладка). */
+            enum Flag {
+                EXTRA_BLACK = 1,    ///< узел несет лишний черный
+                QUEUED = 2          ///< узел записан в очередь отложенных нарушений
+            };
+
+            using TFields::_key;
+            using TFields::_left;
+            using TFields::_right;
+
         public:
 
             /** \brief Возвращает константный указатель на левый дочерний узел. */
@@ -124,16 +692,21 @@ namespace xi {
             const Node* getRight() const { return _right; }
 
             /** \brief Возвращает константный указатель на родительский узел. */
-            const Node* getParent() const { return _parent; }
+            const Node* getParent() const { return parent(); }
 
             /** \brief Возвращает цвет узла. */
-            Color getColor() const { return _color;  }
+            Color getColor() const { return static_cast<Color>(this->colorBit()); }
 
             /** \brief Возвращает истину, если узел черный, иначе ложь. */
-            bool isBlack() const { return _color == BLACK;  }
+            bool isBlack() const { return getColor() == BLACK;  }
 
             /** \brief Возвращает истину, если узел красный, иначе ложь. */
-            bool isRed() const { return _color == RED; }
+            bool isRed() const { return getColor() == RED; }
+
+            /** \brief Возвращает истину, если узел несет отложенный лишний черный (см.
+             *  \c RBTree::setRelaxed()); такой узел черный и считается за два черных.
+             */
+            bool hasExtraBlack() const { return hasFlag(EXTRA_BLACK); }
 
 
             // хелперные методы получения доп информации о ноде
@@ -141,9 +714,9 @@ namespace xi {
             /** \brief Возвращает истину, если есть отец и он красный. */
             bool isDaddyRed() const
             {
-                if (!_parent)
+                if (!parent())
                     return false;
-                return (_parent->_color == RED);
+                return (parent()->isRed());
             }
 
             /** \brief Возвращает истину, если у нода есть предок, для которого нод является левым ребенком.
@@ -151,9 +724,9 @@ namespace xi {
              */
             bool isLeftChild() const
             {
-                if (!_parent)
+                if (!parent())
                     return false;
-                return (_parent->_left == this);
+                return (parent()->_left == this);
             }
 
             /** \brief Возвращает истину, если у нода есть предок, для которого нод является правым ребенком.
@@ -161,17 +734,17 @@ namespace xi {
              */
             bool isRightChild() const
             {
-                if (!_parent)
+                if (!parent())
                     return false;
-                return (_parent->_right == this);
+                return (parent()->_right == this);
             }
 
             /** \brief Определяет, является ли данный узел потомком родителя — левым, правым или не потомком. */
             WhichChild getWhichChild() const
             {
-                if (!_parent)
+                if (!parent())
                     return NONE;
-                if (_parent->_left == this)
+                if (parent()->_left == this)
                     return LEFT;
                 return RIGHT;
             }
@@ -179,6 +752,52 @@ namespace xi {
 
             /** \brief Возвращает константную ссылку на элемент/ключ, храняющийся в узле. */
             const Element& getKey() const { return _key; }
+
+
+            // переходы в порядке возрастания ключей — по связям, без рекурсии и стека
+
+            /** \brief Возвращает следующий по порядку узел дерева или \c nullptr для последнего. */
+            const Node* getNext() const
+            {
+                const Node* nd = this;
+                if (nd->_right)
+                {
+                    nd = nd->_right;
+                    while (nd->_left)
+                        nd = nd->_left;
+                    return nd;
+                }
+
+                // поднимаемся, пока приходим справа
+                const Node* par = nd->parent();
+                while (par && par->_right == nd)
+                {
+                    nd = par;
+                    par = par->parent();
+                }
+                return par;
+            }
+
+            /** \brief Возвращает предыдущий по порядку узел дерева или \c nullptr для первого. */
+            const Node* getPrev() const
+            {
+                const Node* nd = this;
+                if (nd->_left)
+                {
+                    nd = nd->_left;
+                    while (nd->_right)
+                        nd = nd->_right;
+                    return nd;
+                }
+
+                const Node* par = nd->parent();
+                while (par && par->_left == nd)
+                {
+                    nd = par;
+                    par = par->parent();
+                }
+                return par;
+            }
         protected:
 
             Node(const Element& key = Element(),
@@ -186,18 +805,32 @@ namespace xi {
                  Node* right = nullptr,
                  Node* parent = nullptr,
                  Color col = BLACK)
-                    : _key(key), _left(left), _right(right), _parent(parent), _color(col)
+                    : TFields(left, right, parent, col, key)
             {
                 // если переданы дочерние элементы, устанавливаем себя их родителем, но
                 // но не говорим родителю, что мы его дочерь!
                 if (_left)
-                    _left->_parent = this;
+                    _left->setParent(this);
 
                 if (_right)
-                    _right->_parent = this;
+                    _right->setParent(this);
+            }
+
+            /** \brief Тег конструктора, строящего элемент узла на месте. */
+            struct InPlace {
+            };
+
+            /** \brief Создает свободный черный узел, конструируя его элемент на месте из \c args. */
+            template <typename... Args>
+            explicit Node(InPlace, Args&&... args)
+                    : TFields(nullptr, nullptr, nullptr, BLACK, std::forward<Args>(args)...)
+            {
             }
 
-            ~Node();                                ///< Деструктор нода гарантированно грохнет всех потомков.
+            /** \brief Деструктор разрушает только сам узел: потомков и память из-под узлов
+             *  освобождает дерево через свой пул.
+             */
+            ~Node() {}
 
         protected:
             Node(const Node&);                      ///< КК не доступен.
@@ -216,10 +849,40 @@ namespace xi {
             Node* setRight(Node* rg);
 
             /** \brief Делает узел черным. */
-            void setBlack() { _color = BLACK; }
+            void setBlack() { setColor(BLACK); }
 
             /** \brief Делает узел красным. */
-            void setRed() { _color = RED; }
+            void setRed() { setColor(RED); }
+
+
+            // доступ к родителю и цвету — через методы, т.к. в компактной раскладке они хранятся в одном слове
+
+            /** \brief Возвращает родителя узла. */
+            using TFields::parent;
+
+            /** \brief Устанавливает родителя узла, не трогая его цвет и дочерние связи родителя. */
+            using TFields::setParent;
+
+            /** \brief Устанавливает цвет узла. */
+            void setColor(Color col) { this->setColorBit(col); }
+
+            // флаги ослабленной балансировки: лишний черный остается за позицией узла в дереве, как
+            // цвет, а признак записи в очереди — за самим узлом
+
+            /** \brief Возвращает истину, если у узла установлен флаг \c flag. */
+            bool hasFlag(Flag flag) const { return TFields::hasFlag(flag); }
+
+            /** \brief Устанавливает (\c on) или сбрасывает флаг \c flag узла. */
+            void setFlag(Flag flag, bool on) { TFields::setFlag(flag, on); }
+
+            /** \brief Устанавливает или снимает лишний черный. */
+            void setExtraBlack(bool on) { setFlag(EXTRA_BLACK, on); }
+
+            /** \brief Возвращает истину, если узел записан в очередь отложенных нарушений дерева. */
+            bool isQueued() const { return hasFlag(QUEUED); }
+
+            /** \brief Отмечает, записан ли узел в очередь отложенных нарушений. */
+            void setQueued(bool on) { setFlag(QUEUED, on); }
 
 
             // хелперные методы получение родственничков
@@ -236,9 +899,9 @@ namespace xi {
             Node* brother()
             {
                 if (isLeftChild())
-                    return _parent->_right;
+                    return parent()->_right;
                 else
-                    return _parent->_left;
+                    return parent()->_left;
             }
 
             Node* getUncle()
@@ -249,9 +912,9 @@ namespace xi {
                     return nullptr;
 
                 if (node->isLeftChild())
-                    return node->_parent->_right;
+                    return node->parent()->_right;
                 else
-                    return node->_parent->_left;
+                    return node->parent()->_left;
             }
 
             /** \brief Еще один метод получение папочки: если он есть, возвращает по значению и устанавливает
@@ -260,13 +923,13 @@ namespace xi {
              */
             Node* getDaddy(bool& isLeftChild)
             {
-                if (!_parent)
+                if (!parent())
                     return nullptr;
 
                 // определяем, левый ли this детеныш
-                isLeftChild = (_parent->_left == this);
+                isLeftChild = (parent()->_left == this);
 
-                return _parent;
+                return parent();
             }
 
             /** \brief Возвращает ребенка этого узла: (isLeft) — левого, иначе правого. */
@@ -283,27 +946,116 @@ namespace xi {
             bool isSpecificChildPrv(bool isLeft) const
             {
                 if (isLeft)         // проверяем, является ли левым узлом
-                    return (_parent->_left == this);
+                    return (parent()->_left == this);
                 // иначе проверяем, является ли правым узлом
-                return (_parent->_right == this);
+                return (parent()->_right == this);
             }
+        }; // class RBTree::Node
 
+        friend class Node;
 
 
-        protected:
-            Element _key;                           ///< Несомая узлом информация.
-            Color   _color;                         ///< Цвет элемента.
+        /** \brief Двунаправленный итератор по элементам дерева в порядке возрастания.
+         *
+         *  Шаг выполняется по связям узлов (в среднем за O(1), в худшем за высоту дерева) без
+         *  рекурсии и вспомогательного стека. Элементы менять через итератор нельзя, т.к. это
+         *  нарушило бы порядок. Итератор остается в силе, пока не удален узел, на который он
+         *  указывает; \c end() представлен пустым узлом, и его декремент дает последний элемент.
+         */
+        class ConstIterator {
+            friend class RBTree<Element, Compar, Allocator, Augment, Layout>;
 
-            Node*   _parent;                        ///< Родитель узла.
-            Node*   _left;                          ///< Левый потомок.
-            Node*   _right;                         ///< Правый потомок.
-        }; // class RBTree::Node
+        public:
+            typedef std::bidirectional_iterator_tag iterator_category;
+            typedef Element                         value_type;
+            typedef std::ptrdiff_t                  difference_type;
+            typedef const Element*                  pointer;
+            typedef const Element&                  reference;
 
-        friend class Node;
+        public:
+            ConstIterator() : _node(nullptr), _tree(nullptr) {}
 
-    public:
-        RBTree();                                   ///< Конструктор по умолчанию.
-        ~RBTree();                                  ///< Деструктор.
+            reference operator*() const { return _node->getKey(); }
+            pointer operator->() const { return &_node->getKey(); }
+
+            ConstIterator& operator++()
+            {
+                _node = _node->getNext();
+                return *this;
+            }
+
+            ConstIterator operator++(int)
+            {
+                ConstIterator prev(*this);
+                ++*this;
+                return prev;
+            }
+
+            ConstIterator& operator--()
+            {
+                _node = _node ? _node->getPrev() : _tree->_rightmost;
+                return *this;
+            }
+
+            ConstIterator operator--(int)
+            {
+                ConstIterator prev(*this);
+                --*this;
+                return prev;
+            }
+
+            bool operator==(const ConstIterator& other) const { return _node == other._node; }
+            bool operator!=(const ConstIterator& other) const { return _node != other._node; }
+
+            /** \brief Возвращает узел, на который указывает итератор (\c nullptr для \c end()). */
+            const Node* getNode() const { return _node; }
+
+        protected:
+            ConstIterator(const Node* node, const RBTree* tree) : _node(node), _tree(tree) {}
+
+        protected:
+            const Node*   _node;                    ///< Текущий узел или \c nullptr для \c end().
+            const RBTree* _tree;                    ///< Дерево — нужно для декремента \c end().
+        }; // class RBTree::ConstIterator
+
+        /** \brief Полуинтервал элементов дерева [first, last) для обхода range-based for. */
+        class Range {
+        public:
+            Range(const ConstIterator& first, const ConstIterator& last) : _first(first), _last(last) {}
+
+            ConstIterator begin() const { return _first; }
+            ConstIterator end() const { return _last; }
+
+            /** \brief Возвращает истину, если в полуинтервале нет элементов. */
+            bool isEmpty() const { return _first == _last; }
+
+        protected:
+            ConstIterator _first;                   ///< Первый элемент.
+            ConstIterator _last;                    ///< Элемент за последним.
+        }; // class RBTree::Range
+
+        typedef ConstIterator                           iterator;
+        typedef ConstIterator                           const_iterator;
+        typedef std::reverse_iterator<ConstIterator>    reverse_iterator;
+        typedef std::reverse_iterator<ConstIterator>    const_reverse_iterator;
+
+    public:
+        RBTree();                                   ///< Конструктор по умолчанию.
+
+        /** \brief Создает пустое дерево, узлы которого размещаются аллокатором \c alloc. */
+        explicit RBTree(const Allocator& alloc);
+
+        /** \brief Создает пустое дерево с компаратором \c compar и аллокатором \c alloc. */
+        explicit RBTree(const Compar& compar, const Allocator& alloc = Allocator());
+
+        /** \brief Строит дерево из строго возрастающей последовательности [first, last) за линейное
+         *  время (см. \c buildFromSorted()).
+         */
+        template <typename ForwardIt>
+        RBTree(ForwardIt first, ForwardIt last,
+               const Compar& compar = Compar(), const Allocator& alloc = Allocator());
+
+        ~RBTree();                                  ///< Деструктор.
 
     public:
         // Основные операции над деревом
@@ -314,10 +1066,262 @@ namespace xi {
          *  <b style='color:orange'>Для реализации студентами.</b>
          *
          *  Т.к. дубликаты не допустимы, элемента с ключом \c key в дереве быть не должно. Если
-         *  же такой элемент уже существует, генерируется исключительная ситуация \c std::invalid_argument.
+         *  же такой элемент уже существует, генерируется исключительная ситуация \c std::logic_error.
+         *  Если дубликаты — штатная ситуация, дешевле пользоваться \c tryInsert().
          */
         void insert(const Element& key);
 
+        /** \brief Вставляет элемент \c key, если его еще нет в дереве, не генерируя исключений на дубликатах.
+         *
+         *  Место вставки и дубликат находятся за один спуск от корня.
+         *  \returns пару из узла элемента и признака того, что он был вставлен (ложь, если элемент
+         *  уже был в дереве — тогда возвращается его узел).
+         */
+        std::pair<const Node*, bool> tryInsert(const Element& key);
+
+        /** \brief Вставляет элемент \c key, перемещая его в узел; исключения — как у \c insert(const Element&). */
+        void insert(Element&& key);
+
+        /** \brief Аналог \c tryInsert(const Element&), перемещающий \c key в узел. Если элемент уже
+         *  есть в дереве, \c key остается нетронутым.
+         */
+        std::pair<const Node*, bool> tryInsert(Element&& key);
+
+        /** \brief Конструирует элемент из \c args прямо в новом узле и вставляет его, если
+         *  эквивалентного элемента в дереве еще нет.
+         *
+         *  Поскольку ключ известен только после конструирования, узел строится до спуска и при
+         *  дубликате сразу возвращается в пул.
+         *  \returns пару из узла элемента и признака того, что он был вставлен.
+         */
+        template <typename... Args>
+        std::pair<const Node*, bool> emplace(Args&&... args);
+
+        /** \brief Заменяет содержимое дерева элементами строго возрастающей последовательности
+         *  [first, last) за O(n).
+         *
+         *  Дерево строится сразу идеально сбалансированным: поддеревья каждого узла различаются по
+         *  размеру не более чем на единицу, поэтому все пустые ссылки лежат на двух нижних уровнях,
+         *  и достаточно покрасить самый нижний уровень в красный, а остальные — в черный. Сравнения
+         *  выполняются только между соседними элементами для проверки порядка. Если последовательность
+         *  не строго возрастает, генерируется \c std::invalid_argument; при любом исключении дерево
+         *  остается пустым.
+         */
+        template <typename ForwardIt>
+        void buildFromSorted(ForwardIt first, ForwardIt last);
+
+        /** \brief Вставляет пакет элементов [first, last) в произвольном порядке.
+         *
+         *  Пакет сортируется и очищается от повторов (уже строго возрастающий — за m - 1 сравнений
+         *  без сортировки). Дальше, если в дереве не больше \c REBUILD_RATIO * m элементов, оно
+         *  сливается с пакетом и перестраивается целиком, как в \c buildFromSorted(): O(n + m)
+         *  сравнений и ни одной перебалансировки. В большое дерево элементы вставляются по
+         *  возрастанию "с пальцем": место каждого следующего ищется не от корня, а от предыдущего
+         *  вставленного узла, что для плотных пакетов стоит несколько сравнений вместо O(log n).
+         *  Для случайного неупорядоченного пакета в большое дерево выигрыша по сравнениям нет:
+         *  сортировка пакета обходится дороже, чем экономит вставка.
+         *
+         *  При исключении во время слияния дерево не меняется; при вставке "с пальцем" уже
+         *  вставленные элементы остаются в дереве.
+         *  \returns для каждого элемента пакета в исходном порядке — истину, если он вставлен,
+         *  и ложь, если эквивалентный элемент уже был в дереве или раньше в пакете.
+         */
+        template <typename ForwardIt>
+        std::vector<bool> insertBatch(ForwardIt first, ForwardIt last);
+
+        /** \brief Заменяет содержимое дерева элементами [first, last) в произвольном порядке, используя
+         *  до \c threads потоков.
+         *
+         *  Элементы копируются в буфер, который делится на куски по потоку (не мельче
+         *  \c PARALLEL_MIN_CHUNK). Куски сортируются параллельно и сливаются попарно раундами, пары
+         *  каждого раунда — тоже параллельно. Повторы удаляются в каждом куске отдельно, а на стыке
+         *  кусков — одним сравнением. Затем дерево строится сразу сбалансированным, с раскраской как
+         *  в \c buildFromSorted(): верхние уровни — в вызывающем потоке, поддеревья под ними —
+         *  параллельно, каждое в пуле своего рабочего дерева, которые потом объединяются с пулом
+         *  этого. Работа — O(n log n); последнее слияние и верхние уровни — в одном потоке.
+         *
+         *  Из эквивалентных элементов остается первый по порядку входа. Компаратор вызывается
+         *  одновременно из нескольких потоков. При исключении дерево остается пустым.
+         */
+        template <typename ForwardIt>
+        void buildFromUnsorted(ForwardIt first, ForwardIt last,
+                               unsigned threads = std::thread::hardware_concurrency());
+
+    public:
+        // Соединение и разрезание деревьев за O(log n). Узлы переходят между деревьями без
+        // копирования, поэтому деревья объединяют свои пулы (см. NodePool::unite()) и их аллокаторы
+        // должны быть равны, иначе генерируется std::invalid_argument. Компараторы деревьев
+        // предполагаются одинаково упорядочивающими. После этого деревья, разделившие пул, нельзя
+        // менять одновременно из разных потоков.
+
+        /** \brief Дописывает к дереву элемент \c pivot и все элементы дерева \c right, которое
+         *  становится пустым.
+         *
+         *  Все элементы дерева должны быть меньше \c pivot, а \c pivot — меньше всех элементов
+         *  \c right; это проверяется двумя сравнениями с крайними элементами, и при нарушении
+         *  генерируется \c std::invalid_argument. Дерево меньшей черной высоты подвешивается
+         *  через узел \c pivot к краю большего на уровне с той же черной высотой, после чего
+         *  остается одна перебалансировка, как при вставке: O(1 + разность высот).
+         */
+        void join(const Element& pivot, RBTree& right);
+
+        /** \brief Аналог \c join(const Element&, RBTree&) без разделителя: им становится наименьший
+         *  узел \c right, перенесенный без копирования элемента.
+         */
+        void join(RBTree& right);
+
+        /** \brief Разрезает дерево по ключу \c key: в нем остаются элементы меньше \c key, а
+         *  элементы больше \c key переходят в \c greater. Элемент, равный \c key, удаляется.
+         *
+         *  Прежнее содержимое \c greater удаляется. Все сравнения выполняются одним спуском до
+         *  каких-либо изменений, поэтому при исключении из компаратора деревья остаются прежними.
+         *  Затем поддеревья, отсеченные вдоль пути спуска, собираются снизу вверх соединениями,
+         *  как в \c join(), суммарно за O(log n).
+         *  \returns истину, если элемент, равный \c key, был в дереве.
+         */
+        bool split(const Element& key, RBTree& greater) { return splitPrv(key, greater); }
+
+        template <typename Key, typename C = Compar,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value>::type>
+        bool split(const Key& key, RBTree& greater) { return splitPrv(key, greater); }
+
+    public:
+        // Операции над множествами на основе join() и split(): разделителем служит корень дерева
+        // other, этим ключом режется дерево, а половины обрабатываются рекурсивно и соединяются.
+        // Работа — O(m log(n/m + 1)) для деревьев размеров m <= n, глубина — O(log^2 n); половины
+        // крупных подзадач считаются параллельно в std::async, так что одновременно работает
+        // порядка 2 * threads задач. Узлы other переходят в дерево или освобождаются, само other
+        // становится пустым; из эквивалентных элементов остается элемент этого дерева. Чтобы
+        // сохранить other, в операцию передают его копию, например RBTree(other.begin(), other.end()).
+        //
+        // Компаратор вызывается из нескольких потоков (у каждой задачи своя копия). Если он
+        // генерирует исключение, операция прерывается, но дерево остается правильным: в нем все его
+        // элементы, которые операция еще не удалила, и уже добавленные элементы other; остальные
+        // элементы other разрушаются, а само other пусто.
+        // Требования к аллокаторам — как у join(); при нехватке потоков задачи выполняются
+        // в вызывающем потоке.
+
+        /** \brief Добавляет в дерево все элементы \c other (объединение). */
+        void unite(RBTree& other, unsigned threads = std::thread::hardware_concurrency())
+        {
+            combine(SET_UNION, other, threads);
+        }
+
+        /** \brief Оставляет в дереве только элементы, эквивалентные элементам \c other (пересечение). */
+        void intersect(RBTree& other, unsigned threads = std::thread::hardware_concurrency())
+        {
+            combine(SET_INTERSECTION, other, threads);
+        }
+
+        /** \brief Удаляет из дерева элементы, эквивалентные элементам \c other (разность). */
+        void subtract(RBTree& other, unsigned threads = std::thread::hardware_concurrency())
+        {
+            combine(SET_DIFFERENCE, other, threads);
+        }
+
+        /** \brief Удаляет все элементы дерева. Память узлов остается в пуле для следующих вставок. */
+        void clear()
+        {
+            dropPending();
+            deleteNode(_root);
+            _root = _leftmost = _rightmost = nullptr;
+        }
+
+    public:
+        // Ослабленная балансировка (relaxed balance). Вставка и удаление в таком режиме меняют
+        // только связи у места операции, а нарушения записывают в очередь; повороты и перекраски
+        // выполняются позже, порциями, в rebalancePending(). Нарушения бывают двух видов: красный
+        // узел под красным папой и лишний черный — нехватка черного, оставшаяся от удаленного
+        // черного узла и поднятая в ближайший узел, где она хранится флагом рядом с цветом (см.
+        // Node::hasExtraBlack()). Черная высота с учетом лишних черных на всех путях одинакова,
+        // поэтому поиск, обход и границы работают как обычно, но высота дерева, пока очередь не
+        // разобрана, логарифмом не ограничена.
+        //
+        // Удаление черного листа на месте делает столько шагов починки, сколько нужно, чтобы
+        // забрать из-под листа его черный (обычно один); если шагу мешают соседние отложенные
+        // нарушения — красный брат под красным папой, красный ребенок красного брата или лишний
+        // черный у папы, — сначала чинятся они, и только они: очередь целиком удаление не
+        // разбирает. Удаленный узел, еще записанный в очереди, разрушается, когда до него дойдет
+        // rebalancePending(). Соединение, разрезание и операции над множествами требуют правильного
+        // дерева и сначала разбирают очередь целиком; нисходящие вставка и удаление в этом режиме
+        // совпадают с обычными.
+
+        /** \brief Включает или выключает ослабленную балансировку. При выключении очередь
+         *  нарушений разбирается целиком.
+         */
+        void setRelaxed(bool relaxed)
+        {
+            _relaxed = relaxed;
+            if (!relaxed)
+                rebalancePending();
+        }
+
+        /** \brief Возвращает истину, если включена ослабленная балансировка. */
+        bool isRelaxed() const { return _relaxed; }
+
+        /** \brief Разбирает не больше \c budget записей очереди отложенных нарушений, начиная
+         *  с давних, и возвращает число оставшихся записей.
+         *
+         *  Единица бюджета — один локальный шаг (перекраска семейства или одно-два вращения) либо
+         *  одна отброшенная запись: устаревшая (нарушение уже исчезло) или удаленный узел, который
+         *  теперь разрушается. Поэтому за вызов очередь короче не больше чем на \c budget. Шаг
+         *  чинит нарушение очередного узла, а если ему мешает соседнее — сначала то: в цепочке
+         *  красных — верхнее, у лишнего черного — нарушение брата, племянника или папы. Дерево все
+         *  время остается деревом поиска с одинаковой (с учетом лишних черных) черной высотой;
+         *  нарушение, поднятое шагом выше, ставится в очередь. Дерево, как и любые изменения, нужно
+         *  защищать от одновременного доступа: фоновая задача вызывает метод под той же
+         *  блокировкой, что и писатели.
+         *  \returns число записей, оставшихся в очереди (включая, возможно, устаревшие).
+         */
+        std::size_t rebalancePending(std::size_t budget = std::numeric_limits<std::size_t>::max());
+
+        /** \brief Возвращает число записей в очереди отложенных нарушений — оценку сверху, включая
+         *  устаревшие и удаленные узлы; каждый узел записан в ней не больше одного раза.
+         */
+        std::size_t getPendingCount() const { return _pending.size() - _pendingHead; }
+
+    public:
+        // Нисходящие (top-down) вставка и удаление: перекраски и повороты выполняются по пути вниз,
+        // так что к месту вставки или удаления дерево уже готово, и подниматься обратно по _parent
+        // не нужно — путь проходится один раз. Указатели на родителей при поворотах по-прежнему
+        // поддерживаются, но только читаются и пишутся у соседних узлов. Исключение — аугментация:
+        // агрегаты предков обновляются одним проходом вверх (pullAugPath()), для NoAugment его нет.
+        //
+        // Дерево остается правильным после каждого шага спуска, поэтому исключение из компаратора
+        // или при создании узла оставляет правильное дерево с прежним набором элементов, хотя
+        // цвета и повороты могли уже измениться. В режиме ослабленной балансировки (см.
+        // setRelaxed()) они совпадают с tryInsert() и remove(), которые тоже ничего не чинят
+        // на обратном пути.
+
+        /** \brief Нисходящая вставка \c key; на дубликате генерирует \c std::logic_error. */
+        void insertTopDown(const Element& key)
+        {
+            if (!tryInsertTopDown(key).second)
+                throw std::logic_error("Tree already has such key!");
+        }
+
+        /** \brief Нисходящая вставка \c key, если его еще нет.
+         *
+         *  На пути вниз черный узел с двумя красными детьми перекрашивается наоборот; если он
+         *  оказался под красным папой, нарушение снимается одним-двумя поворотами над ним, как в
+         *  \c rebalanceDUG() (дядя в этот момент всегда черный). Поэтому новый красный лист
+         *  конфликтует разве что с папой, и это чинится так же, на месте.
+         *  \returns пару из узла элемента и признака того, что он был вставлен.
+         */
+        std::pair<const Node*, bool> tryInsertTopDown(const Element& key);
+
+#ifdef RBTREE_WITH_DELETION
+        /** \brief Нисходящее удаление \c key; если элемента нет, генерирует \c std::logic_error.
+         *
+         *  Спуск идет к \c key, а от него — к его предшественнику, и проталкивает красный цвет
+         *  вниз: каждый следующий узел пути делается красным перекраской или поворотом у папы и
+         *  брата. Поэтому последний узел пути — красный лист (или единственный корень), и его
+         *  позиция освобождается без \c deleteFixUp(). Узел с ключом, как и в \c remove(), меняется
+         *  с предшественником местами, а не ключами.
+         */
+        void removeTopDown(const Element& key);
+#endif
+
 #ifdef RBTREE_WITH_DELETION
 
         /** \brief Ищет узел, соответствующий ключу \c key, и удаляет узел из дерева
@@ -329,6 +1333,21 @@ namespace xi {
          */
         void remove(const Element& key);
 
+        /** \brief Удаляет элемент, эквивалентный ключу \c key произвольного типа.
+         *
+         *  Доступно только для прозрачных компараторов (см. \c IsTransparentCompar).
+         */
+        template <typename Key, typename C = Compar,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value>::type>
+        void remove(const Key& key)
+        {
+            Node* node = findNode(key);
+            if (node == nullptr)
+                throw std::logic_error("No such node!");
+
+            removeNode(node);
+        }
+
         void deleteFixUp(Node* node);
 #endif
 
@@ -338,18 +1357,142 @@ namespace xi {
          *
          *  \returns узел элемента \c key, если он есть в дереве, иначе \c nullptr.
          */
-        const Node* find(const Element& key);
+        const Node* find(const Element& key) const;
+
+        /** \brief Ищет элемент, эквивалентный ключу \c key произвольного типа (например, строку
+         *  по <tt>const char*</tt>).
+         *
+         *  Доступно только для прозрачных компараторов (см. \c IsTransparentCompar).
+         */
+        template <typename Key, typename C = Compar,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value>::type>
+        const Node* find(const Key& key) const { return findNode(key); }
 
         /** \brief Возвращает истину, если дерево пусто, ложь иначе. */
         bool isEmpty() const { return _root == nullptr; }
 
         /** \brief Возвращает неизменяемый указатель на корневой элемент. */
         const Node* getRoot() const { return _root;  }
+
+    public:
+        // Обход в порядке возрастания; крайние узлы кешируются, поэтому begin() и rbegin() — O(1)
+
+        ConstIterator begin() const { return ConstIterator(_leftmost, this); }
+        ConstIterator end() const { return ConstIterator(nullptr, this); }
+
+        const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+        const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+        /** \brief Возвращает итератор на узел \c nd этого дерева (например, найденный \c find()). */
+        ConstIterator makeIterator(const Node* nd) const { return ConstIterator(nd, this); }
+
+    public:
+        // Запросы по диапазонам: один спуск O(log n) на границу, дальше — потоковый обход итератором.
+        // Для прозрачных компараторов (см. IsTransparentCompar) границы могут быть любого
+        // сравнимого с Element типа.
+
+        /** \brief Возвращает итератор на первый элемент, не меньший \c key (или \c end()). */
+        ConstIterator lowerBound(const Element& key) const { return makeIterator(lowerBoundNode(key)); }
+
+        template <typename Key, typename C = Compar,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value>::type>
+        ConstIterator lowerBound(const Key& key) const { return makeIterator(lowerBoundNode(key)); }
+
+        /** \brief Возвращает итератор на первый элемент, строго больший \c key (или \c end()). */
+        ConstIterator upperBound(const Element& key) const { return makeIterator(upperBoundNode(key)); }
+
+        template <typename Key, typename C = Compar,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value>::type>
+        ConstIterator upperBound(const Key& key) const { return makeIterator(upperBoundNode(key)); }
+
+        /** \brief Возвращает полуинтервал элементов, эквивалентных \c key: пустой или из одного
+         *  элемента, т.к. дубликатов в дереве нет. Выполняется за один спуск.
+         */
+        std::pair<ConstIterator, ConstIterator> equalRange(const Element& key) const
+        {
+            return equalRangePrv(key);
+        }
+
+        template <typename Key, typename C = Compar,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value>::type>
+        std::pair<ConstIterator, ConstIterator> equalRange(const Key& key) const
+        {
+            return equalRangePrv(key);
+        }
+
+        /** \brief Возвращает элементы из полуинтервала [lo, hi) в порядке возрастания.
+         *  Если \c hi не больше \c lo, диапазон пуст.
+         */
+        Range range(const Element& lo, const Element& hi) const { return rangePrv(lo, hi); }
+
+        template <typename KeyLo, typename KeyHi, typename C = Compar,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value>::type>
+        Range range(const KeyLo& lo, const KeyHi& hi) const { return rangePrv(lo, hi); }
+
+    public:
+        // Порядковые статистики: доступны только с политикой OrderStatAugment, все за O(log n).
+        // Позиции считаются от нуля в порядке возрастания элементов.
+
+        /** \brief Возвращает итератор на элемент с позицией \c k или \c end(), если \c k не меньше
+         *  числа элементов.
+         */
+        template <typename A = Augment,
+                  typename = typename std::enable_if<std::is_same<A, OrderStatAugment>::value>::type>
+        ConstIterator select(std::size_t k) const { return makeIterator(selectNode(k)); }
+
+        /** \brief Возвращает число элементов, строго меньших \c key; для элемента дерева это его позиция. */
+        template <typename A = Augment,
+                  typename = typename std::enable_if<std::is_same<A, OrderStatAugment>::value>::type>
+        std::size_t rank(const Element& key) const { return countLess(key); }
+
+        template <typename Key, typename C = Compar, typename A = Augment,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value
+                                                     && std::is_same<A, OrderStatAugment>::value>::type>
+        std::size_t rank(const Key& key) const { return countLess(key); }
+
+        /** \brief Возвращает число элементов в полуинтервале [lo, hi), т.е. длину \c range(lo, hi). */
+        template <typename A = Augment,
+                  typename = typename std::enable_if<std::is_same<A, OrderStatAugment>::value>::type>
+        std::size_t countInRange(const Element& lo, const Element& hi) const { return countInRangePrv(lo, hi); }
+
+        template <typename KeyLo, typename KeyHi, typename C = Compar, typename A = Augment,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value
+                                                     && std::is_same<A, OrderStatAugment>::value>::type>
+        std::size_t countInRange(const KeyLo& lo, const KeyHi& hi) const { return countInRangePrv(lo, hi); }
+
+        /** \brief Возвращает число элементов дерева за O(1). */
+        template <typename A = Augment,
+                  typename = typename std::enable_if<std::is_same<A, OrderStatAugment>::value>::type>
+        std::size_t getSize() const { return _root ? _root->getAugment() : 0; }
+
+    public:
+        // Агрегаты по диапазонам: доступны с любой политикой аугментации, кроме NoAugment
+
+        /** \brief Тип агрегата политики аугментации (\c void для \c NoAugment). */
+        typedef typename NodeAugment<Augment>::value_type AugmentValue;
+
+        /** \brief Возвращает агрегат элементов полуинтервала [lo, hi) в порядке возрастания за
+         *  O(log n), не обходя сами элементы. Для пустого диапазона — \c Augment::identity().
+         */
+        template <typename A = Augment,
+                  typename = typename std::enable_if<!std::is_same<A, NoAugment>::value>::type>
+        AugmentValue aggregate(const Element& lo, const Element& hi) const { return aggregatePrv(lo, hi); }
+
+        template <typename KeyLo, typename KeyHi, typename C = Compar, typename A = Augment,
+                  typename = typename std::enable_if<IsTransparentCompar<C>::value
+                                                     && !std::is_same<A, NoAugment>::value>::type>
+        AugmentValue aggregate(const KeyLo& lo, const KeyHi& hi) const { return aggregatePrv(lo, hi); }
+
+        /** \brief Возвращает копию аллокатора дерева. */
+        Allocator getAllocator() const { return _pool->getAllocator(); }
+
+        /** \brief Возвращает копию компаратора дерева. */
+        Compar getCompar() const { return _compar; }
     public:
         // Отладочные операции
 
         /** \brief Устанавливает отладочный дампер. */
-        void setDumper(IRBTreeDumper<Element, Compar>* dumper)
+        void setDumper(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>* dumper)
         {
             _dumper = dumper;
         }
@@ -373,11 +1516,133 @@ namespace xi {
          */
         Node* insertNewBstEl(const Element& key);
 
+        /** \brief Добавляет новый узел в дерево, как в обычном BST, если элемента \c key там еще нет.
+         *
+         *  \returns пару из узла элемента и признака того, что узел новый.
+         */
+        template <typename Key>
+        std::pair<Node*, bool> insertBstEl(Key&& key);
+
+        /** \brief Завершает вставку, начатую \c insertBstEl(): для нового узла шлет отладочные
+         *  события и перебалансирует дерево.
+         */
+        std::pair<const Node*, bool> completeInsert(std::pair<Node*, bool> res);
+
+        /** \brief За один спуск от корня ищет место для элемента \c key.
+         *
+         *  На каждом уровне выполняется одно сравнение: кандидатом в дубликаты служит последний
+         *  узел, от которого спуск ушел вправо, и он проверяется одним сравнением в конце.
+         *  \returns узел с элементом, равным \c key, если такой есть. Иначе \c nullptr, а в \c parent
+         *  записывается будущий родитель (\c nullptr для пустого дерева), в \c isLeft — сторона.
+         */
+        Node* findInsertPos(const Element& key, Node*& parent, bool& isLeft) const
+        {
+            return findInsertPos(key, _root, parent, isLeft, ThreeWayTag());
+        }
+
+        /** \brief Аналог \c findInsertPos(), спускающийся не от корня, а от узла \c from, в поддереве
+         *  которого заведомо лежит место элемента \c key (см. \c fingerRoot()).
+         */
+        Node* findInsertPos(const Element& key, Node* from, Node*& parent, bool& isLeft) const
+        {
+            return findInsertPos(key, from, parent, isLeft, ThreeWayTag());
+        }
+
+        /** \brief Возвращает корень наименьшего поддерева, в котором лежит место элемента \c key,
+         *  больший ключа узла \c finger: поднимается от \c finger, пока не встретит предка с ключом
+         *  больше \c key слева. Для \c finger, равного \c nullptr, возвращает корень.
+         */
+        Node* fingerRoot(Node* finger, const Element& key) const;
+
+        /** \brief Подвешивает свободный узел \c nd к \c parent со стороны \c isLeft
+         *  (или делает его корнем, если \c parent пуст).
+         */
+        void attachNode(Node* nd, Node* parent, bool isLeft);
+
+
+        // Спуск по ключу: реализации для обычного и трехзначного компаратора выбираются по тегу
+
+        /** \brief Тег режима компаратора: \c std::true_type для трехзначного. */
+        typedef typename IsThreeWayCompar<Compar>::type ThreeWayTag;
+
+        /** \brief Возвращает истину, если \c a строго меньше \c b по компаратору дерева. */
+        template <typename A, typename B>
+        bool keyLess(const A& a, const B& b) const { return keyLess(a, b, ThreeWayTag()); }
+
+        template <typename A, typename B>
+        bool keyLess(const A& a, const B& b, std::false_type) const { return _compar(a, b); }
+
+        template <typename A, typename B>
+        bool keyLess(const A& a, const B& b, std::true_type) const { return _compar(a, b) < 0; }
+
+        /** \brief Возвращает первый узел с ключом не меньше \c key или \c nullptr. */
+        template <typename Key>
+        Node* lowerBoundNode(const Key& key) const;
+
+        /** \brief Возвращает первый узел с ключом строго больше \c key или \c nullptr. */
+        template <typename Key>
+        Node* upperBoundNode(const Key& key) const;
+
+        template <typename Key>
+        std::pair<ConstIterator, ConstIterator> equalRangePrv(const Key& key) const;
+
+        template <typename KeyLo, typename KeyHi>
+        Range rangePrv(const KeyLo& lo, const KeyHi& hi) const;
+
+
+        // Поддержка аугментации: данные узла пересчитываются из детей после каждого изменения
+        // структуры — локально при поворотах и вдоль пути до корня при вставке и удалении
+
+        /** \brief Признак отсутствия аугментации: тогда пересчет по пути до корня не выполняется вовсе. */
+        static const bool NO_AUGMENT = std::is_same<Augment, NoAugment>::value;
+
+        /** \brief Пересчитывает данные узла \c nd по его детям. */
+        static void pullAug(Node* nd) { nd->pullAug(nd->_left, nd->_right, nd->_key); }
+
+        /** \brief Пересчитывает данные узла \c nd и всех его предков. */
+        static void pullAugPath(Node* nd)
+        {
+            if (NO_AUGMENT)
+                return;
+
+            for (; nd; nd = nd->parent())
+                pullAug(nd);
+        }
+
+        /** \brief Возвращает узел с позицией \c k или \c nullptr. */
+        Node* selectNode(std::size_t k) const;
+
+        /** \brief Возвращает число элементов, строго меньших \c key. */
+        template <typename Key>
+        std::size_t countLess(const Key& key) const;
+
+        template <typename KeyLo, typename KeyHi>
+        std::size_t countInRangePrv(const KeyLo& lo, const KeyHi& hi) const;
+
+        template <typename KeyLo, typename KeyHi>
+        AugmentValue aggregatePrv(const KeyLo& lo, const KeyHi& hi) const;
+
+        /** \brief Ищет узел с ключом, эквивалентным \c key; одно сравнение на уровень спуска. */
+        template <typename Key>
+        Node* findNode(const Key& key) const { return findNode(key, ThreeWayTag()); }
+
+        template <typename Key>
+        Node* findNode(const Key& key, std::false_type) const;
+
+        template <typename Key>
+        Node* findNode(const Key& key, std::true_type) const;
+
+        Node* findInsertPos(const Element& key, Node* from, Node*& parent, bool& isLeft, std::false_type) const;
+        Node* findInsertPos(const Element& key, Node* from, Node*& parent, bool& isLeft, std::true_type) const;
+
         /** \brief Выполняет перебалансировку дерева после добавления нового элемента в узел \c nd.
          *
          *  <b style='color:orange'>Для реализации студентами.</b>
+         *
+         *  \returns истину, если в конце пришлось перекрасить красный корень в черный, т.е. черная
+         *  высота дерева выросла на единицу.
          */
-        void rebalance(Node* nd);
+        bool rebalance(Node* nd);
 
 
         /** \brief Выполняет перебалансировку локальных предков узла \c nd: папы, дяди и дедушки.
@@ -388,7 +1653,257 @@ namespace xi {
          */
         Node* rebalanceDUG(Node* nd);
 
-        /** \brief Удаляет нод со всеми его потомками, освобождая память из-под них. */
+        /** \brief Возвращает истину, если \c nd — красный узел (пустой узел черный). */
+        static bool isRedNode(const Node* nd) { return nd && nd->isRed(); }
+
+        // ослабленная балансировка (см. setRelaxed())
+
+        /** \brief Возвращает истину, если у узла дерева \c nd есть отложенное нарушение: лишний
+         *  черный или красный папа при красном узле.
+         */
+        bool hasViolation(const Node* nd) const
+        {
+            return nd->hasExtraBlack() || (nd != _root && nd->isRed() && nd->parent()->isRed());
+        }
+
+        /** \brief Резервирует в очереди место еще для \c n записей, чтобы последующий
+         *  \c notePending() не бросал исключений.
+         */
+        void reservePending(std::size_t n);
+
+        /** \brief Записывает \c nd в очередь, если у него есть нарушение, а записи еще нет. Место
+         *  должно быть зарезервировано.
+         */
+        void notePending(Node* nd);
+
+        /** \brief Прибавляет узлу \c nd, у которого нет лишнего черного, один черный: красный
+         *  чернеет, черный получает лишний черный (у корня он не нужен).
+         */
+        void addBlack(Node* nd);
+
+        /** \brief Переносит лишний черный (если есть) с узла \c from на узел \c to. */
+        void moveExtraBlack(Node* from, Node* to);
+
+        /** \brief Выполняет один шаг починки для верхнего нарушения цепочки красных над красным
+         *  узлом \c nd под красным папой; лишний черный черного дедушки уходит вниз.
+         */
+        void repairRed(Node* nd);
+
+        /** \brief Пытается забрать один черный из-под узла \c x: его лишний черный, а если его
+         *  нет, то собственный черный (так удаляемый черный лист освобождает место).
+         *
+         *  Шаг либо забирает черный (\c done становится истиной; если это собственный черный
+         *  \c x, черная высота под ним на единицу больше, пока \c x не исключен), либо поворотом
+         *  готовит следующий шаг, либо ничего не меняет и возвращает мешающий узел с нарушением,
+         *  которое нужно починить сначала.
+         *  \returns мешающий узел или \c nullptr, если шаг сделан.
+         */
+        Node* liftBlackStep(Node* x, bool& done);
+
+        /** \brief Выполняет один шаг починки нарушения узла \c nd, сначала — мешающих ему. */
+        void repairStep(Node* nd);
+
+        /** \brief Шагами забирает один черный из-под узла \c x, как \c liftBlackStep(). */
+        void liftBlack(Node* x);
+
+        /** \brief Очищает очередь: разрушает ждущие в ней удаленные узлы, а с остальных снимает
+         *  флаги. Нарушения остаются, поэтому дальше дерево должно строиться заново или удаляться.
+         */
+        void dropPending();
+
+        /** \brief Создает в пуле дерева новый узел, аргументы аналогичны конструктору \c Node. */
+        Node* createNode(const Element& key = Element(),
+                         Node* left = nullptr,
+                         Node* right = nullptr,
+                         Node* parent = nullptr,
+                         Color col = BLACK);
+
+        /** \brief Создает в пуле дерева свободный черный узел, конструируя элемент на месте из \c args. */
+        template <typename... Args>
+        Node* emplaceNode(Args&&... args);
+
+        /** \brief Строит из следующих \c count элементов \c it сбалансированное поддерево, корень
+         *  которого лежит на глубине \c depth; узлы глубины \c redDepth красятся в красный.
+         *
+         *  \c prev — последний построенный узел, с ним сравнивается очередной элемент. При исключении
+         *  уже построенные узлы поддерева возвращаются в пул.
+         */
+        template <typename ForwardIt>
+        Node* buildSubtree(ForwardIt& it, std::size_t count, std::size_t depth, std::size_t redDepth,
+                           Node*& prev);
+
+        /** \brief Во сколько раз дерево может быть больше пакета, чтобы \c insertBatch() еще
+         *  перестраивал его слиянием, а не вставлял элементы по одному.
+         */
+        static const std::size_t REBUILD_RATIO = 2;
+
+        /** \brief Наименьший кусок входа, который \c buildFromUnsorted() отдает отдельному потоку. */
+        static const std::size_t PARALLEL_MIN_CHUNK = 16384;
+
+        /** \brief Выполняет \c fn(0), ..., \c fn(count - 1) параллельно: \c fn(0) — в вызывающем
+         *  потоке, остальные — в \c std::async (или тут же, если поток не создался). Дожидается
+         *  всех и перебрасывает первое из возникших исключений.
+         */
+        template <typename Fn>
+        static void parallelFor(std::size_t count, Fn fn);
+
+        /** \brief Строит из элементов \c at(lo), ..., \c at(hi - 1) сбалансированное поддерево с корнем
+         *  на глубине \c depth, перемещая элементы в узлы и крася узлы глубины \c redDepth в
+         *  красный, как \c buildSubtree().
+         *
+         *  Пока \c forks не исчерпано, левая половина строится в другом потоке в пуле своего
+         *  рабочего дерева. При исключении построенные узлы возвращаются в пул.
+         */
+        template <typename At>
+        Node* buildRange(At& at, std::size_t lo, std::size_t hi, std::size_t depth, std::size_t redDepth,
+                         unsigned forks);
+
+        /** \brief Собирает в \c nodes узлы дерева по возрастанию, если их не больше \c limit.
+         *  \returns истину, если собраны все узлы; иначе \c nodes очищается.
+         */
+        bool collectInOrder(std::vector<Node*>& nodes, std::size_t limit) const;
+
+        /** \brief Сливает узлы дерева \c nodes с элементами \c batch в порядке \c order, создавая
+         *  узлы для новых, и перевязывает все узлы в сбалансированное дерево.
+         */
+        void mergeRebuild(const std::vector<Node*>& nodes, std::vector<Element>& batch,
+                          const std::vector<std::size_t>& order, std::vector<bool>& inserted);
+
+        /** \brief Перевязывает узлы \c nodes[lo, hi) в сбалансированное поддерево с корнем на глубине
+         *  \c depth, крася узлы глубины \c redDepth в красный, как \c buildSubtree().
+         */
+        Node* linkSubtree(const std::vector<Node*>& nodes, std::size_t lo, std::size_t hi,
+                          std::size_t depth, std::size_t redDepth);
+
+        /** \brief Объединяет пулы этого дерева и \c other, чтобы узлы могли переходить между ними.
+         *  Если аллокаторы деревьев не равны, генерирует \c std::invalid_argument.
+         */
+        void sharePool(RBTree& other);
+
+        /** \brief Возвращает черную высоту поддерева \c nd: число черных узлов на пути от него
+         *  (включительно) до пустой ссылки.
+         */
+        static std::size_t blackHeight(const Node* nd);
+
+        /** \brief Соединяет самостоятельные поддеревья \c l и \c r (черные корни без родителей,
+         *  черные высоты \c lbh и \c rbh) через свободный узел \c k, все ключи \c l которого
+         *  меньше ключа \c k, а все ключи \c r — больше.
+         *
+         *  Корень результата записывается в \c _root (крайние узлы не трогаются).
+         *  \returns черную высоту результата.
+         */
+        std::size_t joinNodes(Node* l, std::size_t lbh, Node* k, Node* r, std::size_t rbh);
+
+        /** \brief Делает поддерево \c nd черной высоты \c bh самостоятельным: обнуляет ссылку на
+         *  родителя и перекрашивает красный корень в черный.
+         *  \returns черную высоту самостоятельного поддерева.
+         */
+        static std::size_t detachSubtree(Node* nd, std::size_t bh)
+        {
+            if (!nd)
+                return 0;
+
+            nd->setParent(nullptr);
+            if (nd->isBlack())
+                return bh;
+
+            nd->setBlack();
+            return bh + 1;
+        }
+
+        /** \brief Соединяет самостоятельные поддеревья \c l и \c r без разделителя: им становится
+         *  наибольший узел \c l. \returns корень результата, его черная высота — в \c bh.
+         */
+        Node* joinNodes2(Node* l, std::size_t lbh, Node* r, std::size_t rbh, std::size_t& bh);
+
+        /** \brief Вид операции над множествами. */
+        enum SetOp {
+            SET_UNION,
+            SET_INTERSECTION,
+            SET_DIFFERENCE
+        };
+
+        /** \brief Черная высота, начиная с которой половины подзадачи операции над множествами
+         *  стоит считать параллельно: в таком поддереве не меньше 255 узлов.
+         */
+        static const std::size_t PARALLEL_GRAIN_BH = 8;
+
+        /** \brief Выполняет операцию \c op над деревом и \c other, опустошая \c other. */
+        void combine(SetOp op, RBTree& other, unsigned threads);
+
+        /** \brief Выполняет операцию \c op над самостоятельными поддеревьями \c a (элементы этого
+         *  дерева) и \c b (элементы другого), освобождая ненужные узлы в пул этого дерева.
+         *
+         *  Объект дерева служит рабочим пространством задачи: в нем меняются только \c _root
+         *  (рабочая ячейка соединений) и пул. Пока \c forks не исчерпано, левая половина крупной
+         *  подзадачи отдается в другой поток со своим рабочим деревом.
+         *
+         *  Корень результата записывается в \c res, его черная высота — в \c bh. Если компаратор
+         *  или запуск потока генерирует исключение, оно перебрасывается, а в \c res остается
+         *  правильное дерево из еще не удаленных элементов \c a и уже добавленных элементов \c b;
+         *  остальные узлы \c b освобождаются.
+         */
+        void combineNodes(SetOp op, Node* a, std::size_t abh, Node* b, std::size_t bbh,
+                          Node*& res, std::size_t& bh, unsigned forks);
+
+        /** \brief Соединяет дерево с деревом \c right через свободный узел \c k, опустошая \c right. */
+        void joinTrees(Node* k, RBTree& right);
+
+        template <typename Key>
+        bool splitPrv(const Key& key, RBTree& greater);
+
+        /** \brief Разрезает самостоятельное поддерево \c t черной высоты \c tbh по ключу \c key на
+         *  самостоятельные поддеревья \c l (ключи меньше) и \c r (ключи больше) с черными высотами
+         *  \c lbh и \c rbh. \c _root служит рабочей ячейкой соединений.
+         *
+         *  Все сравнения выполняются до изменений, поэтому при исключении из компаратора
+         *  поддерево не меняется.
+         *  \returns узел, эквивалентный \c key, — уже свободный, — или \c nullptr.
+         */
+        template <typename Key>
+        Node* splitNodes(Node* t, std::size_t tbh, const Key& key,
+                         Node*& l, std::size_t& lbh, Node*& r, std::size_t& rbh);
+
+        /** \brief Разрушает один свободный узел \c nd и возвращает его ячейку в пул. */
+        void releaseNode(Node* nd)
+        {
+            nd->~Node();
+            pool().release(nd);
+        }
+
+        typedef NodePool<Node, Allocator> TPool;
+
+        /** \brief Возвращает пул, распоряжающийся узлами дерева сейчас (он меняется при объединении пулов). */
+        TPool& pool() { return TPool::owner(_pool); }
+
+#ifdef RBTREE_WITH_DELETION
+        /** \brief Удаляет из дерева узел \c node с последующей перебалансировкой.
+         *
+         *  Ключи узлов никогда не копируются и не перемещаются: если у \c node двое детей, он
+         *  структурно меняется местами со своим предшественником, поэтому все остальные узлы
+         *  (и указатели на них, полученные от \c find()) остаются в силе.
+         */
+        void removeNode(Node* node);
+
+        /** \brief Исключает узел \c node из дерева, как \c removeNode(), но не разрушает его, а
+         *  оставляет свободным (без родителя и детей) для повторного использования.
+         *
+         *  С \c defer починка откладывается, как в режиме ослабленной балансировки (см.
+         *  \c setRelaxed()); без него дерево должно быть правильным и остается правильным.
+         */
+        void unlinkNode(Node* node, bool defer = false);
+
+        /** \brief Меняет местами в дереве узел \c nd и его предшественника \c pred (самый
+         *  правый узел левого поддерева \c nd), перевешивая связи и обмениваясь цветами.
+         *  Правого ребенка у \c nd может и не быть.
+         */
+        void swapWithPredecessor(Node* nd, Node* pred);
+#endif
+
+        /** \brief Удаляет нод со всеми его потомками, возвращая их ячейки в пул.
+         *
+         *  Обход итеративный (по родительским связям), поэтому глубина поддерева не ограничена стеком.
+         */
         void deleteNode(Node* nd);
 
         /** \brief Вращает поддерево относительно узла \c nd влево.
@@ -418,6 +1933,11 @@ namespace xi {
     protected:
         Compar _compar;                             ///< Компаратор сравнения двух элементов.
 
+        /** \brief Пул, из которого берутся все узлы дерева. Переживает все узлы, поэтому объявлен
+         *  до корня; после \c join() и \c split() деревья делят его (см. \c NodePool::unite()).
+         */
+        std::shared_ptr<TPool> _pool;
+
     protected:
         // Структура дерева
 
@@ -431,19 +1951,36 @@ namespace xi {
          *  узла всегда будет иметь порядок -INF, что, в свою очередь, накладывает дополнительные
          *  ограничения на предикат сравнение элементов, поэтому в настоящей реализации не используется.
          */
-        Node* _root;
+        typename Node::Link _root;
+
+        Node* _leftmost;                            ///< Наименьший узел (\c nullptr для пустого дерева).
+        Node* _rightmost;                           ///< Наибольший узел (\c nullptr для пустого дерева).
+
+        bool _relaxed;                              ///< Включена ли ослабленная балансировка.
+
+        /** \brief Очередь отложенных нарушений: узлы с лишним черным и красные узлы, которые могут
+         *  оказаться под красным папой, а также удаленные из дерева узлы, ждущие разрушения.
+         *  Разобранное начало [0, \c _pendingHead) сдвигается, когда занимает половину.
+         */
+        std::vector<Node*> _pending;
+        std::size_t _pendingHead;                   ///< Первая неразобранная запись \c _pending.
 
 
 
     protected:
         // Секция отладочных компонент
-        IRBTreeDumper<Element, Compar>* _dumper;
+        IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>* _dumper;
 
 
         // Специальный подход, позволяющий следующему классу иметь доступ к закрытым членам для их тестирования.
-        template<typename, typename>
+        template<typename, typename, typename>
         friend class RBTreeTest;
 
+        // Обертка для чтения без блокировок обходит узлы сама, с ограничением числа шагов, а
+        // исключенные узлы разрушает сама, когда их уже не видит ни один читатель.
+        template <typename, typename, typename, typename>
+        friend class ConcurrentRBTree;
+
     }; // class RBTree
 
 
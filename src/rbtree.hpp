@@ -12,33 +12,128 @@
 ///
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>        // std::stable_sort, std::inplace_merge, std::unique
+#include <exception>        // std::exception_ptr
+#include <future>           // std::async
+#include <iterator>         // std::distance, std::make_move_iterator
+#include <limits>           // std::numeric_limits
+#include <new>              // placement new
 #include <stdexcept>        // std::invalid_argument
+#include <system_error>     // std::system_error
 
 
 namespace xi {
 
 
 //==============================================================================
-// class RBTree::node
+// class NodePool
 //==============================================================================
 
-    template <typename Element, typename Compar >
-    RBTree<Element, Compar>::Node::~Node()
+    template <typename T, typename Allocator>
+    NodePool<T, Allocator>::NodePool(const Allocator& alloc)
+        : _alloc(alloc)
+        , _free(nullptr)
+        , _freeTail(nullptr)
+        , _cur(nullptr)
+        , _end(nullptr)
+        , _nextSlabSize(MIN_SLAB_SIZE)
+    {
+    }
+
+    template <typename T, typename Allocator>
+    NodePool<T, Allocator>::~NodePool()
+    {
+        clear();
+    }
+
+
+    template <typename T, typename Allocator>
+    void NodePool<T, Allocator>::clear()
+    {
+        for (std::size_t i = 0; i < _slabs.size(); ++i)
+            CellAllocTraits::deallocate(_alloc, _slabs[i].first, _slabs[i].second);
+
+        _slabs.clear();
+        _free = _cur = _end = nullptr;
+        _nextSlabSize = MIN_SLAB_SIZE;
+    }
+
+
+    template <typename T, typename Allocator>
+    void NodePool<T, Allocator>::absorb(NodePool& other)
+    {
+        // единственное, что может бросить, — рост реестра, и он делается до всех изменений
+        _slabs.reserve(_slabs.size() + other._slabs.size());
+        _slabs.insert(_slabs.end(), other._slabs.begin(), other._slabs.end());
+        other._slabs.clear();
+
+        // текущим остается слэб с большим запасом, а невыданный хвост другого (не длиннее
+        // MAX_SLAB_SIZE ячеек) раскладывается в список свободных
+        if (_end - _cur < other._end - other._cur)
+        {
+            std::swap(_cur, other._cur);
+            std::swap(_end, other._end);
+        }
+        for (Cell* cell = other._cur; cell != other._end; ++cell)
+            release(cell);
+
+        // список свободных другого пула пристегивается целиком благодаря хвосту
+        if (other._free)
+        {
+            setNext(other._freeTail, _free);
+            if (!_free)
+                _freeTail = other._freeTail;
+            _free = other._free;
+        }
+
+        if (_nextSlabSize < other._nextSlabSize)
+            _nextSlabSize = other._nextSlabSize;
+
+        other._free = other._cur = other._end = nullptr;
+        other._nextSlabSize = MIN_SLAB_SIZE;
+    }
+
+
+    template <typename T, typename Allocator>
+    void NodePool<T, Allocator>::unite(std::shared_ptr<NodePool>& a, std::shared_ptr<NodePool>& b)
     {
-//    // TODO: убрать!
-//    setLeft(_left);
+        owner(a);
+        owner(b);
+        if (a == b)
+            return;
+
+        a->absorb(*b);
+
+        // поглощенный пул держит наследника живым, пока на него ссылается кто-то еще
+        b->_heir = a;
+        b = a;
+    }
+
+
+    template <typename T, typename Allocator>
+    void NodePool<T, Allocator>::grow()
+    {
+        // место в реестре резервируем заранее, чтобы не потерять слэб, если вектор не сможет вырасти
+        _slabs.reserve(_slabs.size() + 1);
+
+        Cell* slab = CellAllocTraits::allocate(_alloc, _nextSlabSize);
+        _slabs.push_back(std::make_pair(slab, _nextSlabSize));
 
+        _cur = slab;
+        _end = slab + _nextSlabSize;
 
-        if (_left)
-            delete _left;
-        if (_right)
-            delete _right;
+        if (_nextSlabSize < MAX_SLAB_SIZE)
+            _nextSlabSize *= 2;
     }
 
 
+//==============================================================================
+// class RBTree::node
+//==============================================================================
+
 
-    template <typename Element, typename Compar>
-    typename RBTree<Element, Compar>::Node* RBTree<Element, Compar>::Node::setLeft(Node* lf)
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node* RBTree<Element, Compar, Allocator, Augment, Layout>::Node::setLeft(Node* lf)
     {
         // предупреждаем повторное присвоение
         if (_left == lf)
@@ -48,17 +143,17 @@ namespace xi {
         if (lf)
         {
             // если у него был родитель
-            if (lf->_parent)
+            if (lf->parent())
             {
                 // ищем у родителя, кем был этот элемент, и вместо него ставим бублик
-                if (lf->_parent->_left == lf)
-                    lf->_parent->_left = nullptr;
+                if (lf->parent()->_left == lf)
+                    lf->parent()->_left = nullptr;
                 else                                    // доп. не проверяем, что он был правым, иначе нарушение целостности
-                    lf->_parent->_right = nullptr;
+                    lf->parent()->_right = nullptr;
             }
 
             // задаем нового родителя
-            lf->_parent = this;
+            lf->setParent(this);
         }
 
         // если у текущего уже был один левый — отменяем его родительскую связь и вернем его
@@ -66,14 +161,14 @@ namespace xi {
         _left = lf;
 
         if (prevLeft)
-            prevLeft->_parent = nullptr;
+            prevLeft->setParent(nullptr);
 
         return prevLeft;
     }
 
 
-    template <typename Element, typename Compar>
-    typename RBTree<Element, Compar>::Node* RBTree<Element, Compar>::Node::setRight(Node* rg)
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node* RBTree<Element, Compar, Allocator, Augment, Layout>::Node::setRight(Node* rg)
     {
         // предупреждаем повторное присвоение
         if (_right == rg)
@@ -83,17 +178,17 @@ namespace xi {
         if (rg)
         {
             // если у него был родитель
-            if (rg->_parent)
+            if (rg->parent())
             {
                 // ищем у родителя, кем был этот элемент, и вместо него ставим бублик
-                if (rg->_parent->_left == rg)
-                    rg->_parent->_left = nullptr;
+                if (rg->parent()->_left == rg)
+                    rg->parent()->_left = nullptr;
                 else                                    // доп. не проверяем, что он был правым, иначе нарушение целостности
-                    rg->_parent->_right = nullptr;
+                    rg->parent()->_right = nullptr;
             }
 
             // задаем нового родителя
-            rg->_parent = this;
+            rg->setParent(this);
         }
 
         // если у текущего уже был один левый — отменяем его родительскую связь и вернем его
@@ -101,260 +196,2019 @@ namespace xi {
         _right = rg;
 
         if (prevRight)
-            prevRight->_parent = nullptr;
+            prevRight->setParent(nullptr);
+
+        return prevRight;
+    }
+
+
+//==============================================================================
+// class RBTree
+//==============================================================================
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::RBTree()
+        : _pool(std::allocate_shared<TPool>(Allocator(), Allocator()))
+    {
+        _root = _leftmost = _rightmost = nullptr;
+        _relaxed = false;
+        _pendingHead = 0;
+        _dumper = nullptr;
+    }
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::RBTree(const Allocator& alloc)
+        : _pool(std::allocate_shared<TPool>(alloc, alloc))
+    {
+        _root = _leftmost = _rightmost = nullptr;
+        _relaxed = false;
+        _pendingHead = 0;
+        _dumper = nullptr;
+    }
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::RBTree(const Compar& compar, const Allocator& alloc)
+        : _compar(compar)
+        , _pool(std::allocate_shared<TPool>(alloc, alloc))
+    {
+        _root = _leftmost = _rightmost = nullptr;
+        _relaxed = false;
+        _pendingHead = 0;
+        _dumper = nullptr;
+    }
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename ForwardIt>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::RBTree(ForwardIt first, ForwardIt last,
+                                                        const Compar& compar, const Allocator& alloc)
+        : _compar(compar)
+        , _pool(std::allocate_shared<TPool>(alloc, alloc))
+    {
+        _root = _leftmost = _rightmost = nullptr;
+        _relaxed = false;
+        _pendingHead = 0;
+        _dumper = nullptr;
+
+        buildFromSorted(first, last);
+    }
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::~RBTree()
+    {
+        // узлы, которым есть что разрушать (ключ или агрегат), разрушаем обходом, а память пул отдаст
+        // разом, когда у него не останется владельцев; в пул, разделяемый с другими деревьями,
+        // ячейки возвращаются поштучно, чтобы соседи могли их переиспользовать
+        pool();
+        if (!std::is_trivially_destructible<Element>::value
+            || !std::is_trivially_destructible<NodeAugment<Augment> >::value
+            || _pool.use_count() > 1)
+        {
+            dropPending();
+            deleteNode(_root);
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::createNode(const Element& key, Node* left, Node* right, Node* parent, Color col)
+    {
+        void* cell = pool().acquire();
+        try
+        {
+            return new (cell) Node(key, left, right, parent, col);
+        }
+        catch (...)
+        {
+            _pool->release(cell);
+            throw;
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename... Args>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::emplaceNode(Args&&... args)
+    {
+        void* cell = pool().acquire();
+        try
+        {
+            return new (cell) Node(typename Node::InPlace(), std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            _pool->release(cell);
+            throw;
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::deleteNode(Node* nd)
+    {
+        // если переданный узел не существует, просто ничего не делаем, т.к. в вызывающем проверок нет
+        if (nd == nullptr)
+            return;
+
+        // отрезаем поддерево от родителя (если тот еще ссылается на него), чтобы обход не ушел выше
+        if (nd->parent())
+        {
+            if (nd->parent()->_left == nd)
+                nd->parent()->_left = nullptr;
+            else if (nd->parent()->_right == nd)
+                nd->parent()->_right = nullptr;
+            nd->setParent(nullptr);
+        }
+
+        // обратный обход без стека: спускаемся до листа, разрушаем его и поднимаемся к родителю
+        Node* cur = nd;
+        while (cur)
+        {
+            if (cur->_left)
+                cur = cur->_left;
+            else if (cur->_right)
+                cur = cur->_right;
+            else
+            {
+                Node* parent = cur->parent();
+                if (parent)
+                {
+                    if (parent->_left == cur)
+                        parent->_left = nullptr;
+                    else
+                        parent->_right = nullptr;
+                }
+
+                releaseNode(cur);
+                cur = parent;
+            }
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::insert(const Element& key)
+    {
+        if (!tryInsert(key).second)
+            throw std::logic_error("Tree already has such key!");
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    std::pair<const typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*, bool>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::tryInsert(const Element& key)
+    {
+        return completeInsert(insertBstEl(key));
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::insert(Element&& key)
+    {
+        if (!tryInsert(std::move(key)).second)
+            throw std::logic_error("Tree already has such key!");
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    std::pair<const typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*, bool>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::tryInsert(Element&& key)
+    {
+        return completeInsert(insertBstEl(std::move(key)));
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename... Args>
+    std::pair<const typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*, bool>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::emplace(Args&&... args)
+    {
+        Node* node = emplaceNode(std::forward<Args>(args)...);
+
+        // узел построен до спуска, поэтому исключение компаратора не должно его потерять
+        try
+        {
+            Node* parent;
+            bool isLeft;
+            if (Node* dup = findInsertPos(node->_key, parent, isLeft))
+            {
+                releaseNode(node);
+                return std::make_pair(dup, false);
+            }
+
+            attachNode(node, parent, isLeft);
+        }
+        catch (...)
+        {
+            releaseNode(node);
+            throw;
+        }
+
+        return completeInsert(std::make_pair(node, true));
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename ForwardIt>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::buildFromSorted(ForwardIt first, ForwardIt last)
+    {
+        clear();
+
+        std::size_t count = std::distance(first, last);
+        if (count == 0)
+            return;
+
+        // глубина нижнего уровня — floor(log2(count)); корень не красим никогда
+        std::size_t redDepth = 0;
+        for (std::size_t n = count; n > 1; n /= 2)
+            ++redDepth;
+
+        Node* prev = nullptr;
+        _root = buildSubtree(first, count, 0, redDepth, prev);
+
+        _leftmost = _root;
+        while (_leftmost->_left)
+            _leftmost = _leftmost->_left;
+        _rightmost = prev;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename ForwardIt>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::buildSubtree(ForwardIt& it, std::size_t count, std::size_t depth,
+                                                              std::size_t redDepth, Node*& prev)
+    {
+        if (count == 0)
+            return nullptr;
+
+        // элементы идут по порядку: сначала все левое поддерево, затем сам узел, затем правое
+        std::size_t leftCount = count / 2;
+        Node* left = buildSubtree(it, leftCount, depth + 1, redDepth, prev);
+
+        Node* nd;
+        try
+        {
+            if (prev && !keyLess(prev->_key, *it))
+                throw std::invalid_argument("Input range is not strictly increasing");
+
+            nd = emplaceNode(*it);
+        }
+        catch (...)
+        {
+            deleteNode(left);
+            throw;
+        }
+        ++it;
+        prev = nd;
+
+        nd->_left = left;
+        if (left)
+            left->setParent(nd);
+
+        Node* right;
+        try
+        {
+            right = buildSubtree(it, count - 1 - leftCount, depth + 1, redDepth, prev);
+        }
+        catch (...)
+        {
+            deleteNode(nd);
+            throw;
+        }
+
+        nd->_right = right;
+        if (right)
+            right->setParent(nd);
+
+        nd->setColor(depth == redDepth && depth > 0 ? RED : BLACK);
+        pullAug(nd);
+
+        return nd;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename ForwardIt>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::buildFromUnsorted(ForwardIt first, ForwardIt last,
+                                                                        unsigned threads)
+    {
+        clear();
+
+        std::vector<Element> keys(first, last);
+        std::size_t n = keys.size();
+        if (n == 0)
+            return;
+
+        // по куску на поток, но не мельче PARALLEL_MIN_CHUNK элементов
+        std::size_t chunks = std::min<std::size_t>(std::max(threads, 1u),
+                                                   std::max<std::size_t>(n / PARALLEL_MIN_CHUNK, 1));
+        std::vector<std::size_t> bounds(chunks + 1);
+        for (std::size_t c = 0; c <= chunks; ++c)
+            bounds[c] = n / chunks * c + std::min(c, n % chunks);
+
+        typename std::vector<Element>::iterator base = keys.begin();
+        auto less = [this](const Element& a, const Element& b) { return keyLess(a, b); };
+
+        // куски сортируются независимо и сливаются попарно раундами; обе операции устойчивы,
+        // поэтому эквивалентные элементы остаются в порядке входа
+        parallelFor(chunks, [&](std::size_t c) {
+            std::stable_sort(base + bounds[c], base + bounds[c + 1], less);
+        });
+        for (std::size_t width = 1; width < chunks; width *= 2)
+        {
+            parallelFor((chunks + 2 * width - 1) / (2 * width), [&](std::size_t pair) {
+                std::size_t lo = 2 * width * pair;
+                std::size_t mid = std::min(lo + width, chunks);
+                std::size_t hi = std::min(lo + 2 * width, chunks);
+                if (mid < hi)
+                    std::inplace_merge(base + bounds[lo], base + bounds[mid], base + bounds[hi], less);
+            });
+        }
+
+        // повторы удаляются внутри кусков; кусок, начинающийся с повтора конца предыдущего,
+        // пропускает свой первый элемент
+        std::vector<std::size_t> kept(chunks);
+        parallelFor(chunks, [&](std::size_t c) {
+            kept[c] = std::unique(base + bounds[c], base + bounds[c + 1],
+                                  [this](const Element& a, const Element& b) { return !keyLess(a, b); })
+                      - (base + bounds[c]);
+        });
+
+        std::vector<std::size_t> skip(chunks, 0);
+        std::vector<std::size_t> offsets(chunks + 1, 0);
+        const Element* prevLast = nullptr;
+        for (std::size_t c = 0; c < chunks; ++c)
+        {
+            if (kept[c] > 0)
+            {
+                if (prevLast && !keyLess(*prevLast, base[bounds[c]]))
+                    skip[c] = 1;
+                prevLast = &base[bounds[c] + kept[c] - 1];
+            }
+            offsets[c + 1] = offsets[c] + kept[c] - skip[c];
+        }
+
+        // элемент с номером u среди оставшихся: кусок ищется по префиксным суммам
+        auto at = [&](std::size_t u) -> Element& {
+            std::size_t c = std::upper_bound(offsets.begin(), offsets.end(), u) - offsets.begin() - 1;
+            return base[bounds[c] + skip[c] + (u - offsets[c])];
+        };
+
+        std::size_t count = offsets[chunks];
+
+        // глубина нижнего уровня — floor(log2(count)); корень не красим никогда
+        std::size_t redDepth = 0;
+        for (std::size_t m = count; m > 1; m /= 2)
+            ++redDepth;
+
+        // ветвлений столько, чтобы поддеревьев под верхними уровнями было не меньше кусков
+        unsigned forks = 0;
+        while ((std::size_t(1) << forks) < chunks)
+            ++forks;
+
+        _root = buildRange(at, 0, count, 0, redDepth, forks);
+
+        _leftmost = _rightmost = _root;
+        while (_leftmost->_left)
+            _leftmost = _leftmost->_left;
+        while (_rightmost->_right)
+            _rightmost = _rightmost->_right;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Fn>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::parallelFor(std::size_t count, Fn fn)
+    {
+        std::vector<std::future<void> > tasks;
+        tasks.reserve(count);
+
+        std::exception_ptr error;
+        for (std::size_t i = 1; i < count; ++i)
+        {
+            try
+            {
+                tasks.push_back(std::async(std::launch::async, fn, i));
+            }
+            catch (const std::system_error&)
+            {
+                // поток не создался — задача выполняется здесь же
+                try
+                {
+                    fn(i);
+                }
+                catch (...)
+                {
+                    if (!error)
+                        error = std::current_exception();
+                }
+            }
+        }
+
+        try
+        {
+            fn(0);
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+
+        for (std::size_t i = 0; i < tasks.size(); ++i)
+        {
+            try
+            {
+                tasks[i].get();
+            }
+            catch (...)
+            {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename At>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::buildRange(At& at, std::size_t lo, std::size_t hi,
+                                                            std::size_t depth, std::size_t redDepth,
+                                                            unsigned forks)
+    {
+        if (lo == hi)
+            return nullptr;
+
+        // разбиение то же, что в buildSubtree(): слева на узел не больше, чем справа
+        std::size_t mid = lo + (hi - lo) / 2;
+        Node* left = nullptr;
+        Node* right = nullptr;
+        if (forks)
+        {
+            // левая половина строится в другом потоке в пуле своего рабочего дерева
+            RBTree side(_compar, getAllocator());
+            try
+            {
+                parallelFor(2, [&](std::size_t i) {
+                    if (i == 0)
+                        right = buildRange(at, mid + 1, hi, depth + 1, redDepth, forks - 1);
+                    else
+                        left = side.buildRange(at, lo, mid, depth + 1, redDepth, forks - 1);
+                });
+                sharePool(side);
+            }
+            catch (...)
+            {
+                side.deleteNode(left);
+                deleteNode(right);
+                throw;
+            }
+        }
+        else
+        {
+            left = buildRange(at, lo, mid, depth + 1, redDepth, 0);
+            try
+            {
+                right = buildRange(at, mid + 1, hi, depth + 1, redDepth, 0);
+            }
+            catch (...)
+            {
+                deleteNode(left);
+                throw;
+            }
+        }
+
+        Node* nd;
+        try
+        {
+            nd = emplaceNode(std::move(at(mid)));
+        }
+        catch (...)
+        {
+            deleteNode(left);
+            deleteNode(right);
+            throw;
+        }
+
+        nd->_left = left;
+        if (left)
+            left->setParent(nd);
+        nd->_right = right;
+        if (right)
+            right->setParent(nd);
+
+        nd->setColor(depth == redDepth && depth > 0 ? RED : BLACK);
+        pullAug(nd);
+
+        return nd;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename ForwardIt>
+    std::vector<bool> RBTree<Element, Compar, Allocator, Augment, Layout>::insertBatch(ForwardIt first, ForwardIt last)
+    {
+        std::vector<Element> batch(first, last);
+        std::vector<bool> inserted(batch.size(), false);
+
+        // упорядочиваем номера, а не элементы: так элементы копируются только один раз, а статус
+        // возвращается в исходном порядке
+        std::vector<std::size_t> order(batch.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+
+        // уже строго возрастающий пакет не сортируем и не чистим от повторов
+        std::size_t sortedPrefix = 1;
+        while (sortedPrefix < batch.size() && keyLess(batch[sortedPrefix - 1], batch[sortedPrefix]))
+            ++sortedPrefix;
+
+        if (sortedPrefix < batch.size())
+        {
+            // устойчивость оставляет первое из равных вхождений
+            std::stable_sort(order.begin(), order.end(),
+                             [this, &batch](std::size_t a, std::size_t b) { return keyLess(batch[a], batch[b]); });
+
+            std::size_t num = 1;
+            for (std::size_t i = 1; i < order.size(); ++i)
+                if (keyLess(batch[order[num - 1]], batch[order[i]]))
+                    order[num++] = order[i];
+            order.resize(num);
+        }
+
+        // если дерево не больше пакета более чем вдвое, дешевле слить их и перестроить дерево
+        // целиком: O(n + m) сравнений и ни одной перебалансировки; обход ограничен размером пакета
+        std::vector<Node*> nodes;
+        if (collectInOrder(nodes, REBUILD_RATIO * order.size()))
+        {
+            mergeRebuild(nodes, batch, order, inserted);
+            return inserted;
+        }
+
+        // иначе вставляем по возрастанию "с пальцем"
+        Node* finger = nullptr;
+        for (std::size_t i = 0; i < order.size(); ++i)
+        {
+            Element& key = batch[order[i]];
+
+            // ключи пакета возрастают, так что ключ больше пальца; если палец — самый правый узел,
+            // элемент встает справа от него без единого сравнения (типичное дописывание в конец)
+            Node* parent = finger;
+            bool isLeft = false;
+            if (finger != _rightmost)
+            {
+                if (Node* dup = findInsertPos(key, fingerRoot(finger, key), parent, isLeft))
+                {
+                    finger = dup;
+                    continue;
+                }
+            }
+
+            Node* node = emplaceNode(std::move(key));
+            attachNode(node, parent, isLeft);
+            completeInsert(std::make_pair(node, true));
+
+            // повороты при перебалансировке не меняют порядок, так что узел остается хорошим пальцем
+            finger = node;
+            inserted[order[i]] = true;
+        }
+
+        return inserted;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    bool RBTree<Element, Compar, Allocator, Augment, Layout>::collectInOrder(std::vector<Node*>& nodes,
+                                                                     std::size_t limit) const
+    {
+        for (const Node* nd = _leftmost; nd; nd = nd->getNext())
+        {
+            if (nodes.size() == limit)
+            {
+                nodes.clear();
+                return false;
+            }
+            nodes.push_back(const_cast<Node*>(nd));
+        }
+
+        return true;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::mergeRebuild(const std::vector<Node*>& nodes,
+                                                                   std::vector<Element>& batch,
+                                                                   const std::vector<std::size_t>& order,
+                                                                   std::vector<bool>& inserted)
+    {
+        std::vector<Node*> merged;
+        merged.reserve(nodes.size() + order.size());
+
+        // до перевязки дерево не тронуто, так что при исключении достаточно вернуть в пул новые узлы
+        std::vector<Node*> created;
+        std::size_t cur = 0;
+        try
+        {
+            for (std::size_t i = 0; i < order.size(); ++i)
+            {
+                Element& key = batch[order[i]];
+                while (cur < nodes.size() && keyLess(nodes[cur]->_key, key))
+                    merged.push_back(nodes[cur++]);
+
+                if (cur < nodes.size() && !keyLess(key, nodes[cur]->_key))
+                    continue;
+
+                Node* nd = emplaceNode(std::move(key));
+                created.push_back(nd);
+                merged.push_back(nd);
+                inserted[order[i]] = true;
+            }
+        }
+        catch (...)
+        {
+            for (std::size_t i = 0; i < created.size(); ++i)
+                releaseNode(created[i]);
+            throw;
+        }
+
+        while (cur < nodes.size())
+            merged.push_back(nodes[cur++]);
+
+        if (merged.empty())
+            return;
+
+        std::size_t redDepth = 0;
+        for (std::size_t n = merged.size(); n > 1; n /= 2)
+            ++redDepth;
+
+        _root = linkSubtree(merged, 0, merged.size(), 0, redDepth);
+        _root->setParent(nullptr);
+        _leftmost = merged.front();
+        _rightmost = merged.back();
+
+        // дерево построено заново, отложенных нарушений в нем нет
+        dropPending();
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::linkSubtree(const std::vector<Node*>& nodes,
+                                                             std::size_t lo, std::size_t hi,
+                                                             std::size_t depth, std::size_t redDepth)
+    {
+        if (lo == hi)
+            return nullptr;
+
+        // разбиение то же, что в buildSubtree(): слева на узел не больше, чем справа
+        std::size_t mid = lo + (hi - lo) / 2;
+        Node* nd = nodes[mid];
+
+        nd->_left = linkSubtree(nodes, lo, mid, depth + 1, redDepth);
+        if (nd->_left)
+            nd->_left->setParent(nd);
+
+        nd->_right = linkSubtree(nodes, mid + 1, hi, depth + 1, redDepth);
+        if (nd->_right)
+            nd->_right->setParent(nd);
+
+        nd->setColor(depth == redDepth && depth > 0 ? RED : BLACK);
+        pullAug(nd);
+
+        return nd;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::fingerRoot(Node* finger, const Element& key) const
+    {
+        if (!finger)
+            return _root;
+
+        // предки, к которым поднимаемся справа, меньше finger, а значит, и key; предок, к которому
+        // поднялись слева и который больше key, ограничивает поддерево места вставки сверху
+        Node* cur = finger;
+        while (Node* par = cur->parent())
+        {
+            if (par->_left == cur && keyLess(key, par->_key))
+                return cur;
+            cur = par;
+        }
+
+        return _root;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    std::pair<const typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*, bool>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::completeInsert(std::pair<Node*, bool> res)
+    {
+        if (!res.second)
+            return res;
+
+        Node* newNode = res.first;
+
+        // отладочное событие
+        if (_dumper)
+            _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_BST_INS, this, newNode);
+
+        if (!_relaxed)
+            rebalance(newNode);
+        else if (newNode != _root)
+        {
+            // корень остается черным и здесь; нарушение, если оно есть, ждет rebalancePending()
+            newNode->setRed();
+            if (newNode->parent()->isRed())
+            {
+                try
+                {
+                    reservePending(1);
+                }
+                catch (...)
+                {
+                    // незаписанное нарушение никто не починит, а красный лист убирается без поворотов
+                    unlinkNode(newNode);
+                    releaseNode(newNode);
+                    throw;
+                }
+                notePending(newNode);
+            }
+        }
+
+        // отладочное событие
+        if (_dumper)
+            _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_INSERT, this, newNode);
+
+        return res;
+    }
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    std::pair<const typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*, bool>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::tryInsertTopDown(const Element& key)
+    {
+        if (_relaxed)
+            return tryInsert(key);
+
+        // как в findNode(): одно сравнение на уровень, а равенство проверяется в конце с самым
+        // нижним узлом, где спуск свернул влево; поворот над текущим узлом затрагивает только
+        // пройденных папу и дедушку, и поиск просто продолжается от текущего узла
+        Node* parent = nullptr;
+        Node* cur = _root;
+        Node* candidate = nullptr;
+        bool isLeft = false;
+        while (cur)
+        {
+            if (isRedNode(cur->_left) && isRedNode(cur->_right))
+            {
+                cur->_left->setBlack();
+                cur->_right->setBlack();
+
+                // у корня перекраска просто увеличивает черную высоту
+                if (cur != _root)
+                {
+                    cur->setRed();
+                    if (parent->isRed())
+                        rebalanceDUG(cur);
+                }
+            }
+
+            isLeft = !keyLess(cur->_key, key);
+            if (isLeft)
+                candidate = cur;
+
+            parent = cur;
+            cur = isLeft ? cur->_left : cur->_right;
+        }
+
+        if (candidate && !keyLess(key, candidate->_key))
+            return std::make_pair(candidate, false);
+
+        Node* nd = createNode(key, nullptr, nullptr, nullptr, RED);
+        attachNode(nd, parent, isLeft);
+        if (parent && parent->isRed())
+            rebalanceDUG(nd);
+
+        // отладочное событие
+        if (_dumper)
+            _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_INSERT, this, nd);
+
+        return std::make_pair(nd, true);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::join(const Element& pivot, RBTree& right)
+    {
+        if (&right == this)
+            throw std::invalid_argument("Can't join a tree with itself");
+
+        if ((_rightmost && !keyLess(_rightmost->_key, pivot))
+            || (right._leftmost && !keyLess(pivot, right._leftmost->_key)))
+            throw std::invalid_argument("Pivot doesn't separate the joined trees");
+
+        rebalancePending();
+        right.rebalancePending();
+        sharePool(right);
+        joinTrees(emplaceNode(pivot), right);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::join(RBTree& right)
+    {
+        if (&right == this)
+            throw std::invalid_argument("Can't join a tree with itself");
+
+        if (right.isEmpty())
+            return;
+
+        if (_rightmost && !keyLess(_rightmost->_key, right._leftmost->_key))
+            throw std::invalid_argument("Joined trees overlap");
+
+        rebalancePending();
+        right.rebalancePending();
+        sharePool(right);
+
+        Node* pivot = right._leftmost;
+        right.unlinkNode(pivot);
+        joinTrees(pivot, right);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::joinTrees(Node* k, RBTree& right)
+    {
+        Node* leftmost = _leftmost ? _leftmost : k;
+        Node* rightmost = right._rightmost ? right._rightmost : k;
+
+        joinNodes(_root, blackHeight(_root), k, right._root, blackHeight(right._root));
+
+        _leftmost = leftmost;
+        _rightmost = rightmost;
+        right._root = right._leftmost = right._rightmost = nullptr;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    std::size_t RBTree<Element, Compar, Allocator, Augment, Layout>::joinNodes(Node* l, std::size_t lbh, Node* k,
+                                                                       Node* r, std::size_t rbh)
+    {
+        k->setParent(nullptr);
+
+        // равные высоты: k — новый черный корень
+        if (lbh == rbh)
+        {
+            k->_left = l;
+            k->_right = r;
+            if (l)
+                l->setParent(k);
+            if (r)
+                r->setParent(k);
+
+            k->setBlack();
+            pullAug(k);
+            _root = k;
+            return lbh + 1;
+        }
+
+        // спускаемся по обращенному к другому дереву краю более высокого до первого черного узла
+        // с черной высотой низкого (или до пустой ссылки, если низкое пусто)
+        bool intoLeft = lbh > rbh;
+        std::size_t target = intoLeft ? rbh : lbh;
+        std::size_t h = intoLeft ? lbh : rbh;
+        Node* cur = intoLeft ? l : r;
+        Node* parent = nullptr;
+        while (cur && (cur->isRed() || h > target))
+        {
+            if (cur->isBlack())
+                --h;
+            parent = cur;
+            cur = intoLeft ? cur->_right : cur->_left;
+        }
+
+        // k встает на место найденного узла, забирая его и низкое дерево в дети; черные высоты
+        // сходятся, и остается только нарушение "красный под красным", как после вставки
+        Node* low = intoLeft ? r : l;
+        k->_left = intoLeft ? cur : low;
+        k->_right = intoLeft ? low : cur;
+        if (cur)
+            cur->setParent(k);
+        if (low)
+            low->setParent(k);
+
+        k->setParent(parent);
+        if (intoLeft)
+            parent->_right = k;
+        else
+            parent->_left = k;
+
+        // путь от k до корня не длиннее удвоенной разности высот
+        _root = intoLeft ? l : r;
+        pullAugPath(k);
+
+        return (intoLeft ? lbh : rbh) + (rebalance(k) ? 1 : 0);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Key>
+    bool RBTree<Element, Compar, Allocator, Augment, Layout>::splitPrv(const Key& key, RBTree& greater)
+    {
+        if (&greater == this)
+            throw std::invalid_argument("Can't split a tree into itself");
+
+        // соединения опираются на черную высоту и цвета правильного дерева
+        rebalancePending();
+        sharePool(greater);
+
+        // промежуточные соединения — не события этого дерева, поэтому дампер на это время молчит
+        IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>* dumper = _dumper;
+        _dumper = nullptr;
+
+        Node* l;
+        Node* r;
+        std::size_t lbh, rbh;
+        Node* found;
+        try
+        {
+            found = splitNodes(_root, blackHeight(_root), key, l, lbh, r, rbh);
+        }
+        catch (...)
+        {
+            _dumper = dumper;
+            throw;
+        }
+        _dumper = dumper;
+
+        if (found)
+            releaseNode(found);
+        greater.clear();
+
+        // наименьший узел остается слева, наибольший — справа, если соответствующая часть не пуста
+        Node* rightmost = _rightmost;
+
+        _root = l;
+        if (!l)
+            _leftmost = nullptr;
+        _rightmost = l;
+        while (_rightmost && _rightmost->_right)
+            _rightmost = _rightmost->_right;
+
+        greater._root = r;
+        greater._rightmost = r ? rightmost : nullptr;
+        greater._leftmost = r;
+        while (greater._leftmost && greater._leftmost->_left)
+            greater._leftmost = greater._leftmost->_left;
+
+        return found != nullptr;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Key>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::splitNodes(Node* t, std::size_t tbh, const Key& key,
+                                                            Node*& l, std::size_t& lbh,
+                                                            Node*& r, std::size_t& rbh)
+    {
+        // шаг спуска: узел, его черная высота и сторона, в которую ушел спуск
+        struct Step {
+            Node* node;
+            std::size_t bh;
+            bool toLeft;
+        };
+
+        // первый проход: все сравнения; поддерево пока не меняется. Путь не длиннее удвоенной
+        // черной высоты, а она не больше разрядности size_t, поэтому хватает массива на стеке
+        Step path[2 * std::numeric_limits<std::size_t>::digits];
+        std::size_t len = 0;
+        Node* found = nullptr;
+        std::size_t bh = tbh;
+        for (Node* cur = t; cur; )
+        {
+            bool toLeft = keyLess(key, cur->_key);
+            if (!toLeft && !keyLess(cur->_key, key))
+            {
+                found = cur;
+                break;
+            }
+
+            Step step = { cur, bh, toLeft };
+            path[len++] = step;
+
+            if (cur->isBlack())
+                --bh;
+            cur = toLeft ? cur->_left : cur->_right;
+        }
+
+        // второй проход без сравнений: отсеченные поддеревья соединяются снизу вверх через узлы пути
+        l = r = nullptr;
+        lbh = rbh = 0;
+        if (found)
+        {
+            std::size_t childBh = bh - (found->isBlack() ? 1 : 0);
+            l = found->_left;
+            r = found->_right;
+            lbh = detachSubtree(l, childBh);
+            rbh = detachSubtree(r, childBh);
+            found->_left = found->_right = nullptr;
+            found->setParent(nullptr);
+        }
+
+        while (len-- > 0)
+        {
+            Node* x = path[len].node;
+            std::size_t childBh = path[len].bh - (x->isBlack() ? 1 : 0);
+            if (path[len].toLeft)
+            {
+                // x и его правое поддерево больше key
+                Node* sub = x->_right;
+                std::size_t subBh = detachSubtree(sub, childBh);
+                rbh = joinNodes(r, rbh, x, sub, subBh);
+                r = _root;
+            }
+            else
+            {
+                Node* sub = x->_left;
+                std::size_t subBh = detachSubtree(sub, childBh);
+                lbh = joinNodes(sub, subBh, x, l, lbh);
+                l = _root;
+            }
+        }
+
+        return found;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::joinNodes2(Node* l, std::size_t lbh, Node* r, std::size_t rbh,
+                                                            std::size_t& bh)
+    {
+        if (!l)
+        {
+            bh = rbh;
+            return r;
+        }
+        if (!r)
+        {
+            bh = lbh;
+            return l;
+        }
+
+        // разделителем становится наибольший узел l, вынутый из него обычным удалением
+        Node* k = l;
+        while (k->_right)
+            k = k->_right;
+
+        _root = l;
+        unlinkNode(k);
+        l = _root;
+        lbh = detachSubtree(l, blackHeight(l));
+
+        bh = joinNodes(l, lbh, k, r, rbh);
+        return _root;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::combine(SetOp op, RBTree& other, unsigned threads)
+    {
+        if (&other == this)
+            throw std::invalid_argument("Can't combine a tree with itself");
+
+        rebalancePending();
+        other.rebalancePending();
+        sharePool(other);
+
+        // каждое ветвление удваивает число задач; берем их вдвое больше потоков для баланса
+        unsigned forks = 0;
+        while (threads > 1 && forks < 16 && (1u << forks) < 2 * threads)
+            ++forks;
+
+        IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>* dumper = _dumper;
+        _dumper = nullptr;
+
+        Node* a = _root;
+        Node* b = other._root;
+        other._root = other._leftmost = other._rightmost = nullptr;
+        _leftmost = _rightmost = nullptr;
+
+        Node* res;
+        std::size_t bh;
+        std::exception_ptr error;
+        try
+        {
+            combineNodes(op, a, blackHeight(a), b, blackHeight(b), res, bh, forks);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        // и прерванная операция оставляет в res правильное дерево, крайние узлы ищутся заново
+        _root = res;
+        _dumper = dumper;
+
+        _leftmost = _rightmost = _root;
+        while (_leftmost && _leftmost->_left)
+            _leftmost = _leftmost->_left;
+        while (_rightmost && _rightmost->_right)
+            _rightmost = _rightmost->_right;
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::combineNodes(SetOp op, Node* a, std::size_t abh,
+                                                                   Node* b, std::size_t bbh,
+                                                                   Node*& res, std::size_t& bh, unsigned forks)
+    {
+        if (!a || !b)
+        {
+            // в объединении остается непустое поддерево, в разности — a, в пересечении — ничего
+            Node* keep = op == SET_UNION ? (a ? a : b) : op == SET_DIFFERENCE ? a : nullptr;
+            if (a != keep)
+                deleteNode(a);
+            if (b != keep)
+                deleteNode(b);
+
+            res = keep;
+            bh = !keep ? 0 : keep == a ? abh : bbh;
+            return;
+        }
+
+        // разделитель — корень b (черный); его ключом режется a. Все сравнения split делает до
+        // изменений, поэтому при исключении a остается целым и становится результатом
+        Node* al;
+        Node* ar;
+        std::size_t albh, arbh;
+        Node* dup;
+        try
+        {
+            dup = splitNodes(a, abh, b->_key, al, albh, ar, arbh);
+        }
+        catch (...)
+        {
+            deleteNode(b);
+            res = a;
+            bh = abh;
+            throw;
+        }
+
+        Node* k = b;
+        Node* bl = k->_left;
+        Node* br = k->_right;
+        std::size_t blbh = detachSubtree(bl, bbh - 1);
+        std::size_t brbh = detachSubtree(br, bbh - 1);
+        k->_left = k->_right = nullptr;
+
+        // подзадача, даже прерванная исключением, оставляет в l или r правильное дерево; вместо
+        // не начатой остается половина a, а половина b разрушается
+        Node* l = al;
+        Node* r = ar;
+        std::size_t lbh = albh, rbh = arbh;
+        bool lStarted = false, rStarted = false;
+        std::exception_ptr error;
+        unsigned subForks = forks ? forks - 1 : 0;
+        try
+        {
+            if (forks && std::max(abh, bbh) >= PARALLEL_GRAIN_BH)
+            {
+                // левая половина уходит в другой поток со своим рабочим деревом, правая считается здесь
+                RBTree side(_compar, getAllocator());
+                struct ScratchGuard {
+                    RBTree& tree;
+                    ~ScratchGuard() { tree._root = nullptr; }  // рабочее дерево не владеет узлами
+                } guard = { side };
+
+                try
+                {
+                    parallelFor(2, [&](std::size_t i) {
+                        if (i == 0)
+                        {
+                            rStarted = true;
+                            combineNodes(op, ar, arbh, br, brbh, r, rbh, subForks);
+                        }
+                        else
+                        {
+                            lStarted = true;
+                            side.combineNodes(op, al, albh, bl, blbh, l, lbh, subForks);
+                        }
+                    });
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+                sharePool(side);                    // освобожденные там ячейки переходят сюда
+            }
+            else
+            {
+                lStarted = true;
+                combineNodes(op, al, albh, bl, blbh, l, lbh, subForks);
+                rStarted = true;
+                combineNodes(op, ar, arbh, br, brbh, r, rbh, subForks);
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        if (!lStarted)
+            deleteNode(bl);
+        if (!rStarted)
+            deleteNode(br);
+
+        // из эквивалентных элементов остается элемент этого дерева
+        Node* pivot = op == SET_UNION ? (dup ? dup : k) : op == SET_INTERSECTION ? dup : nullptr;
+        if (k != pivot)
+            releaseNode(k);
+        if (dup && dup != pivot)
+            releaseNode(dup);
+
+        if (!pivot)
+            res = joinNodes2(l, lbh, r, rbh, bh);
+        else
+        {
+            bh = joinNodes(l, lbh, pivot, r, rbh);
+            res = _root;
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::sharePool(RBTree& other)
+    {
+        if (!(getAllocator() == other.getAllocator()))
+            throw std::invalid_argument("Trees with unequal allocators can't exchange nodes");
+
+        TPool::unite(_pool, other._pool);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    std::size_t RBTree<Element, Compar, Allocator, Augment, Layout>::blackHeight(const Node* nd)
+    {
+        std::size_t h = 0;
+        for (; nd; nd = nd->_left)
+        {
+            if (nd->isBlack())
+                ++h;
+        }
+        return h;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::remove(const Element &key)
+    {
+        Node* node = findNode(key);
+
+        if (node == nullptr)
+            throw std::logic_error("No such node!");
+
+        removeNode(node);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::removeTopDown(const Element& key)
+    {
+        if (_relaxed)
+        {
+            remove(key);
+            return;
+        }
+
+        // спуск: к key, а от узла с key (там он сворачивает влево) — вправо до предшественника;
+        // перед шагом вниз текущий узел q или его ребенок по пути делается красным
+        Node* p = nullptr;
+        Node* q = _root;
+        bool qLeft = false;                     // q — левый ребенок p
+        Node* candidate = nullptr;
+        bool found;
+        try
+        {
+            while (q)
+            {
+                bool left = !keyLess(q->_key, key);
+                if (left)
+                    candidate = q;
+
+                // ребенок по пути ни одним из поворотов ниже не меняется
+                Node* next = left ? q->_left : q->_right;
+                Node* other = left ? q->_right : q->_left;
+
+                if (q->isBlack() && !isRedNode(next))
+                {
+                    if (isRedNode(other))
+                    {
+                        // красный ребенок с другой стороны поднимается над q, а q краснеет
+                        if (left)
+                            rotLeft(q);
+                        else
+                            rotRight(q);
+                        other->setBlack();
+                        q->setRed();
+                    }
+                    else if (p)
+                    {
+                        // папа здесь красный (его красили на прошлом шаге, ведь q черный) или корень
+                        Node* s = qLeft ? p->_right : p->_left;
+                        Node* inner = qLeft ? s->_left : s->_right;
+                        Node* outer = qLeft ? s->_right : s->_left;
+
+                        if (!isRedNode(inner) && !isRedNode(outer))
+                        {
+                            p->setBlack();
+                            s->setRed();
+                            q->setRed();
+                        }
+                        else
+                        {
+                            // красный племянник или брат встает на место папы; q остается ребенком p
+                            Node* top = s;
+                            if (isRedNode(inner))
+                            {
+                                top = inner;
+                                if (qLeft)
+                                    rotRight(s);
+                                else
+                                    rotLeft(s);
+                            }
+                            if (qLeft)
+                                rotLeft(p);
+                            else
+                                rotRight(p);
+
+                            q->setRed();
+                            top->setRed();
+                            top->_left->setBlack();
+                            top->_right->setBlack();
+                        }
+                    }
+                }
+
+                p = q;
+                qLeft = left;
+                q = next;
+            }
+
+            found = candidate && !keyLess(key, candidate->_key);
+        }
+        catch (...)
+        {
+            // после каждого шага дерево правильное, разве что корень покраснел
+            if (_root)
+                _root->setBlack();
+            throw;
+        }
+
+        if (!found)
+        {
+            if (_root)
+                _root->setBlack();
+            throw std::logic_error("No such node!");
+        }
+
+        // последний узел пути — красный лист или единственный корень; узел с ключом встает на
+        // его место, и место освобождается без перебалансировки
+        Node* node = candidate;
+        if (node == _leftmost)
+            _leftmost = const_cast<Node*>(node->getNext());
+        if (node == _rightmost)
+            _rightmost = const_cast<Node*>(node->getPrev());
+
+        if (p != node)
+            swapWithPredecessor(node, p);
+
+        Node* parent = node->parent();
+        if (!parent)
+            _root = nullptr;
+        else
+        {
+            if (parent->_left == node)
+                parent->_left = nullptr;
+            else
+                parent->_right = nullptr;
+
+            node->setParent(nullptr);
+            pullAugPath(parent);
+            _root->setBlack();
+        }
+
+        releaseNode(node);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::removeNode(Node* node)
+    {
+        unlinkNode(node, _relaxed);
+
+        // узел, записанный в очереди, разрушит rebalancePending(), когда дойдет до записи
+        if (!node->isQueued())
+            releaseNode(node);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::unlinkNode(Node* node, bool defer)
+    {
+        // место под записи, которые сделает исключение, — до изменений (красному листу оно не
+        // нужно, и его можно исключить, даже когда места нет)
+        if (defer && (node->_left || node->_right || node->isBlack()))
+            reservePending(2);
+
+        // соседей крайних узлов находим, пока они еще достижимы, а ставим, когда узел исключен
+        Node* leftmost = (node == _leftmost) ? const_cast<Node*>(node->getNext()) : _leftmost;
+        Node* rightmost = (node == _rightmost) ? const_cast<Node*>(node->getPrev()) : _rightmost;
+
+        // узел с двумя детьми уводим на место предшественника, где детей не больше одного
+        if (node->_left && node->_right)
+        {
+            Node* pred = node->predecessor();
+            swapWithPredecessor(node, pred);
+
+            // цвет и лишний черный остались за позициями, а запись в очереди — за узлами
+            if (defer)
+                notePending(pred);
+        }
+
+        Node* child;
+        if (node->_left)
+        {
+            child = node->_left;
+            node->_left = nullptr;
+        }
+        else
+        {
+            child = node->_right;
+            node->_right = nullptr;
+        }
+
+        if (child != nullptr)
+        {
+            if (node == _root)
+            {
+                _root = child;
+                child->setParent(nullptr);
+            }
+            else
+            {
+                if (node->isLeftChild())
+                    node->parent()->_left = child;
+                else
+                    node->parent()->_right = child;
+
+                child->setParent(node->parent());
+            }
+
+            // данные предков должны быть верны до поворотов в deleteFixUp()
+            pullAugPath(child->parent());
+
+            // единственный ребенок красный и в ослабленном дереве (черного под ним столько же,
+            // сколько с пустой стороны, т.е. нет), поэтому забирает черный узла с его лишним
+            if (node->isBlack())
+            {
+                deleteFixUp(child);
+                moveExtraBlack(node, child);
+            }
+            else if (defer)
+                notePending(child);
+        }
+        else if (node == _root)
+            _root = nullptr;
+        else
+        {
+            // в ослабленном дереве черный лист до исключения отдает свой лишний черный и сам черный
+            if (defer && node->isBlack())
+            {
+                if (node->hasExtraBlack())
+                    liftBlack(node);
+                liftBlack(node);
+            }
+
+            // лист остается в дереве на время deleteFixUp(), но уже ничего не вносит в данные предков
+            node->clearAug();
+            pullAugPath(node->parent());
+
+            if (!defer && node->isBlack())
+                deleteFixUp(node);
+
+            if (node->parent() != nullptr)
+            {
+                if (node->parent()->_left == node)
+                    node->parent()->_left = nullptr;
+                else if (node->parent()->_right == node)
+                    node->parent()->_right = nullptr;
+            }
+        }
+
+        node->setParent(nullptr);
+        _leftmost = leftmost;
+        _rightmost = rightmost;
+    }
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::swapWithPredecessor(Node* nd, Node* pred)
+    {
+        Node* ndParent = nd->parent();
+        Node* ndRight = nd->_right;
+        Node* predParent = pred->parent();
+        Node* predLeft = pred->_left;           // правого у предшественника нет
+
+        // предшественник встает на место nd у его родителя
+        if (!ndParent)
+            _root = pred;
+        else if (ndParent->_left == nd)
+            ndParent->_left = pred;
+        else
+            ndParent->_right = pred;
+        pred->setParent(ndParent);
+
+        pred->_right = ndRight;
+        if (ndRight)
+            ndRight->setParent(pred);
+
+        if (nd->_left == pred)
+        {
+            // предшественник — непосредственный левый ребенок: nd становится его левым
+            pred->_left = nd;
+            nd->setParent(pred);
+        }
+        else
+        {
+            pred->_left = nd->_left;
+            pred->_left->setParent(pred);
+
+            // предшественник глубже левого ребенка всегда правый ребенок своего родителя
+            predParent->_right = nd;
+            nd->setParent(predParent);
+        }
+
+        nd->_left = predLeft;
+        if (predLeft)
+            predLeft->setParent(nd);
+        nd->_right = nullptr;
+
+        // цвета и лишние черные остаются за позициями
+        Color col = nd->getColor();
+        nd->setColor(pred->getColor());
+        pred->setColor(col);
+
+        bool extra = nd->hasExtraBlack();
+        nd->setExtraBlack(pred->hasExtraBlack());
+        pred->setExtraBlack(extra);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::deleteFixUp(Node *node)
+    {
+        while (node != _root && node->isBlack()) {
+            if (node == node->parent()->_left) {
+                Node* bro = node->brother();
+                //if brother is red => left rotation between father and brother
+                //making bro black, father - red [tree's hight is saved]
+                if (bro->isRed()) {
+                    bro->setColor(BLACK);
+                    node->parent()->setColor(RED);
+                    rotLeft(node->parent());
+                    bro = node->parent()->_right;
+                }
+                //if bro's children both black
+                //bro becomes red and consider node's parent
+                if ((!bro->_left || bro->_left->isBlack())
+                    && (!bro->_right || bro->_right->isBlack())){
+                    bro->setRed();
+                    node = node->parent();
+                } else {
+                    //if bro's right child red, left - black
+                    //bro's left becomes black, bro - red, and make right rotation
+                    if (!bro->_right || bro->_right->isBlack()) {
+                        bro->_left->setColor(BLACK);
+                        bro->setRed();
+                        rotRight(bro);
+                        bro = node->parent()->_right;
+                    }
+                    //make bro the same color with father
+                    //bro's child and father -> black
+                    bro->setColor(node->parent()->getColor());
+                    node->parent()->setColor(BLACK);
+                    if (bro->_right)
+                        bro->_right->setColor(BLACK);
+                    rotLeft(node->parent());
+                    node = _root;
+                }
+            } else {
+                //symmetric to the upper code
+                Node* bro = node->brother();
+                if (bro->isRed()) {
+                    bro->setBlack();
+                    node->parent()->setColor(RED);
+                    rotRight(node->parent());
+                    bro = node->parent()->_left;
+                }
+                if ((!bro->_left || bro->_left->isBlack())
+                    && (!bro->_right || bro->_right->isBlack())) {
+                    bro->setRed();
+                    node = node->parent();
+                } else {
+                    if (!bro->_left || bro->_left->isBlack()) {
+                        bro->_right->setColor(BLACK);
+                        bro->setColor(RED);
+                        rotLeft(bro);
+                        bro = node->parent()->_left;
+                    }
+                    bro->setColor(node->parent()->getColor());
+                    node->parent()->setColor(BLACK);
+                    if (bro->_left)
+                        bro->_left->setColor(BLACK);
+                    rotRight(node->parent());
+                    node = _root;
+                }
+            }
+        }
+        node->setBlack();
+    }
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    const typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node* RBTree<Element, Compar, Allocator, Augment, Layout>::find(const Element& key) const
+    {
+        return findNode(key);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Key>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::findNode(const Key& key, std::false_type) const
+    {
+        // ищем самый левый узел с ключом не меньше key, а равенство проверяем один раз в конце
+        Node* current = _root;
+        Node* candidate = nullptr;
+        while (current)
+        {
+            if (_compar(current->_key, key))
+                current = current->_right;
+            else
+            {
+                candidate = current;
+                current = current->_left;
+            }
+        }
+
+        if (candidate && !_compar(key, candidate->_key))
+            return candidate;
+
+        return nullptr;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Key>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::findNode(const Key& key, std::true_type) const
+    {
+        // трехзначный компаратор сразу говорит о равенстве
+        Node* current = _root;
+        while (current)
+        {
+            int res = _compar(key, current->_key);
+            if (res == 0)
+                return current;
+
+            current = (res < 0) ? current->_left : current->_right;
+        }
+
+        return nullptr;
+    }
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::insertNewBstEl(const Element& key)
+    {
+        std::pair<Node*, bool> res = insertBstEl(key);
+        if (!res.second)
+            throw std::logic_error("Tree already has such key!");
+
+        return res.first;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Key>
+    std::pair<typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*, bool>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::insertBstEl(Key&& key)
+    {
+        Node* parent;
+        bool isLeft;
+        if (Node* dup = findInsertPos(key, parent, isLeft))
+            return std::make_pair(dup, false);
+
+        // элемент копируется или перемещается в узел ровно один раз
+        Node* node = emplaceNode(std::forward<Key>(key));
+        attachNode(node, parent, isLeft);
+
+        return std::make_pair(node, true);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Key>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::lowerBoundNode(const Key& key) const
+    {
+        Node* current = _root;
+        Node* candidate = nullptr;
+        while (current)
+        {
+            if (keyLess(current->_key, key))
+                current = current->_right;
+            else
+            {
+                candidate = current;
+                current = current->_left;
+            }
+        }
+
+        return candidate;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Key>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::upperBoundNode(const Key& key) const
+    {
+        Node* current = _root;
+        Node* candidate = nullptr;
+        while (current)
+        {
+            if (keyLess(key, current->_key))
+            {
+                candidate = current;
+                current = current->_left;
+            }
+            else
+                current = current->_right;
+        }
 
-        return prevRight;
+        return candidate;
     }
 
 
-//==============================================================================
-// class RBTree
-//==============================================================================
-
-    template <typename Element, typename Compar >
-    RBTree<Element, Compar>::RBTree()
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Key>
+    std::pair<typename RBTree<Element, Compar, Allocator, Augment, Layout>::ConstIterator,
+              typename RBTree<Element, Compar, Allocator, Augment, Layout>::ConstIterator>
+    RBTree<Element, Compar, Allocator, Augment, Layout>::equalRangePrv(const Key& key) const
     {
-        _root = nullptr;
-        _dumper = nullptr;
-    }
+        // дубликатов нет, поэтому верхняя граница — это нижняя или следующий за ней
+        ConstIterator first = makeIterator(lowerBoundNode(key));
+        ConstIterator last = first;
+        if (first != end() && !keyLess(key, *first))
+            ++last;
 
-    template <typename Element, typename Compar >
-    RBTree<Element, Compar>::~RBTree()
-    {
-        // грохаем пока что всех через корень
-        if (_root)
-            delete _root;
+        return std::make_pair(first, last);
     }
 
 
-    template <typename Element, typename Compar >
-    void RBTree<Element, Compar>::deleteNode(Node* nd)
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename KeyLo, typename KeyHi>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Range
+    RBTree<Element, Compar, Allocator, Augment, Layout>::rangePrv(const KeyLo& lo, const KeyHi& hi) const
     {
-        // если переданный узел не существует, просто ничего не делаем, т.к. в вызывающем проверок нет
-        if (nd == nullptr)
-            return;
+        // границы сравниваем только с элементами: прозрачный компаратор не обязан
+        // сравнивать ключи разных типов между собой; при hi <= lo первый элемент не меньше hi
+        ConstIterator first = makeIterator(lowerBoundNode(lo));
+        if (first == end() || !keyLess(*first, hi))
+            return Range(first, first);
 
-        // потомков убьет в деструкторе
-        delete nd;
+        return Range(first, makeIterator(lowerBoundNode(hi)));
     }
 
 
-    template <typename Element, typename Compar >
-    void RBTree<Element, Compar>::insert(const Element& key)
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::selectNode(std::size_t k) const
     {
-        // этот метод можно оставить студентам целиком
-        Node* newNode = insertNewBstEl(key);
+        Node* current = _root;
+        while (current)
+        {
+            std::size_t leftSize = current->_left ? current->_left->getAugment() : 0;
+            if (k < leftSize)
+                current = current->_left;
+            else if (k == leftSize)
+                return current;
+            else
+            {
+                k -= leftSize + 1;
+                current = current->_right;
+            }
+        }
 
-        // отладочное событие
-        if (_dumper)
-            _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_BST_INS, this, newNode);
+        return nullptr;
+    }
 
-        rebalance(newNode);
 
-        // отладочное событие
-        if (_dumper)
-            _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_INSERT, this, newNode);
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename Key>
+    std::size_t RBTree<Element, Compar, Allocator, Augment, Layout>::countLess(const Key& key) const
+    {
+        // спуск как в lowerBoundNode(): уходя вправо, пропускаем левое поддерево и сам узел
+        std::size_t count = 0;
+        Node* current = _root;
+        while (current)
+        {
+            if (keyLess(current->_key, key))
+            {
+                count += 1 + (current->_left ? current->_left->getAugment() : 0);
+                current = current->_right;
+            }
+            else
+                current = current->_left;
+        }
 
+        return count;
     }
 
-    template <typename Element, typename Compar>
-    void RBTree<Element, Compar>::remove(const Element &key)
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename KeyLo, typename KeyHi>
+    std::size_t RBTree<Element, Compar, Allocator, Augment, Layout>::countInRangePrv(const KeyLo& lo, const KeyHi& hi) const
     {
-        Node* node = (Node *) find(key);
+        std::size_t below = countLess(lo);
+        std::size_t belowHi = countLess(hi);
+        return belowHi > below ? belowHi - below : 0;
+    }
 
-        if (node == nullptr)
-            throw std::logic_error("No such node!");
 
-        if (node->_left && node->_right)
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    template <typename KeyLo, typename KeyHi>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::AugmentValue
+    RBTree<Element, Compar, Allocator, Augment, Layout>::aggregatePrv(const KeyLo& lo, const KeyHi& hi) const
+    {
+        // спускаемся до узла, где пути к границам расходятся: он сам лежит в диапазоне
+        Node* split = _root;
+        while (split)
         {
-            Node* pred = node->predecessor();
-            node->_key = pred->_key;
-            node = pred;
+            if (keyLess(split->_key, lo))
+                split = split->_right;
+            else if (!keyLess(split->_key, hi))
+                split = split->_left;
+            else
+                break;
         }
 
-        Node* child;
-        if (node->_left)
-        {
-            child = node->_left;
-            node->_left = nullptr;
-        }
-        else
-        {
-            child = node->_right;
-            node->_right = nullptr;
-        }
+        if (!split)
+            return Augment::identity();
 
-        if (child != nullptr)
+        // левая ветка: узлы не меньше lo входят вместе со всем правым поддеревом;
+        // они идут по убыванию, поэтому присоединяются слева
+        AugmentValue left = Augment::identity();
+        for (Node* nd = split->_left; nd; )
         {
-            if (node == _root)
-                _root = child;
+            if (keyLess(nd->_key, lo))
+                nd = nd->_right;
             else
             {
-                if (node->isLeftChild())
-                    node->_parent->_left = child;
-                else
-                    node->_parent->_right = child;
-
-                child->_parent = node->_parent;
+                AugmentValue part = Augment::fromElement(nd->_key);
+                if (nd->_right)
+                    part = Augment::combine(part, nd->_right->getAugment());
+                left = Augment::combine(part, left);
+                nd = nd->_left;
             }
-
-
-            if (node->isBlack())
-                deleteFixUp(child);
         }
-        else if (node == _root)
-            _root = nullptr;
-        else
-        {
-            if (node->isBlack())
-                deleteFixUp(node);
 
-            if (node->_parent != nullptr)
+        // правая ветка симметрична: узлы меньше hi входят вместе с левым поддеревом
+        AugmentValue right = Augment::identity();
+        for (Node* nd = split->_right; nd; )
+        {
+            if (!keyLess(nd->_key, hi))
+                nd = nd->_left;
+            else
             {
-                if (node->_parent->_left == node)
-                    node->_parent->_left = nullptr;
-                else if (node->_parent->_right == node)
-                    node->_parent->_right = nullptr;
-                node->_parent = nullptr;
+                AugmentValue part = Augment::fromElement(nd->_key);
+                if (nd->_left)
+                    part = Augment::combine(nd->_left->getAugment(), part);
+                right = Augment::combine(right, part);
+                nd = nd->_right;
             }
         }
 
-        deleteNode(node);
+        return Augment::combine(Augment::combine(left, Augment::fromElement(split->_key)), right);
     }
 
-    template <typename Element, typename Compar>
-    void RBTree<Element, Compar>::deleteFixUp(Node *node)
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::findInsertPos(const Element& key, Node* from, Node*& parent,
+                                                               bool& isLeft, std::false_type) const
     {
-        while (node != _root && node->isBlack()) {
-            if (node == node->_parent->_left) {
-                Node* bro = node->brother();
-                //if brother is red => left rotation between father and brother
-                //making bro black, father - red [tree's hight is saved]
-                if (bro->isRed()) {
-                    bro->_color = BLACK;
-                    node->_parent->_color = RED;
-                    rotLeft(node->_parent);
-                    bro = node->_parent->_right;
-                }
-                //if bro's children both black
-                //bro becomes red and consider node's parent
-                if ((!bro->_left || bro->_left->isBlack())
-                    && (!bro->_right || bro->_right->isBlack())){
-                    bro->setRed();
-                    node = node->_parent;
-                } else {
-                    //if bro's right child red, left - black
-                    //bro and left become black and make right rotation
-                    if (bro->_right->isBlack()) {
-                        bro->_left->_color = BLACK;
-                        bro->setBlack();
-                        rotRight(bro);
-                        bro = node->_parent->_right;
-                    }
-                    //make bro the same color with father
-                    //bro's child and father -> black
-                    bro->_color = node->_parent->_color;
-                    node->_parent->_color = BLACK;
-                    if (bro->_right)
-                        bro->_right->_color = BLACK;
-                    rotLeft(node->_parent);
-                    node = _root;
-                }
-            } else {
-                //symmetric to the upper code
-                Node* bro = node->brother();
-                if (bro->isRed()) {
-                    bro->setBlack();
-                    node->_parent->_color = RED;
-                    rotRight(node->_parent);
-                    bro = node->_parent->_left;
-                }
-                if (bro->_left->isBlack() && bro->_right->isBlack()) {
-                    bro->setRed();
-                    node = node->_parent;
-                } else {
-                    if (bro->_left->isBlack()) {
-                        bro->_right->_color = BLACK;
-                        bro->_color = RED;
-                        rotLeft(bro);
-                        bro = node->_parent->_left;
-                    }
-                    bro->_color = node->_parent->_color;
-                    node->_parent->_color = BLACK;
-                    bro->_left->_color = BLACK;
-                    rotRight(node->_parent);
-                    node = _root;
-                }
+        Node* current = from;
+        Node* lastRight = nullptr;          // последний узел, от которого ушли вправо: key >= его ключа
+        parent = nullptr;
+        isLeft = false;
+
+        //choose the parent for a new node
+        while (current)
+        {
+            parent = current;
+            if (_compar(key, current->_key))
+            {
+                isLeft = true;
+                current = current->_left;
+            }
+            else
+            {
+                isLeft = false;
+                lastRight = current;
+                current = current->_right;
             }
         }
-        node->setBlack();
+
+        // key >= lastRight и key меньше всех ключей его правого поддерева, так что равным
+        // может оказаться только он сам
+        if (lastRight && !_compar(lastRight->_key, key))
+            return lastRight;
+
+        return nullptr;
     }
 
-    template <typename Element, typename Compar>
-    const typename RBTree<Element, Compar>::Node* RBTree<Element, Compar>::find(const Element& key)
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::findInsertPos(const Element& key, Node* from, Node*& parent,
+                                                               bool& isLeft, std::true_type) const
     {
-        // TODO: метод реализуют студенты
-        Node* current = _root;
-        //search by a key from a root
+        Node* current = from;
+        parent = nullptr;
+        isLeft = false;
+
         while (current)
         {
-            if (current->_key == key)
+            int res = _compar(key, current->_key);
+            if (res == 0)
                 return current;
 
-            if(key < current->_key)
-                current=current->_left;
-            else
-                current=current->_right;
+            parent = current;
+            isLeft = (res < 0);
+            current = isLeft ? current->_left : current->_right;
         }
 
         return nullptr;
     }
 
-    template <typename Element, typename Compar >
-    typename RBTree<Element, Compar>::Node*
-    RBTree<Element, Compar>::insertNewBstEl(const Element& key)
-    {
-        // TODO: метод реализуют студенты
-        if (find(key) != nullptr)
-            throw std::logic_error("Tree already has such key!");
-
-        Node* node = new Node(key);
-        Node* current = _root;
-        Node* temp = nullptr;
 
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::attachNode(Node* nd, Node* parent, bool isLeft)
+    {
         //there was nothing in a tree
-        if (current == nullptr)
+        if (parent == nullptr)
         {
-            _root = node;
-            node->setBlack();
-            return node;
+            _root = _leftmost = _rightmost = nd;
+            nd->setBlack();
+            pullAug(nd);
+            return;
         }
 
-        //choose the parent for a new node
-        do
+        //check for the node to be on the right or on the left
+        if (isLeft)
         {
-            temp = current;
-            if (node->_key < current->_key)
-                current = current->_left;
-            else
-                current = current->_right;
+            parent->_left = nd;
+            if (parent == _leftmost)
+                _leftmost = nd;
         }
-        while (current);
-
-        //check for the node to be on the right or on the left
-        if (node->_key < temp->_key)
-            temp->_left = node;
         else
-            temp->_right = node;
+        {
+            parent->_right = nd;
+            if (parent == _rightmost)
+                _rightmost = nd;
+        }
 
-        node->_parent = temp;
-        return node;
+        nd->setParent(parent);
+        pullAugPath(nd);
     }
 
 
-    template <typename Element, typename Compar >
-    typename RBTree<Element, Compar>::Node*
-    RBTree<Element, Compar>::rebalanceDUG(Node* nd)
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::rebalanceDUG(Node* nd)
     {
         // TODO: этот метод студенты могут оставить и реализовать при декомпозиции балансировки дерева
         // В методе оставлены некоторые важные комментарии/snippet-ы
@@ -380,12 +2234,12 @@ namespace xi {
 
             // отладочное событие
             if (_dumper)
-                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_RECOLOR1, this, nd);
+                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_RECOLOR1, this, nd);
 
             // теперь чередование цветов "узел-папа-дедушка-дядя" — К-Ч-К-Ч, но надо разобраться, что там
             // с дедушкой и его предками, поэтому продолжим с дедушкой
             //..
-            rebalanceDUG(uncle->getDaddy(f));
+            return uncle->getDaddy(f);
         }
 
             // дядя черный
@@ -395,8 +2249,12 @@ namespace xi {
 
             // ... при вращении будет вызвано отладочное событие
             // ...
+            // после поворота бывший папа становится ребенком, дальше работаем с ним
             if (nd->isRightChild())
-                rotLeft(nd->getDaddy(f));
+            {
+                nd = nd->getDaddy(f);
+                rotLeft(nd);
+            }
 
             nd->getDaddy(f)->setBlack();
 
@@ -404,7 +2262,7 @@ namespace xi {
 
             // отладочное событие
             if (_dumper)
-                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_RECOLOR3D, this, nd);
+                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_RECOLOR3D, this, nd);
 
 
             // деда в красный
@@ -414,7 +2272,7 @@ namespace xi {
 
             // отладочное событие
             if (_dumper)
-                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_RECOLOR3G, this, nd);
+                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_RECOLOR3G, this, nd);
 
             rotRight(grandParent);
 
@@ -422,14 +2280,17 @@ namespace xi {
         else if (nd->getParent()->isRightChild())
         {
             if (nd->isLeftChild())
-                rotRight(nd->getDaddy(f));
+            {
+                nd = nd->getDaddy(f);
+                rotRight(nd);
+            }
 
             nd->getDaddy(f)->setBlack();
             Node* grandParent = nd->getDaddy(f)->getDaddy(f);
 
             // отладочное событие
             if (_dumper)
-                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_RECOLOR3D, this, nd);
+                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_RECOLOR3D, this, nd);
 
 
             // деда в красный
@@ -437,7 +2298,7 @@ namespace xi {
 
             // отладочное событие
             if (_dumper)
-                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_RECOLOR3G, this, nd);
+                _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_RECOLOR3G, this, nd);
 
             rotLeft(grandParent);
         }
@@ -446,7 +2307,7 @@ namespace xi {
 //
 //    // отладочное событие
 //    if (_dumper)
-//        _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_RECOLOR3D, this, nd);
+//        _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_RECOLOR3D, this, nd);
 //
 //
 //    // деда в красный
@@ -455,7 +2316,7 @@ namespace xi {
 //
 //    // отладочное событие
 //    if (_dumper)
-//        _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_RECOLOR3G, this, nd);
+//        _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_RECOLOR3G, this, nd);
 //
 //    // ...
 
@@ -464,8 +2325,8 @@ namespace xi {
     }
 
 
-    template <typename Element, typename Compar >
-    void RBTree<Element, Compar>::rebalance(Node* nd)
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    bool RBTree<Element, Compar, Allocator, Augment, Layout>::rebalance(Node* nd)
     {
 
         // TODO: метод реализуют студенты
@@ -483,14 +2344,270 @@ namespace xi {
 
 
         // ...
+        bool grown = _root->isRed();
         _root->setBlack();
 
+        return grown;
+    }
+
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    std::size_t RBTree<Element, Compar, Allocator, Augment, Layout>::rebalancePending(std::size_t budget)
+    {
+        for (; budget > 0 && _pendingHead < _pending.size(); --budget)
+        {
+            Node* nd = _pending[_pendingHead];
+
+            // узел удален из дерева, пока ждал в очереди
+            if (nd != _root && !nd->parent())
+            {
+                ++_pendingHead;
+                releaseNode(nd);
+                continue;
+            }
+
+            if (!hasViolation(nd))
+            {
+                nd->setQueued(false);
+                ++_pendingHead;
+                continue;
+            }
+
+            // место для нарушений, поднятых шагом, готовим до изменений
+            reservePending(2);
+            repairStep(nd);
+        }
+
+        if (2 * _pendingHead >= _pending.size())
+        {
+            _pending.erase(_pending.begin(), _pending.begin() + _pendingHead);
+            _pendingHead = 0;
+        }
+
+        return _pending.size() - _pendingHead;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::reservePending(std::size_t n)
+    {
+        if (_pending.capacity() - _pending.size() < n)
+            _pending.reserve(std::max(2 * _pending.size(), _pending.size() + n));
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::notePending(Node* nd)
+    {
+        if (!nd->isQueued() && hasViolation(nd))
+        {
+            nd->setQueued(true);
+            _pending.push_back(nd);
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::addBlack(Node* nd)
+    {
+        if (nd->isRed())
+            nd->setBlack();
+        else if (nd != _root)
+        {
+            nd->setExtraBlack(true);
+            notePending(nd);
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::moveExtraBlack(Node* from, Node* to)
+    {
+        if (!from->hasExtraBlack())
+            return;
+
+        from->setExtraBlack(false);
+        addBlack(to);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::repairRed(Node* nd)
+    {
+        // корень всегда черный, поэтому у красного папы есть дедушка; rebalanceDUG() рассчитан на
+        // черного дедушку, поэтому в цепочке красных чиним верхнее нарушение; нижние остаются в
+        // очереди, а вращения переносят их только под красные узлы, у которых они и так были
+        // под красным папой
+        Node* top = nd;
+        while (top->parent()->parent()->isRed())
+            top = top->parent();
+
+        Node* grandParent = top->parent()->parent();
+        if (!grandParent->hasExtraBlack())
+        {
+            Node* up = rebalanceDUG(top);
+            _root->setBlack();
+            notePending(up);
+            return;
+        }
+
+        // лишний черный дедушки делится между папой и дядей или уходит к вершине поворота
+        Node* uncle = top->getUncle();
+        if (isRedNode(uncle))
+        {
+            grandParent->setExtraBlack(false);
+            top->parent()->setBlack();
+            uncle->setBlack();
+        }
+        else
+        {
+            rebalanceDUG(top);
+            moveExtraBlack(grandParent, grandParent->parent());
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node*
+    RBTree<Element, Compar, Allocator, Augment, Layout>::liftBlackStep(Node* x, bool& done)
+    {
+        done = false;
+        if (x == _root)
+        {
+            x->setExtraBlack(false);
+            done = true;
+            return nullptr;
+        }
+
+        // разбор случаев тот же, что в deleteFixUp(); под x черного не меньше единицы, значит,
+        // и под братом, поэтому брат есть, а у красного брата есть оба ребенка
+        Node* par = x->parent();
+        bool left = (par->_left == x);
+        Node* bro = left ? par->_right : par->_left;
+        Node* inner = left ? bro->_left : bro->_right;
+        Node* outer = left ? bro->_right : bro->_left;
+
+        if (bro->isRed())
+        {
+            // поворот ниже рассчитан на черного папу и черных детей брата
+            if (par->isRed())
+                return bro;
+            if (inner->isRed())
+                return inner;
+            if (outer->isRed())
+                return outer;
+
+            // брат встает на место папы вместе с его лишним черным, а у x теперь черный брат
+            bro->setBlack();
+            par->setRed();
+            if (left)
+                rotLeft(par);
+            else
+                rotRight(par);
+            moveExtraBlack(par, bro);
+            return nullptr;
+        }
+
+        if (bro->hasExtraBlack() || (!isRedNode(inner) && !isRedNode(outer)))
+        {
+            // черный уходит от обоих братьев к папе, а третьего черного папа не унесет
+            if (par->hasExtraBlack())
+                return par;
+
+            if (bro->hasExtraBlack())
+                bro->setExtraBlack(false);
+            else
+                bro->setRed();
+            x->setExtraBlack(false);
+            addBlack(par);
+            done = true;
+            return nullptr;
+        }
+
+        // красный племянник: вершина одного-двух поворотов получает цвет папы и его лишний черный
+        Node* top = bro;
+        if (isRedNode(outer))
+            outer->setBlack();
+        else
+        {
+            top = inner;
+            if (left)
+                rotRight(bro);
+            else
+                rotLeft(bro);
+        }
+
+        top->setColor(par->getColor());
+        par->setBlack();
+        if (left)
+            rotLeft(par);
+        else
+            rotRight(par);
+
+        moveExtraBlack(par, top);
+        notePending(top);
+        x->setExtraBlack(false);
+        done = true;
+        return nullptr;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::repairStep(Node* nd)
+    {
+        // мешающие нарушения находятся рядом или выше, поэтому цепочка конечна
+        bool done;
+        while (nd->hasExtraBlack())
+        {
+            nd = liftBlackStep(nd, done);
+            if (!nd)
+            {
+                _root->setBlack();
+                return;
+            }
+        }
+
+        repairRed(nd);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::liftBlack(Node* x)
+    {
+        bool done = false;
+        while (!done)
+        {
+            reservePending(2);
+            if (Node* blocker = liftBlackStep(x, done))
+                repairStep(blocker);
+            _root->setBlack();
+        }
     }
 
 
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::dropPending()
+    {
+        for (std::size_t i = _pendingHead; i < _pending.size(); ++i)
+        {
+            Node* nd = _pending[i];
+            if (nd != _root && !nd->parent())
+                releaseNode(nd);
+            else
+            {
+                nd->setQueued(false);
+                nd->setExtraBlack(false);
+            }
+        }
+
+        _pending.clear();
+        _pendingHead = 0;
+    }
+
 
-    template <typename Element, typename Compar>
-    void RBTree<Element, Compar>::rotLeft(typename RBTree<Element, Compar>::Node* nd)
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::rotLeft(typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node* nd)
     {
         // TODO: метод реализуют студенты
 
@@ -502,38 +2619,42 @@ namespace xi {
 
         // ...
         //changing nodeRight's left pointer
-        y->_right = nd->_left;
+        nd->_right = y->_left;
         if (y->_left)
-            y->_left->_parent = nd;
+            y->_left->setParent(nd);
 
         //changing nodeRight's parent pointer
         if (y)
-            y->_parent = nd->_parent;
+            y->setParent(nd->parent());
 
         //changing parent's pointer
-        if (nd->_parent)
-            if (nd == nd->_parent->_left)
-                nd->_parent->_left = y;
+        if (nd->parent())
+            if (nd == nd->parent()->_left)
+                nd->parent()->_left = y;
             else
-                nd->_parent->_right = y;
+                nd->parent()->_right = y;
         else
             _root = y; // in case node was a root
 
         // changing node's parent
         y->_left = nd;
         if (nd)
-            nd->_parent = y;
+            nd->setParent(y);
+
+        // nd стал ребенком y, поэтому пересчитывается первым
+        pullAug(nd);
+        pullAug(y);
 
 
         // отладочное событие
         if (_dumper)
-            _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_LROT, this, nd);
+            _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_LROT, this, nd);
     }
 
 
 
-    template <typename Element, typename Compar>
-    void RBTree<Element, Compar>::rotRight(typename RBTree<Element, Compar>::Node* nd)
+    template <typename Element, typename Compar, typename Allocator, typename Augment, typename Layout>
+    void RBTree<Element, Compar, Allocator, Augment, Layout>::rotRight(typename RBTree<Element, Compar, Allocator, Augment, Layout>::Node* nd)
     {
         // TODO: метод реализуют студенты
 
@@ -542,30 +2663,33 @@ namespace xi {
         //changing nodeLeft's right pointer
         nd->_left = nodeLeft->_right;
         if (nodeLeft->_right)
-            nodeLeft->_right->_parent = nd;
+            nodeLeft->_right->setParent(nd);
 
         //changing nodeLeft's parent pointer
         if (nodeLeft)
-            nodeLeft->_parent = nd->_parent;
+            nodeLeft->setParent(nd->parent());
 
         //changing parent's pointer
-        if (nd->_parent)
-            if (nd == nd->_parent->_right)
-                nd->_parent->_right = nodeLeft;
+        if (nd->parent())
+            if (nd == nd->parent()->_right)
+                nd->parent()->_right = nodeLeft;
             else
-                nd->_parent->_left = nodeLeft;
+                nd->parent()->_left = nodeLeft;
         else
             _root = nodeLeft;
 
         nodeLeft->_right = nd;
         if (nodeLeft)
-            nd->_parent = nodeLeft;
+            nd->setParent(nodeLeft);
+
+        pullAug(nd);
+        pullAug(nodeLeft);
 
         // ...
 
         // отладочное событие
         if (_dumper)
-            _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar>::DE_AFTER_RROT, this, nd);
+            _dumper->rbTreeEvent(IRBTreeDumper<Element, Compar, Allocator, Augment, Layout>::DE_AFTER_RROT, this, nd);
     }
 
 
@@ -0,0 +1,209 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Определение КЧД, разбитого на диапазоны ключей для параллельных писателей
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Множество, разбитое на шарды — RBTree со своими мьютексами, каждый из которых отвечает
+/// за свой полуинтервал ключей. "Реализация" методов располагается в файле shardedrbtree.hpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef RBTREE_SHARDEDRBTREE_H_
+#define RBTREE_SHARDEDRBTREE_H_
+
+#include <atomic>           // std::atomic
+#include <cstddef>          // std::size_t
+#include <functional>       // std::less
+#include <memory>           // std::allocator, std::unique_ptr
+#include <mutex>            // std::mutex
+#include <vector>
+
+#include "rbtree.h"
+
+
+namespace xi {
+
+
+/** \brief Множество на красно-черных деревьях, разбитое по диапазонам ключей на шарды
+ *  с отдельными блокировками.
+ *
+ *  Каждый шард — \c RBTree с собственным мьютексом и собственным пулом узлов — хранит элементы
+ *  полуинтервала [нижняя граница, верхняя граница). Операция над ключом находит шард по
+ *  неизменяемому оглавлению (двоичный поиск по нижним границам, без блокировок), берет мьютекс
+ *  только этого шарда и сверяет его границы. Поэтому писатели в разные диапазоны не мешают друг
+ *  другу, а общими для них остаются лишь читаемые данные оглавления.
+ *
+ *  Шард, переросший \c maxShardSize элементов, делится пополам: старшая половина копируется в
+ *  новый шард за линейное время (у него будет свой пул), отрезается от старого за O(log n)
+ *  (\c RBTree::split()), и публикуется новое оглавление. Деления выполняются по одному, не
+ *  останавливая операции над другими шардами. Старое оглавление освобождается, когда его
+ *  заведомо никто не читает: читатели отмечаются в счетчиках двух поколений, разнесенных по
+ *  нескольким линиям кэша, а делящий поток меняет поколение и ждет, пока счетчики прежнего
+ *  опустеют. Шарды не сливаются: опустевший шард остается в оглавлении.
+ *
+ *  Обход \c forEach() идет по шардам по возрастанию, держа мьютекс следующего шарда прежде,
+ *  чем отпустить текущий, поэтому каждый элемент, остающийся в множестве весь обход, будет
+ *  посещен ровно один раз, даже если шарды в это время делятся.
+ *
+ *  \tparam Element Тип элементов; должен быть копируемым.
+ *  \tparam Compar Строгий слабый порядок на элементах, как у \c RBTree.
+ *  \tparam Allocator Аллокатор узлов, как у \c RBTree.
+ */
+    template <typename Element,
+              typename Compar = std::less<Element>,
+              typename Allocator = std::allocator<Element> >
+    class ShardedRBTree {
+    public:
+        typedef RBTree<Element, Compar, Allocator, OrderStatAugment> TTree;
+
+        /** \brief Размер шарда по умолчанию, после которого он делится. */
+        static const std::size_t DEF_MAX_SHARD_SIZE = 8192;
+
+    public:
+        /** \brief Создает пустое множество из одного шарда на весь диапазон ключей. */
+        explicit ShardedRBTree(std::size_t maxShardSize = DEF_MAX_SHARD_SIZE,
+                               const Compar& compar = Compar(), const Allocator& alloc = Allocator());
+
+        /** \brief Создает пустое множество, заранее разбитое границами [firstBound, lastBound)
+         *  на шарды (k границ дают k + 1 шард).
+         *
+         *  Границы должны строго возрастать, иначе генерируется \c std::invalid_argument.
+         */
+        template <typename ForwardIt>
+        ShardedRBTree(ForwardIt firstBound, ForwardIt lastBound, std::size_t maxShardSize = DEF_MAX_SHARD_SIZE,
+                      const Compar& compar = Compar(), const Allocator& alloc = Allocator());
+
+        ~ShardedRBTree();
+
+    public:
+        // Изменение
+
+        /** \brief Вставляет элемент \c key; если он уже есть, генерирует \c std::logic_error,
+         *  как \c RBTree::insert().
+         */
+        void insert(const Element& key);
+
+        /** \brief Вставляет элемент \c key, если его еще нет; возвращает истину, если вставил. */
+        bool tryInsert(const Element& key);
+
+#ifdef RBTREE_WITH_DELETION
+        /** \brief Удаляет элемент \c key; если его нет, генерирует \c std::logic_error. */
+        void remove(const Element& key);
+#endif
+
+    public:
+        // Чтение
+
+        /** \brief Возвращает истину, если элемент, эквивалентный \c key, есть в множестве. */
+        bool contains(const Element& key) const;
+
+        /** \brief Вызывает \c visitor(element) для всех элементов по возрастанию.
+         *
+         *  Шард посещается под своим мьютексом, поэтому \c visitor не должен обращаться к этому
+         *  множеству.
+         */
+        template <typename Visitor>
+        void forEach(Visitor visitor) const;
+
+        /** \brief Возвращает число элементов; при параллельных изменениях — на момент прохода
+         *  по каждому шарду.
+         */
+        std::size_t getSize() const;
+
+        /** \brief Возвращает текущее число шардов. */
+        std::size_t getShardCount() const;
+
+    protected:
+        static const std::size_t CACHE_LINE = 64;   ///< Предполагаемый размер линии кэша.
+        static const std::size_t PIN_STRIPES = 16;  ///< Число полос счетчиков читателей.
+
+        /** \brief Шард: дерево своего полуинтервала ключей и его мьютекс. */
+        struct Shard {
+            Shard(const Compar& compar, const Allocator& alloc) : tree(compar, alloc), next(nullptr) {}
+
+            std::mutex lock;                        ///< Защищает все остальные поля.
+            TTree tree;                             ///< Элементы шарда.
+            Shard* next;                            ///< Следующий по ключам шард или \c nullptr.
+            std::unique_ptr<Element> lower;         ///< Нижняя граница (включительно); нет у первого.
+            std::unique_ptr<Element> upper;         ///< Верхняя граница (исключая); нет у последнего.
+        }; // struct Shard
+
+        /** \brief Неизменяемое оглавление: шарды по возрастанию и нижние границы всех, кроме первого. */
+        struct Directory {
+            std::vector<Shard*> shards;
+            std::vector<Element> lowers;            ///< \c lowers[i] — нижняя граница \c shards[i + 1].
+        }; // struct Directory
+
+        /** \brief Счетчики читателей оглавления двух поколений; занимает целую линию кэша, чтобы
+         *  потоки, попавшие в разные полосы, не делили ее.
+         */
+        struct PinStripe {
+            std::atomic<std::size_t> pins[2];
+            char pad[CACHE_LINE - 2 * sizeof(std::atomic<std::size_t>)];
+        }; // struct PinStripe
+
+        /** \brief Выполняет \c fn(shard) под мьютексом шарда, отвечающего за \c key, и возвращает
+         *  этот шард.
+         */
+        template <typename Fn>
+        Shard* withShard(const Element& key, Fn fn) const;
+
+        /** \brief Возвращает шард, отвечающий за \c key по текущему оглавлению; к моменту взятия
+         *  его мьютекса граница может уже сдвинуться, поэтому ее надо сверить.
+         */
+        Shard* route(const Element& key) const;
+
+        /** \brief Выполняет \c fn(directory), отметившись читателем текущего оглавления. */
+        template <typename Fn>
+        void readDirectory(Fn fn) const;
+
+        /** \brief Возвращает истину, если \c key лежит в границах шарда \c sh (под его мьютексом). */
+        bool covers(const Shard& sh, const Element& key) const
+        {
+            return (!sh.lower || !_less(key, *sh.lower)) && (!sh.upper || _less(key, *sh.upper));
+        }
+
+        /** \brief Делит шард \c sh пополам, если он все еще больше \c _maxShardSize и никто другой
+         *  сейчас не делит шарды.
+         */
+        void trySplit(Shard* sh);
+
+        /** \brief Освобождает замененное оглавление \c old, сменив поколение и дождавшись всех его
+         *  читателей. Вызывается под \c _splitLock.
+         */
+        void retire(Directory* old);
+
+    protected:
+        ShardedRBTree(const ShardedRBTree&);                ///< КК не доступен.
+        ShardedRBTree& operator= (const ShardedRBTree&);    ///< Оператор присваивания недоступен.
+
+    protected:
+        KeyLess<Compar> _less;                      ///< "Меньше" поверх компаратора элементов.
+        Allocator   _alloc;                         ///< Аллокатор для новых шардов.
+        std::size_t _maxShardSize;                  ///< Размер, после которого шард делится.
+
+        std::vector<std::unique_ptr<Shard> > _shards;   ///< Все шарды; меняется под \c _splitLock.
+        Shard*      _first;                         ///< Шард с наименьшими ключами; не меняется.
+        std::mutex  _splitLock;                     ///< Сериализует деления шардов.
+
+        std::atomic<Directory*> _dir;               ///< Текущее оглавление.
+        std::atomic<unsigned> _epoch;               ///< Поколение; его четность выбирает счетчик.
+        mutable PinStripe _pins[PIN_STRIPES];       ///< Счетчики читателей оглавления.
+    }; // class ShardedRBTree
+
+
+} // namespace xi
+
+
+
+// Подключаем "реализационную" часть
+#include "shardedrbtree.hpp"
+
+
+#endif // RBTREE_SHARDEDRBTREE_H_
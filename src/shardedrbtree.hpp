@@ -0,0 +1,305 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Реализация КЧД, разбитого на диапазоны ключей для параллельных писателей
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// "Реализация" (шаблонов) методов, описанных в файле shardedrbtree.h
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>        // std::upper_bound
+#include <stdexcept>        // std::invalid_argument
+#include <thread>           // std::this_thread
+
+
+namespace xi {
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    ShardedRBTree<Element, Compar, Allocator>::ShardedRBTree(std::size_t maxShardSize,
+                                                             const Compar& compar, const Allocator& alloc)
+        : _less(compar)
+        , _alloc(alloc)
+        , _maxShardSize(maxShardSize)
+        , _first(nullptr)
+        , _dir(nullptr)
+        , _epoch(0)
+    {
+        for (std::size_t i = 0; i < PIN_STRIPES; ++i)
+            _pins[i].pins[0] = _pins[i].pins[1] = 0;
+
+        _shards.push_back(std::unique_ptr<Shard>(new Shard(_less.getCompar(), _alloc)));
+        _first = _shards.back().get();
+
+        std::unique_ptr<Directory> dir(new Directory());
+        dir->shards.push_back(_first);
+        _dir = dir.release();
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    template <typename ForwardIt>
+    ShardedRBTree<Element, Compar, Allocator>::ShardedRBTree(ForwardIt firstBound, ForwardIt lastBound,
+                                                             std::size_t maxShardSize,
+                                                             const Compar& compar, const Allocator& alloc)
+        : ShardedRBTree(maxShardSize, compar, alloc)
+    {
+        // множество еще никому не видно, поэтому шарды и оглавление достраиваются без блокировок
+        Directory* dir = _dir.load(std::memory_order_relaxed);
+        Shard* last = _first;
+        for (ForwardIt it = firstBound; it != lastBound; ++it)
+        {
+            if (!dir->lowers.empty() && !_less(dir->lowers.back(), *it))
+                throw std::invalid_argument("Shard bounds must be strictly increasing");
+
+            _shards.push_back(std::unique_ptr<Shard>(new Shard(_less.getCompar(), _alloc)));
+            Shard* sh = _shards.back().get();
+            sh->lower.reset(new Element(*it));
+            last->upper.reset(new Element(*it));
+            last->next = sh;
+            last = sh;
+
+            dir->shards.push_back(sh);
+            dir->lowers.push_back(*it);
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    ShardedRBTree<Element, Compar, Allocator>::~ShardedRBTree()
+    {
+        delete _dir.load(std::memory_order_relaxed);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void ShardedRBTree<Element, Compar, Allocator>::insert(const Element& key)
+    {
+        bool grown = false;
+        Shard* sh = withShard(key, [this, &key, &grown](Shard& s) {
+            s.tree.insert(key);
+            grown = s.tree.getSize() > _maxShardSize;
+        });
+
+        if (grown)
+            trySplit(sh);
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    bool ShardedRBTree<Element, Compar, Allocator>::tryInsert(const Element& key)
+    {
+        bool inserted = false;
+        bool grown = false;
+        Shard* sh = withShard(key, [this, &key, &inserted, &grown](Shard& s) {
+            inserted = s.tree.tryInsert(key).second;
+            grown = s.tree.getSize() > _maxShardSize;
+        });
+
+        if (grown)
+            trySplit(sh);
+        return inserted;
+    }
+
+
+#ifdef RBTREE_WITH_DELETION
+
+    template <typename Element, typename Compar, typename Allocator>
+    void ShardedRBTree<Element, Compar, Allocator>::remove(const Element& key)
+    {
+        withShard(key, [&key](Shard& s) { s.tree.remove(key); });
+    }
+
+#endif // RBTREE_WITH_DELETION
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    bool ShardedRBTree<Element, Compar, Allocator>::contains(const Element& key) const
+    {
+        bool found = false;
+        withShard(key, [&key, &found](Shard& s) { found = s.tree.find(key) != nullptr; });
+        return found;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    template <typename Visitor>
+    void ShardedRBTree<Element, Compar, Allocator>::forEach(Visitor visitor) const
+    {
+        // мьютекс следующего шарда берется до того, как отпущен текущий: деление, сдвигающее
+        // границу между ними, ждет обоих, поэтому элементы не перескакивают через обход
+        Shard* sh = _first;
+        std::unique_lock<std::mutex> lock(sh->lock);
+        for (;;)
+        {
+            for (typename TTree::ConstIterator it = sh->tree.begin(); it != sh->tree.end(); ++it)
+                visitor(*it);
+
+            Shard* next = sh->next;
+            if (!next)
+                return;
+
+            std::unique_lock<std::mutex> nextLock(next->lock);
+            lock.swap(nextLock);
+            sh = next;
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    std::size_t ShardedRBTree<Element, Compar, Allocator>::getSize() const
+    {
+        std::size_t size = 0;
+        for (Shard* sh = _first; sh; )
+        {
+            std::lock_guard<std::mutex> lock(sh->lock);
+            size += sh->tree.getSize();
+            sh = sh->next;
+        }
+        return size;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    std::size_t ShardedRBTree<Element, Compar, Allocator>::getShardCount() const
+    {
+        std::size_t count = 0;
+        readDirectory([&count](const Directory& dir) { count = dir.shards.size(); });
+        return count;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    template <typename Fn>
+    typename ShardedRBTree<Element, Compar, Allocator>::Shard*
+    ShardedRBTree<Element, Compar, Allocator>::withShard(const Element& key, Fn fn) const
+    {
+        // оглавление могло устареть, пока мы ждали мьютекс: тогда граница шарда уже сдвинута
+        // делением, и шард ищется заново по свежему оглавлению
+        for (;;)
+        {
+            Shard* sh = route(key);
+            std::lock_guard<std::mutex> lock(sh->lock);
+            if (covers(*sh, key))
+            {
+                fn(*sh);
+                return sh;
+            }
+        }
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    typename ShardedRBTree<Element, Compar, Allocator>::Shard*
+    ShardedRBTree<Element, Compar, Allocator>::route(const Element& key) const
+    {
+        Shard* sh = nullptr;
+        readDirectory([this, &key, &sh](const Directory& dir) {
+            sh = dir.shards[std::upper_bound(dir.lowers.begin(), dir.lowers.end(), key, _less)
+                            - dir.lowers.begin()];
+        });
+        return sh;
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    template <typename Fn>
+    void ShardedRBTree<Element, Compar, Allocator>::readDirectory(Fn fn) const
+    {
+        PinStripe& stripe = _pins[std::hash<std::thread::id>()(std::this_thread::get_id()) % PIN_STRIPES];
+
+        // отметка действует, только если поколение не сменилось между ее чтением и проверкой:
+        // иначе делящий поток мог уже не увидеть ее и освободить оглавление
+        unsigned epoch = _epoch.load();
+        for (;;)
+        {
+            stripe.pins[epoch & 1].fetch_add(1);
+            unsigned now = _epoch.load();
+            if (now == epoch)
+                break;
+
+            stripe.pins[epoch & 1].fetch_sub(1, std::memory_order_release);
+            epoch = now;
+        }
+
+        struct Unpin {
+            std::atomic<std::size_t>& pins;
+            ~Unpin() { pins.fetch_sub(1, std::memory_order_release); }
+        } unpin = { stripe.pins[epoch & 1] };
+
+        fn(*_dir.load());
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void ShardedRBTree<Element, Compar, Allocator>::trySplit(Shard* sh)
+    {
+        // если делит другой поток, он же поделит и этот шард позже — при следующей вставке в него
+        std::unique_lock<std::mutex> splitLock(_splitLock, std::try_to_lock);
+        if (!splitLock.owns_lock())
+            return;
+
+        std::unique_ptr<Directory> dir;
+        {
+            std::lock_guard<std::mutex> lock(sh->lock);
+            std::size_t size = sh->tree.getSize();
+            if (size <= _maxShardSize)
+                return;
+
+            // старшая половина копируется в новый шард с собственным пулом: деревья, разрезанные
+            // split(), делят пул, а шарды меняются параллельно
+            typename TTree::ConstIterator mid = sh->tree.select(size / 2);
+            std::unique_ptr<Shard> fresh(new Shard(_less.getCompar(), _alloc));
+            fresh->tree.buildFromSorted(mid, sh->tree.end());
+            fresh->lower.reset(new Element(*mid));
+
+            const Directory* old = _dir.load(std::memory_order_relaxed);
+            std::size_t pos = std::upper_bound(old->lowers.begin(), old->lowers.end(), *mid, _less)
+                              - old->lowers.begin();
+            dir.reset(new Directory(*old));
+            dir->shards.insert(dir->shards.begin() + pos + 1, fresh.get());
+            dir->lowers.insert(dir->lowers.begin() + pos, *fresh->lower);
+            std::unique_ptr<Element> upper(new Element(*fresh->lower));
+            _shards.reserve(_shards.size() + 1);
+
+            // дальше ничего не бросает, кроме компаратора в split(), который сравнивает до изменений
+            {
+                TTree greater(_less.getCompar(), _alloc);
+                sh->tree.split(*fresh->lower, greater);
+            }
+            fresh->upper.swap(sh->upper);
+            sh->upper.swap(upper);
+            fresh->next = sh->next;
+            sh->next = fresh.get();
+            _shards.push_back(std::move(fresh));
+
+            // оглавление публикуется до того, как отпущен шард: писатель, нашедший его по старому
+            // оглавлению, увидит сдвинутую границу и перечитает оглавление
+            dir.reset(_dir.exchange(dir.release()));
+        }
+
+        retire(dir.release());
+    }
+
+
+    template <typename Element, typename Compar, typename Allocator>
+    void ShardedRBTree<Element, Compar, Allocator>::retire(Directory* old)
+    {
+        // новое поколение: кто отметится после смены, прочтет уже новое оглавление
+        unsigned epoch = _epoch.fetch_add(1);
+        for (std::size_t i = 0; i < PIN_STRIPES; ++i)
+        {
+            while (_pins[i].pins[epoch & 1].load(std::memory_order_acquire) != 0)
+                std::this_thread::yield();
+        }
+
+        delete old;
+    }
+
+
+} // namespace xi
@@ -0,0 +1,198 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit tests for xi::ConcurrentRBTree interfaces
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "concurrentrbtree.h"
+
+
+using namespace xi;
+
+// Тестируем на целых числах.
+typedef ConcurrentRBTree<int> ConcurrentRBTreeInt;
+
+
+/** \brief Трехзначный компаратор целых. */
+struct IntCompar3 {
+    typedef void is_three_way;
+
+    int operator()(int a, int b) const { return a < b ? -1 : (b < a ? 1 : 0); }
+}; // struct IntCompar3
+
+
+/** \brief Тестовый класс для открытых интерфейсов конкурентного КЧД. */
+class ConcurrentRBTreePubTest : public ::testing::Test {
+}; // class ConcurrentRBTreePubTest
+
+
+
+TEST_F(ConcurrentRBTreePubTest, Simplest)
+{
+    ConcurrentRBTreeInt tree;
+    EXPECT_TRUE(tree.isEmpty());
+    EXPECT_FALSE(tree.contains(1));
+    EXPECT_TRUE(tree.findRange(0, 100).empty());
+
+    tree.insert(5);
+    tree.insert(1);
+    EXPECT_TRUE(tree.tryInsert(3));
+    EXPECT_FALSE(tree.tryInsert(3));
+    EXPECT_THROW(tree.insert(5), std::logic_error);
+
+    int out = 0;
+    EXPECT_TRUE(tree.find(3, out));
+    EXPECT_EQ(3, out);
+    EXPECT_FALSE(tree.find(4, out));
+    EXPECT_EQ(3, out);
+
+    std::vector<int> range = tree.findRange(1, 5);          // полуинтервал: 5 не входит
+    ASSERT_EQ(2u, range.size());
+    EXPECT_EQ(1, range[0]);
+    EXPECT_EQ(3, range[1]);
+
+    tree.remove(3);
+    EXPECT_FALSE(tree.contains(3));
+    EXPECT_THROW(tree.remove(3), std::logic_error);
+
+    tree.clear();
+    EXPECT_TRUE(tree.isEmpty());
+}
+
+
+// читатели без блокировок сравнивают ключи так же, как само дерево
+TEST_F(ConcurrentRBTreePubTest, threeWayCompar1)
+{
+    ConcurrentRBTree<int, IntCompar3> tree;
+    for (int i = 0; i < 100; ++i)
+        tree.insert(i);
+
+    for (int i = 0; i < 100; ++i)
+        EXPECT_TRUE(tree.contains(i));
+    EXPECT_FALSE(tree.contains(100));
+
+    std::vector<int> range = tree.findRange(10, 20);
+    ASSERT_EQ(10u, range.size());
+    for (int i = 0; i < 10; ++i)
+        EXPECT_EQ(10 + i, range[i]);
+}
+
+
+// читатели параллельно с писателем: четные ключи есть всегда, нечетные то вставляются,
+// то удаляются, и каждый снимок диапазона должен быть упорядочен и содержать все четные
+TEST_F(ConcurrentRBTreePubTest, readersWithWriter1)
+{
+    const int KEYS = 2000;
+    ConcurrentRBTreeInt tree;
+    for (int i = 0; i < KEYS; i += 2)
+        tree.insert(i);
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> failures(0);
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r)
+    {
+        readers.push_back(std::thread([&tree, &stop, &failures, r, KEYS]() {
+            int key = r;
+            while (!stop.load())
+            {
+                key = (key + 2 * 37 + 1) % KEYS;
+                int even = key & ~1;
+                if (!tree.contains(even))
+                    ++failures;
+
+                std::vector<int> snap = tree.findRange(even, even + 100);
+                int expectEven = even;
+                for (std::size_t i = 0; i < snap.size(); ++i)
+                {
+                    if (i > 0 && !(snap[i - 1] < snap[i]))
+                        ++failures;
+                    if (snap[i] % 2 == 0)
+                    {
+                        if (snap[i] != expectEven)
+                            ++failures;
+                        expectEven += 2;
+                    }
+                }
+                if (expectEven < even + 100 && expectEven < KEYS)
+                    ++failures;
+            }
+        }));
+    }
+
+    for (int round = 0; round < 20; ++round)
+    {
+        for (int i = 1; i < KEYS; i += 2)
+            tree.insert(i);
+        for (int i = 1; i < KEYS; i += 2)
+            tree.remove(i);
+    }
+
+    stop.store(true);
+    for (std::size_t i = 0; i < readers.size(); ++i)
+        readers[i].join();
+
+    EXPECT_EQ(0, failures.load());
+    EXPECT_EQ(static_cast<std::size_t>(KEYS / 2), tree.findRange(0, KEYS).size());
+}
+
+
+// очистка при живых читателях: узлы снятого дерева разрушаются только после того, как читатели,
+// которые могли на них стоять, закончат; каждый снимок — упорядоченный кусок [0, KEYS)
+TEST_F(ConcurrentRBTreePubTest, readersWithClear1)
+{
+    const int KEYS = 500;
+    ConcurrentRBTreeInt tree;
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> failures(0);
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r)
+    {
+        readers.push_back(std::thread([&tree, &stop, &failures, KEYS]() {
+            while (!stop.load())
+            {
+                std::vector<int> snap = tree.findRange(0, KEYS);
+                for (std::size_t i = 0; i < snap.size(); ++i)
+                {
+                    if (snap[i] != static_cast<int>(i))
+                        ++failures;
+                }
+            }
+        }));
+    }
+
+    for (int round = 0; round < 50; ++round)
+    {
+        tree.clear();
+        for (int i = 0; i < KEYS; ++i)
+            tree.insert(i);
+    }
+
+    stop.store(true);
+    for (std::size_t i = 0; i < readers.size(); ++i)
+        readers[i].join();
+
+    EXPECT_EQ(0, failures.load());
+    EXPECT_EQ(static_cast<std::size_t>(KEYS), tree.findRange(0, KEYS).size());
+}
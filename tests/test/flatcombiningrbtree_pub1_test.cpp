@@ -0,0 +1,173 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit tests for xi::FlatCombiningRBTree interfaces
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "flatcombiningrbtree.h"
+
+
+using namespace xi;
+
+// Тестируем на целых числах.
+typedef FlatCombiningRBTree<int> FlatCombiningRBTreeInt;
+
+
+/** \brief Трехзначный компаратор целых, бросающий исключение на ключе \c BAD_KEY. */
+struct ThrowingCompar3 {
+    typedef void is_three_way;
+
+    enum { BAD_KEY = -13 };
+
+    int operator()(int a, int b) const
+    {
+        if (a == BAD_KEY || b == BAD_KEY)
+            throw std::runtime_error("Bad key");
+        return a < b ? -1 : (b < a ? 1 : 0);
+    }
+}; // struct ThrowingCompar3
+
+
+/** \brief Тестовый класс для открытых интерфейсов КЧД с плоским комбинированием. */
+class FlatCombiningRBTreePubTest : public ::testing::Test {
+protected:
+    /** \brief Возвращает элементы дерева по порядку. */
+    static std::vector<int> elements(const FlatCombiningRBTreeInt& tree)
+    {
+        std::vector<int> res;
+        tree.withTree([&res](const FlatCombiningRBTreeInt::TTree& t) {
+            for (FlatCombiningRBTreeInt::TTree::ConstIterator it = t.begin(); it != t.end(); ++it)
+                res.push_back(*it);
+        });
+        return res;
+    }
+}; // class FlatCombiningRBTreePubTest
+
+
+
+TEST_F(FlatCombiningRBTreePubTest, Simplest)
+{
+    FlatCombiningRBTreeInt tree;
+
+    tree.insert(5);
+    tree.insert(1);
+    EXPECT_TRUE(tree.tryInsert(3));
+    EXPECT_FALSE(tree.tryInsert(3));
+    EXPECT_THROW(tree.insert(1), std::logic_error);
+
+    EXPECT_TRUE(tree.contains(5));
+    EXPECT_FALSE(tree.contains(4));
+
+    tree.remove(5);
+    EXPECT_THROW(tree.remove(5), std::logic_error);
+    EXPECT_TRUE(tree.tryRemove(1));
+    EXPECT_FALSE(tree.tryRemove(1));
+
+    EXPECT_EQ(std::vector<int>(1, 3), elements(tree));
+}
+
+
+// писатели с пересекающимися ключами: каждый ключ вставляется ровно одним, а исключения
+// повторных вставок доходят до тех потоков, что их запросили
+TEST_F(FlatCombiningRBTreePubTest, writers1)
+{
+    const int WRITERS = 4;
+    const int KEYS = 4000;
+    FlatCombiningRBTreeInt tree;
+
+    std::atomic<int> inserted(0);
+    std::atomic<int> rejected(0);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> writers;
+    for (int w = 0; w < WRITERS; ++w)
+    {
+        writers.push_back(std::thread([&tree, &inserted, &rejected, &failures, KEYS]() {
+            for (int key = 0; key < KEYS; ++key)
+            {
+                try
+                {
+                    tree.insert(key);
+                    ++inserted;
+                }
+                catch (std::logic_error&)
+                {
+                    ++rejected;
+                }
+
+                if (!tree.contains(key))
+                    ++failures;
+            }
+        }));
+    }
+
+    for (std::size_t i = 0; i < writers.size(); ++i)
+        writers[i].join();
+
+    EXPECT_EQ(0, failures.load());
+    EXPECT_EQ(KEYS, inserted.load());
+    EXPECT_EQ((WRITERS - 1) * KEYS, rejected.load());
+
+    std::vector<int> all = elements(tree);
+    ASSERT_EQ(static_cast<std::size_t>(KEYS), all.size());
+    for (int i = 0; i < KEYS; ++i)
+        EXPECT_EQ(i, all[i]);
+}
+
+
+// трехзначный компаратор и компаратор, бросающий исключения в том числе при сортировке пачки:
+// каждый запрос завершается, а исключение получает только тот, кто спрашивал плохой ключ
+TEST_F(FlatCombiningRBTreePubTest, compar1)
+{
+    const int WRITERS = 4;
+    const int KEYS = 2000;
+    FlatCombiningRBTree<int, ThrowingCompar3> tree;
+
+    std::atomic<int> failures(0);
+    std::vector<std::thread> writers;
+    for (int w = 0; w < WRITERS; ++w)
+    {
+        writers.push_back(std::thread([&tree, &failures, w, KEYS]() {
+            for (int i = 0; i < KEYS; ++i)
+            {
+                int key = i * WRITERS + w;
+                tree.insert(key);
+                if (!tree.contains(key))
+                    ++failures;
+
+                try
+                {
+                    tree.tryInsert(ThrowingCompar3::BAD_KEY);
+                    ++failures;
+                }
+                catch (std::runtime_error&)
+                {
+                }
+            }
+        }));
+    }
+
+    for (std::size_t i = 0; i < writers.size(); ++i)
+        writers[i].join();
+
+    EXPECT_EQ(0, failures.load());
+    for (int key = 0; key < WRITERS * KEYS; ++key)
+        EXPECT_TRUE(tree.contains(key));
+}
@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit tests for xi::IntervalTree interfaces
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "intervaltree.h"
+
+
+using namespace xi;
+
+// Тестируем на целых числах.
+typedef IntervalTree<int> IntervalTreeInt;
+
+
+/** \brief Тестовый класс для открытых интерфейсов дерева интервалов. */
+class IntervalTreePubTest : public ::testing::Test {
+public:
+    static const int INTERVALS[][2];
+    static const int INTERVALS_NUM;
+
+protected:
+    /** \brief Заполняет дерево интервалами из \c INTERVALS. */
+    void fill(IntervalTreeInt& tree)
+    {
+        for (int i = 0; i < INTERVALS_NUM; ++i)
+            tree.insert(INTERVALS[i][0], INTERVALS[i][1]);
+    }
+
+    /** \brief Возвращает интервалы из \c INTERVALS, пересекающиеся с [lo, hi], прямым перебором. */
+    std::vector<IntervalTreeInt::TInterval> bruteOverlapping(int lo, int hi)
+    {
+        std::vector<IntervalTreeInt::TInterval> res;
+        for (int i = 0; i < INTERVALS_NUM; ++i)
+        {
+            IntervalTreeInt::TInterval iv = { INTERVALS[i][0], INTERVALS[i][1] };
+            if (lo <= hi && iv.overlaps(lo, hi))
+                res.push_back(iv);
+        }
+        std::sort(res.begin(), res.end(), IntervalLess<int>());
+        return res;
+    }
+
+    /** \brief Сравнивает списки интервалов. */
+    static bool sameIntervals(const std::vector<IntervalTreeInt::TInterval>& a,
+                              const std::vector<IntervalTreeInt::TInterval>& b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (std::size_t i = 0; i < a.size(); ++i)
+            if (a[i].low != b[i].low || a[i].high != b[i].high)
+                return false;
+        return true;
+    }
+}; // class IntervalTreePubTest
+
+
+// Вынесенная инициализация массива (пример из Кормена и др.)
+const int IntervalTreePubTest::INTERVALS[][2] =
+{ { 16, 21 }, { 8, 9 }, { 25, 30 }, { 5, 8 }, { 15, 23 }, { 17, 19 },
+  { 26, 26 }, { 0, 3 }, { 6, 10 }, { 19, 20 }, { 5, 40 } };
+const int IntervalTreePubTest::INTERVALS_NUM = sizeof(INTERVALS) / sizeof(INTERVALS[0]);
+
+
+
+TEST_F(IntervalTreePubTest, Simplest)
+{
+    IntervalTreeInt tree;
+    EXPECT_TRUE(tree.isEmpty());
+    EXPECT_EQ(nullptr, tree.findAnyOverlapping(0, 100));
+    EXPECT_TRUE(tree.findContaining(5).empty());
+    EXPECT_THROW(tree.insert(5, 4), std::invalid_argument);
+}
+
+
+// пересечения и протыкания против прямого перебора
+TEST_F(IntervalTreePubTest, overlap1)
+{
+    IntervalTreeInt tree;
+    fill(tree);
+    EXPECT_TRUE(tree.contains(5, 8));
+    EXPECT_FALSE(tree.contains(5, 9));
+    EXPECT_THROW(tree.insert(5, 8), std::logic_error);
+
+    for (int lo = -2; lo <= 42; ++lo)
+    {
+        for (int hi = lo - 1; hi <= 42; ++hi)
+        {
+            std::vector<IntervalTreeInt::TInterval> expected = bruteOverlapping(lo, hi);
+            EXPECT_TRUE(sameIntervals(expected, tree.findOverlapping(lo, hi)));
+
+            const IntervalTreeInt::TInterval* any = tree.findAnyOverlapping(lo, hi);
+            EXPECT_EQ(expected.empty(), any == nullptr);
+            if (any)
+            {
+                EXPECT_TRUE(any->overlaps(lo, hi));
+            }
+        }
+    }
+
+    std::vector<IntervalTreeInt::TInterval> at20 = tree.findContaining(20);
+    EXPECT_EQ(4u, at20.size());                 // [5, 40], [15, 23], [16, 21], [19, 20]
+}
+
+
+// максимальный конец поддерживается при удалениях
+TEST_F(IntervalTreePubTest, remove1)
+{
+    IntervalTreeInt tree;
+    fill(tree);
+
+    tree.remove(5, 40);
+    tree.remove(16, 21);
+    EXPECT_THROW(tree.remove(16, 21), std::logic_error);
+
+    EXPECT_EQ(30, tree.getTree().getRoot()->getAugment());
+    EXPECT_EQ(nullptr, tree.findAnyOverlapping(31, 100));
+
+    std::vector<IntervalTreeInt::TInterval> at20 = tree.findContaining(20);
+    ASSERT_EQ(2u, at20.size());
+    EXPECT_EQ(15, at20[0].low);
+    EXPECT_EQ(19, at20[1].low);
+}
@@ -0,0 +1,155 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit tests for xi::PersistentRBTree interfaces
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include "persistentrbtree.h"
+
+
+using namespace xi;
+
+// Тестируем на целых числах.
+typedef PersistentRBTree<int> PersistentRBTreeInt;
+
+
+/** \brief Тестовый класс для открытых интерфейсов персистентного КЧД. */
+class PersistentRBTreePubTest : public ::testing::Test {
+protected:
+    /** \brief Проверяет свойства КЧД и порядок в поддереве \c nd; возвращает черную высоту
+     *  или -1, если свойства нарушены.
+     */
+    static int checkRB(const PersistentRBTreeInt::Node* nd, bool parentRed)
+    {
+        if (!nd)
+            return 0;
+
+        bool red = nd->getColor() == PersistentRBTreeInt::RED;
+        if (red && parentRed)
+            return -1;
+        if ((nd->getLeft() && !(nd->getLeft()->getKey() < nd->getKey()))
+            || (nd->getRight() && !(nd->getKey() < nd->getRight()->getKey())))
+            return -1;
+
+        int lbh = checkRB(nd->getLeft(), red);
+        int rbh = checkRB(nd->getRight(), red);
+        if (lbh < 0 || lbh != rbh)
+            return -1;
+        return lbh + (red ? 0 : 1);
+    }
+
+    /** \brief Возвращает элементы дерева по порядку. */
+    static std::vector<int> elements(const PersistentRBTreeInt& tree)
+    {
+        std::vector<int> res;
+        tree.forEach([&res](int e) { res.push_back(e); });
+        return res;
+    }
+}; // class PersistentRBTreePubTest
+
+
+
+TEST_F(PersistentRBTreePubTest, Simplest)
+{
+    PersistentRBTreeInt tree;
+    EXPECT_TRUE(tree.isEmpty());
+    EXPECT_EQ(nullptr, tree.find(1));
+
+    tree.insert(2);
+    tree.insert(1);
+    EXPECT_TRUE(tree.tryInsert(3));
+    EXPECT_FALSE(tree.tryInsert(3));
+    EXPECT_THROW(tree.insert(1), std::logic_error);
+    EXPECT_EQ(3u, tree.getSize());
+    ASSERT_NE(nullptr, tree.find(2));
+    EXPECT_EQ(2, *tree.find(2));
+
+    tree.remove(2);
+    EXPECT_FALSE(tree.contains(2));
+    EXPECT_THROW(tree.remove(2), std::logic_error);
+    EXPECT_EQ(2u, tree.getSize());
+}
+
+
+// снимок стоит O(1), не видит последующих изменений и делит с деревом нетронутые узлы
+TEST_F(PersistentRBTreePubTest, snapshot1)
+{
+    PersistentRBTreeInt tree;
+    for (int i = 0; i < 1000; ++i)
+        tree.insert(i);
+
+    PersistentRBTreeInt snap = tree.snapshot();
+    EXPECT_EQ(tree.getRoot(), snap.getRoot());
+
+    // вставка справа копирует только правый путь, левое поддерево корня остается общим
+    tree.insert(1000);
+    EXPECT_NE(tree.getRoot(), snap.getRoot());
+    EXPECT_EQ(snap.getRoot()->getLeft(), tree.getRoot()->getLeft());
+    EXPECT_TRUE(tree.getRoot()->getLeft()->isShared());
+
+    tree.remove(0);
+
+    EXPECT_EQ(1000u, snap.getSize());
+    EXPECT_TRUE(snap.contains(0));
+    EXPECT_FALSE(snap.contains(1000));
+    EXPECT_FALSE(tree.contains(0));
+    EXPECT_TRUE(tree.contains(1000));
+}
+
+
+// много версий, меняющихся вперемешку, против std::set
+TEST_F(PersistentRBTreePubTest, versions1)
+{
+    std::vector<PersistentRBTreeInt> trees(1);
+    std::vector<std::set<int> > sets(1);
+
+    unsigned rnd = 12345;
+    for (int step = 0; step < 20000; ++step)
+    {
+        rnd = rnd * 1103515245 + 12345;
+        std::size_t v = (rnd >> 8) % trees.size();
+        int key = static_cast<int>((rnd >> 16) % 500);
+
+        if (step % 500 == 0)
+        {
+            trees.push_back(trees[v]);
+            sets.push_back(sets[v]);
+        }
+        else if ((rnd >> 4) & 1)
+        {
+            EXPECT_EQ(sets[v].insert(key).second, trees[v].tryInsert(key));
+        }
+        else if (sets[v].erase(key))
+            trees[v].remove(key);
+        else
+            EXPECT_THROW(trees[v].remove(key), std::logic_error);
+    }
+
+    for (std::size_t v = 0; v < trees.size(); ++v)
+    {
+        EXPECT_EQ(std::vector<int>(sets[v].begin(), sets[v].end()), elements(trees[v]));
+        EXPECT_EQ(sets[v].size(), trees[v].getSize());
+        EXPECT_GE(checkRB(trees[v].getRoot(), false), 0);
+        if (trees[v].getRoot())
+        {
+            EXPECT_EQ(PersistentRBTreeInt::BLACK, trees[v].getRoot()->getColor());
+        }
+    }
+}
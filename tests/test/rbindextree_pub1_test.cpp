@@ -0,0 +1,157 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit tests for xi::RBIndexTree interfaces
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <cstring>          // std::memcpy
+#include <stdexcept>
+#include <vector>
+
+#include "rbindextree.h"
+
+
+using namespace xi;
+
+// Тестируем на целых числах.
+typedef RBIndexTree<int> RBIndexTreeInt;
+
+
+/** \brief Тестовый класс для открытых интерфейсов индексного КЧД. */
+class RBIndexTreePubTest : public ::testing::Test {
+public:
+    static const int STRUCT2_SEQ[];
+    static const int STRUCT2_SEQ_NUM;
+
+protected:
+    /** \brief Проверяет свойства КЧД поддерева \c nd и возвращает его черную высоту. */
+    int checkSubtree(const RBIndexTreeInt& tree, RBIndexTreeInt::Index nd)
+    {
+        if (nd == RBIndexTreeInt::NIL)
+            return 1;
+
+        RBIndexTreeInt::Index lf = tree.getLeft(nd);
+        RBIndexTreeInt::Index rg = tree.getRight(nd);
+
+        if (lf != RBIndexTreeInt::NIL)
+        {
+            EXPECT_EQ(nd, tree.getParent(lf));
+            EXPECT_LT(tree.getKey(lf), tree.getKey(nd));
+        }
+        if (rg != RBIndexTreeInt::NIL)
+        {
+            EXPECT_EQ(nd, tree.getParent(rg));
+            EXPECT_LT(tree.getKey(nd), tree.getKey(rg));
+        }
+        if (tree.getColor(nd) == RBIndexTreeInt::RED)
+        {
+            EXPECT_EQ(RBIndexTreeInt::BLACK, tree.getColor(lf));
+            EXPECT_EQ(RBIndexTreeInt::BLACK, tree.getColor(rg));
+        }
+
+        int lh = checkSubtree(tree, lf);
+        EXPECT_EQ(lh, checkSubtree(tree, rg));
+        return lh + (tree.getColor(nd) == RBIndexTreeInt::BLACK ? 1 : 0);
+    }
+}; // class RBIndexTreePubTest
+
+
+// Вынесенная инициализация массива
+const int RBIndexTreePubTest::STRUCT2_SEQ[] =
+{ 4, 50, 10, 40, 17, 35, 20, 27, 37, 45, 60, 21, 1, 30 };
+const int RBIndexTreePubTest::STRUCT2_SEQ_NUM = sizeof(STRUCT2_SEQ) / sizeof(STRUCT2_SEQ[0]);
+
+
+
+TEST_F(RBIndexTreePubTest, Simplest)
+{
+    RBIndexTreeInt tree;
+    EXPECT_TRUE(tree.isEmpty());
+    EXPECT_EQ(RBIndexTreeInt::NIL, tree.find(4));
+}
+
+
+// вставка, поиск и удаление с проверкой свойств КЧД на каждом шаге
+TEST_F(RBIndexTreePubTest, insertRemove1)
+{
+    RBIndexTreeInt tree;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+    {
+        tree.insert(STRUCT2_SEQ[i]);
+        checkSubtree(tree, tree.getRoot());
+    }
+
+    EXPECT_EQ((std::size_t)STRUCT2_SEQ_NUM, tree.getSize());
+    EXPECT_EQ(20, tree.getKey(tree.find(20)));
+    EXPECT_THROW(tree.insert(20), std::logic_error);
+
+    // индекс узла, который не удаляется, остается действительным
+    RBIndexTreeInt::Index n30 = tree.find(30);
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM - 1; ++i)
+    {
+        tree.remove(STRUCT2_SEQ[i]);
+        EXPECT_EQ(RBIndexTreeInt::NIL, tree.find(STRUCT2_SEQ[i]));
+        EXPECT_EQ(n30, tree.find(30));
+        checkSubtree(tree, tree.getRoot());
+    }
+
+    EXPECT_THROW(tree.remove(4), std::logic_error);
+
+    tree.remove(30);
+    EXPECT_TRUE(tree.isEmpty());
+}
+
+
+// освобожденные узлы переиспользуются
+TEST_F(RBIndexTreePubTest, freeList1)
+{
+    RBIndexTreeInt tree;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+
+    std::size_t num = tree.getNodesNum();
+    RBIndexTreeInt::Index n37 = tree.find(37);
+    tree.remove(37);
+
+    EXPECT_EQ(n37, tree.insert(38));
+    EXPECT_EQ(num, tree.getNodesNum());
+}
+
+
+// дерево восстанавливается из побайтовой копии массива узлов
+TEST_F(RBIndexTreePubTest, rawCopy1)
+{
+    RBIndexTreeInt tree;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+    tree.remove(17);
+
+    std::vector<RBIndexTreeInt::Node> image(tree.getNodesNum());
+    std::memcpy(image.data(), tree.getNodes(), image.size() * sizeof(RBIndexTreeInt::Node));
+
+    RBIndexTreeInt copy;
+    copy.assignNodes(image.data(), image.size(), tree.getRoot(), tree.getFreeHead(), tree.getSize());
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        EXPECT_EQ(tree.find(STRUCT2_SEQ[i]), copy.find(STRUCT2_SEQ[i]));
+
+    copy.insert(17);
+    checkSubtree(copy, copy.getRoot());
+}
@@ -37,13 +37,13 @@ namespace xi {
  *  ему классы КЧД представляют дружественные полномочия, поэтому он может смело
  *  покопаться во внутренностях этих классов.
  */
-template <typename Element, typename Compar = std::less<Element> >
+template <typename Element, typename Compar = std::less<Element>, typename Layout = LooseNodes>
 class RBTreeTest : public ::testing::Test {
 public:
     // Объявление типов дерева и узла для упрощения доступа
-    typedef RBTree<Element, Compar> TTree;
-    typedef typename RBTree<Element, Compar>::Node TTreeNode;
-    typedef typename RBTree<Element, Compar>::Color TTreeColor;
+    typedef RBTree<Element, Compar, std::allocator<Element>, NoAugment, Layout> TTree;
+    typedef typename TTree::Node TTreeNode;
+    typedef typename TTree::Color TTreeColor;
 
 public:
     static const int STRUCT2_SEQ[];
@@ -67,15 +67,16 @@ protected:
     }
 
 
-    /** \brief Создает узел без привязки к дереву */
+    /** \brief Создает в пуле дерева \c tree узел без привязки к самому дереву */
     typename TTreeNode* createNode(
+        TTree& tree,
         const Element& key = Element(),
         typename TTreeNode* left = nullptr,
         typename TTreeNode* right = nullptr,
         typename TTreeNode* parent = nullptr,
         typename TTreeColor col = TTree::BLACK)
     {
-        TTreeNode* newNode = new TTreeNode(key, left, right, parent, col);
+        TTreeNode* newNode = tree.createNode(key, left, right, parent, col);
 
         return newNode;
     }
@@ -108,9 +109,27 @@ protected:
     /** \brief Для данного узла возвращает его предка. */
     typename TTreeNode* getParentChild(TTreeNode* node)
     {
-        return node->_parent;
+        return node->parent();
     }
     
+    /** \brief Перепривязывает узел \c node к родителю \c par, не трогая его потомков. */
+    void setParentNode(TTreeNode* node, TTreeNode* par)
+    {
+        node->setParent(par);
+    }
+
+    /** \brief Красит узел \c node в цвет \c col. */
+    void setNodeColor(TTreeNode* node, TTreeColor col)
+    {
+        node->setColor(col);
+    }
+
+    /** \brief Устанавливает или снимает у узла \c node лишний черный. */
+    void setNodeExtraBlack(TTreeNode* node, bool on)
+    {
+        node->setExtraBlack(on);
+    }
+
     /** \brief Вставляет элемент \c el в BST без учета свойств КЧД. */
     typename TTreeNode* insertNewBstEl(TTree* tree, const Element& el)
     {
@@ -124,11 +143,11 @@ protected:
     {
         // создаем структуру с [Рисунка 1]
 
-        TTreeNode* n1 = createNode(1);
-        TTreeNode* n4 = createNode(4);
-        TTreeNode* n6 = createNode(6);
-        TTreeNode* n5 = createNode(5, n4, n6);
-        TTreeNode* n3 = createNode(3, n1, n5);
+        TTreeNode* n1 = createNode(tree, 1);
+        TTreeNode* n4 = createNode(tree, 4);
+        TTreeNode* n6 = createNode(tree, 6);
+        TTreeNode* n5 = createNode(tree, 5, n4, n6);
+        TTreeNode* n3 = createNode(tree, 3, n1, n5);
 
         // устанавливаем 3 как корень
         TTreeNode* & rt = getRootNode(&tree);
@@ -149,12 +168,12 @@ protected:
 
 
 // Вынесенная инициализация массива
-template <typename Element, typename Compar>
-const int RBTreeTest<Element, Compar>::STRUCT2_SEQ[] = 
+template <typename Element, typename Compar, typename Layout>
+const int RBTreeTest<Element, Compar, Layout>::STRUCT2_SEQ[] = 
     {  4, 50, 10, 40, 17, 35, 20, 27, 37, 45, 60, 21, 1, 30 };
 
-template <typename Element, typename Compar>
-const int RBTreeTest<Element, Compar>::STRUCT2_SEQ_NUM = sizeof(STRUCT2_SEQ) / sizeof(STRUCT2_SEQ[0]);
+template <typename Element, typename Compar, typename Layout>
+const int RBTreeTest<Element, Compar, Layout>::STRUCT2_SEQ_NUM = sizeof(STRUCT2_SEQ) / sizeof(STRUCT2_SEQ[0]);
 
 
 // Тестируем на целых числах.
@@ -163,6 +182,9 @@ typedef RBTree<int> RBTreeInt;
 // Конкретизация шаблонного класса для далеетестируемого целочисленного дерева
 typedef RBTreeTest<int> RBTreeIntTester;
 
+// То же в компактной раскладке узлов
+typedef RBTreeTest<int, std::less<int>, CompactNodes> RBTreeCompactTester;
+
 
 TEST_F(RBTreeIntTester, Simplest)
 {
@@ -179,7 +201,7 @@ TEST_F(RBTreeIntTester, AddRootManually)
 
     // берем ссылку на корень
     TTreeNode* & rt = getRootNode(&tree);
-    rt = createNode();
+    rt = createNode(tree);
     EXPECT_NE(nullptr, rt);
     EXPECT_FALSE(tree.isEmpty());           // теперь должен быть непустым!
 }
@@ -374,6 +396,78 @@ TEST_F(RBTreeIntTester, LeftRot2)
 
 
 
+// узел компактной раскладки меньше обычного: ключ и три связи без выравнивания под цвет
+TEST_F(RBTreeIntTester, CompactNodes1)
+{
+    typedef RBTree<int, std::less<int>, std::allocator<int>, NoAugment, CompactNodes> TCompactInt;
+    typedef RBTree<double, std::less<double>, std::allocator<double>, NoAugment, CompactNodes> TCompactDouble;
+
+    EXPECT_EQ(sizeof(int) + 3 * sizeof(void*), sizeof(TCompactInt::Node));
+    EXPECT_LT(sizeof(TCompactInt::Node), sizeof(RBTree<int>::Node));
+
+    EXPECT_EQ(sizeof(double) + 3 * sizeof(void*), sizeof(TCompactDouble::Node));
+    EXPECT_LT(sizeof(TCompactDouble::Node), sizeof(RBTree<double>::Node));
+}
+
+
+// цвет и флаги узлов компактной раскладки переживают смену родителя и повороты
+TEST_F(RBTreeCompactTester, CompactNodes2)
+{
+    // создаем структуру с [Рисунка 1]
+    TTree tree;
+    createStruct1(tree);
+
+    TTreeNode* & rt = getRootNode(&tree);
+    TTreeNode* n3 = rt;
+    TTreeNode* n1 = getLeftChild(n3);
+    TTreeNode* n5 = getRightChild(n3);
+    TTreeNode* n4 = getLeftChild(n5);
+    TTreeNode* n6 = getRightChild(n5);
+
+    setNodeColor(n5, TTree::RED);
+    setNodeColor(n1, TTree::RED);
+    setNodeExtraBlack(n6, true);
+
+    // перепривязка к тому же и к другому родителю не задевает цвет и флаги
+    setParentNode(n4, nullptr);
+    EXPECT_EQ(nullptr, n4->getParent());
+    EXPECT_TRUE(n4->isBlack());
+    setParentNode(n4, n5);
+    setParentNode(n1, n5);
+    EXPECT_EQ(n5, n1->getParent());
+    EXPECT_TRUE(n1->isRed());
+    setParentNode(n1, n3);
+    EXPECT_EQ(n3, n1->getParent());
+    EXPECT_TRUE(n1->isRed());
+
+    // повороты меняют родителей у n3, n4, n5, n6, но не их цвета
+    rotNodeLeft(&tree, n3);
+    EXPECT_EQ(n5, rt);
+    EXPECT_EQ(nullptr, n5->getParent());
+    EXPECT_EQ(n5, n3->getParent());
+    EXPECT_EQ(n3, n4->getParent());
+    EXPECT_TRUE(n5->isRed());
+    EXPECT_TRUE(n3->isBlack());
+    EXPECT_TRUE(n4->isBlack());
+    EXPECT_TRUE(n1->isRed());
+    EXPECT_TRUE(n6->isBlack());
+    EXPECT_TRUE(n6->hasExtraBlack());
+    EXPECT_FALSE(n5->hasExtraBlack());
+
+    rotNodeRight(&tree, n5);
+    EXPECT_EQ(n3, rt);
+    EXPECT_EQ(nullptr, n3->getParent());
+    EXPECT_EQ(n3, n5->getParent());
+    EXPECT_EQ(n5, n4->getParent());
+    EXPECT_EQ(n5, n6->getParent());
+    EXPECT_TRUE(n5->isRed());
+    EXPECT_TRUE(n3->isBlack());
+    EXPECT_TRUE(n1->isRed());
+    EXPECT_TRUE(n6->hasExtraBlack());
+    EXPECT_FALSE(n4->hasExtraBlack());
+}
+
+
 // внутренняя вставка элемента — добавление нода
 TEST_F(RBTreeIntTester, insertNewBstEl1)
 {
@@ -391,5 +485,21 @@ TEST_F(RBTreeIntTester, insertNewBstEl1)
 
 
 
+// освобожденный при удалении узел переиспользуется пулом при следующей вставке
+TEST_F(RBTreeIntTester, PoolRecycle1)
+{
+    RBTreeInt tree;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+
+    const TTreeNode* n30 = tree.find(30);       // лист, удаляется без копирования ключей
+    tree.remove(30);
+    tree.insert(31);
+
+    EXPECT_EQ(n30, tree.find(31));
+}
+
+
 
 } // namespace xi
\ No newline at end of file
@@ -19,6 +19,13 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 #include "rbtree.h"
 #include "def_dumper.h"
 #include "individual.h"
@@ -30,6 +37,195 @@ using namespace xi;
 typedef RBTree<int> RBTreeInt;
 
 
+/** \brief Минимальный аллокатор, подсчитывающий число живых блоков в общем счетчике. */
+template <typename T>
+struct CountingAlloc {
+    typedef T value_type;
+
+    explicit CountingAlloc(int* blocks) : _blocks(blocks) {}
+
+    template <typename U>
+    CountingAlloc(const CountingAlloc<U>& other) : _blocks(other._blocks) {}
+
+    T* allocate(std::size_t n)
+    {
+        ++*_blocks;
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        --*_blocks;
+        ::operator delete(p);
+    }
+
+    bool operator==(const CountingAlloc& other) const { return _blocks == other._blocks; }
+    bool operator!=(const CountingAlloc& other) const { return _blocks != other._blocks; }
+
+    int* _blocks;
+}; // struct CountingAlloc
+
+
+/** \brief Трехзначный компаратор строк, считающий свои вызовы. */
+struct CountingStrCompar {
+    typedef void is_three_way;
+
+    explicit CountingStrCompar(int* calls = nullptr) : _calls(calls) {}
+
+    int operator()(const std::string& a, const std::string& b) const
+    {
+        if (_calls)
+            ++*_calls;
+        return a.compare(b);
+    }
+
+    int* _calls;
+}; // struct CountingStrCompar
+
+
+/** \brief Компаратор целых "меньше", считающий свои вызовы. */
+struct CountingIntLess {
+    explicit CountingIntLess(int* calls = nullptr) : _calls(calls) {}
+
+    bool operator()(int a, int b) const
+    {
+        if (_calls)
+            ++*_calls;
+        return a < b;
+    }
+
+    int* _calls;
+}; // struct CountingIntLess
+
+
+/** \brief Прозрачный компаратор строк, сравнивающий их и с <tt>const char*</tt> без временных строк. */
+struct TransparentStrLess {
+    typedef void is_transparent;
+
+    explicit TransparentStrLess(int* cStrCalls = nullptr) : _cStrCalls(cStrCalls) {}
+
+    bool operator()(const std::string& a, const std::string& b) const { return a < b; }
+
+    bool operator()(const char* a, const std::string& b) const
+    {
+        countCStr();
+        return b.compare(a) > 0;
+    }
+
+    bool operator()(const std::string& a, const char* b) const
+    {
+        countCStr();
+        return a.compare(b) < 0;
+    }
+
+    void countCStr() const
+    {
+        if (_cStrCalls)
+            ++*_cStrCalls;
+    }
+
+    int* _cStrCalls;
+}; // struct TransparentStrLess
+
+
+/** \brief Элемент, считающий свои копирования в общем счетчике. */
+struct CopyCounted {
+    static int copies;
+
+    explicit CopyCounted(int v = 0) : value(v) {}
+    CopyCounted(const CopyCounted& other) : value(other.value) { ++copies; }
+    CopyCounted(CopyCounted&& other) : value(other.value) {}
+
+    CopyCounted& operator=(const CopyCounted& other)
+    {
+        value = other.value;
+        ++copies;
+        return *this;
+    }
+
+    CopyCounted& operator=(CopyCounted&& other)
+    {
+        value = other.value;
+        return *this;
+    }
+
+    bool operator<(const CopyCounted& other) const { return value < other.value; }
+
+    int value;
+}; // struct CopyCounted
+
+int CopyCounted::copies = 0;
+
+
+/** \brief Элемент, считающий живые экземпляры (в т. ч. из задач других потоков): ни один узел
+ *  не должен потеряться.
+ */
+struct LiveCounted {
+    static std::atomic<int> live;
+
+    explicit LiveCounted(int v = 0) : value(v) { ++live; }
+    LiveCounted(const LiveCounted& other) : value(other.value) { ++live; }
+    ~LiveCounted() { --live; }
+
+    LiveCounted& operator=(const LiveCounted& other)
+    {
+        value = other.value;
+        return *this;
+    }
+
+    bool operator<(const LiveCounted& other) const { return value < other.value; }
+
+    int value;
+}; // struct LiveCounted
+
+std::atomic<int> LiveCounted::live(0);
+
+
+/** \brief Компаратор "меньше", бросающий исключение, когда кончается бюджет вызовов.
+ *
+ *  Отрицательный бюджет не кончается никогда. Бюджет общий для всех копий и потоков.
+ */
+template <typename T>
+struct ThrowingLess {
+    explicit ThrowingLess(std::atomic<int>* budget) : _budget(budget) {}
+
+    bool operator()(const T& a, const T& b) const
+    {
+        if ((*_budget)-- == 0)
+            throw std::runtime_error("Comparator failed");
+        return a < b;
+    }
+
+    std::atomic<int>* _budget;
+}; // struct ThrowingLess
+
+
+/** \brief Политика аугментации: сумма элементов поддерева. */
+struct SumAugment {
+    typedef long long value_type;
+
+    static value_type identity() { return 0; }
+    static value_type fromElement(int e) { return e; }
+    static value_type combine(value_type a, value_type b) { return a + b; }
+}; // struct SumAugment
+
+
+/** \brief Некоммутативная политика аугментации: элементы поддерева через пробел по порядку. */
+struct ConcatAugment {
+    typedef std::string value_type;
+
+    static value_type identity() { return std::string(); }
+    static value_type fromElement(int e) { return std::to_string(e); }
+
+    static value_type combine(const value_type& a, const value_type& b)
+    {
+        if (a.empty() || b.empty())
+            return a + b;
+        return a + " " + b;
+    }
+}; // struct ConcatAugment
+
+
 /** \brief Тестовый класс для тестирования открытых интерфейсов классов КЧД в виде черного ящика. */
 class RBTreePubTest : public ::testing::Test {
 public:
@@ -43,6 +239,39 @@ public:
     static const int STRUCT2_SEQ_NUM;
 
 
+protected:
+    /** \brief Проверяет свойства КЧД поддерева \c nd и возвращает его черную высоту. В дереве
+     *  с ослабленной балансировкой (\c relaxed) красный под красным допустим, а лишний черный
+     *  входит в высоту.
+     */
+    template <typename TNode>
+    int checkSubtree(const TNode* nd, bool relaxed = false)
+    {
+        if (!nd)
+            return 1;
+
+        if (nd->getLeft())
+        {
+            EXPECT_EQ(nd, nd->getLeft()->getParent());
+            EXPECT_LT(nd->getLeft()->getKey(), nd->getKey());
+        }
+        if (nd->getRight())
+        {
+            EXPECT_EQ(nd, nd->getRight()->getParent());
+            EXPECT_LT(nd->getKey(), nd->getRight()->getKey());
+        }
+        if (nd->isRed() && !relaxed)
+        {
+            EXPECT_TRUE(!nd->getLeft() || nd->getLeft()->isBlack());
+            EXPECT_TRUE(!nd->getRight() || nd->getRight()->isBlack());
+        }
+        EXPECT_TRUE(!nd->hasExtraBlack() || (relaxed && nd->isBlack()));
+
+        int lh = checkSubtree(nd->getLeft(), relaxed);
+        EXPECT_EQ(lh, checkSubtree(nd->getRight(), relaxed));
+        return lh + (nd->isBlack() ? 1 : 0) + (nd->hasExtraBlack() ? 1 : 0);
+    }
+
 protected:
     RBTreeDefDumper<int, std::less<int>> _dumper;
 
@@ -114,6 +343,29 @@ TEST_F(RBTreePubTest, find1)
     EXPECT_EQ(nullptr, n100);
 }
 
+// вставка без исключений на дубликатах
+TEST_F(RBTreePubTest, tryInsert1)
+{
+    RBTreeInt tree;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+    {
+        std::pair<const RBTreeInt::Node*, bool> res = tree.tryInsert(STRUCT2_SEQ[i]);
+        EXPECT_TRUE(res.second);
+        EXPECT_EQ(STRUCT2_SEQ[i], res.first->getKey());
+    }
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+    {
+        std::pair<const RBTreeInt::Node*, bool> res = tree.tryInsert(STRUCT2_SEQ[i]);
+        EXPECT_FALSE(res.second);
+        EXPECT_EQ(tree.find(STRUCT2_SEQ[i]), res.first);
+    }
+
+    EXPECT_THROW(tree.insert(STRUCT2_SEQ[0]), std::logic_error);
+}
+
+
 // поиск элемента
 TEST_F(RBTreePubTest, find2)
 {
@@ -128,6 +380,202 @@ TEST_F(RBTreePubTest, find2)
 }
 
 
+// порядок задается компаратором дерева, а не операторами сравнения элементов
+TEST_F(RBTreePubTest, compar1)
+{
+    RBTree<int, std::greater<int> > tree;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+
+    // самый большой элемент — крайний левый
+    const RBTree<int, std::greater<int> >::Node* nd = tree.getRoot();
+    while (nd->getLeft())
+        nd = nd->getLeft();
+    EXPECT_EQ(60, nd->getKey());
+
+    EXPECT_EQ(35, tree.find(35)->getKey());
+    EXPECT_EQ(nullptr, tree.find(36));
+}
+
+
+// трехзначный компаратор вызывается не чаще одного раза на уровень спуска
+TEST_F(RBTreePubTest, threeWayCompar1)
+{
+    int calls = 0;
+    RBTree<std::string, CountingStrCompar> tree((CountingStrCompar(&calls)));
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(std::to_string(STRUCT2_SEQ[i]));
+
+    // высота КЧД из 14 узлов не больше 2 * log2(15) < 8
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+    {
+        calls = 0;
+        EXPECT_EQ(std::to_string(STRUCT2_SEQ[i]), tree.find(std::to_string(STRUCT2_SEQ[i]))->getKey());
+        EXPECT_GE(8, calls);
+    }
+
+    EXPECT_EQ(nullptr, tree.find("36"));
+    EXPECT_FALSE(tree.tryInsert("35").second);
+}
+
+
+// узлы берутся у пользовательского аллокатора и все возвращаются ему при разрушении дерева
+TEST_F(RBTreePubTest, allocator1)
+{
+    int blocks = 0;
+    {
+        RBTree<int, std::less<int>, CountingAlloc<int> > tree((CountingAlloc<int>(&blocks)));
+
+        for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+            tree.insert(STRUCT2_SEQ[i]);
+
+        EXPECT_LT(0, blocks);
+        EXPECT_EQ(30, tree.find(30)->getKey());
+    }
+
+    EXPECT_EQ(0, blocks);
+}
+
+
+// нижняя и верхняя границы и диапазоны
+TEST_F(RBTreePubTest, bounds1)
+{
+    RBTreeInt tree;
+    EXPECT_TRUE(tree.lowerBound(10) == tree.end());
+    EXPECT_TRUE(tree.range(1, 100).isEmpty());
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+
+    EXPECT_EQ(35, *tree.lowerBound(35));
+    EXPECT_EQ(37, *tree.upperBound(35));
+    EXPECT_EQ(37, *tree.lowerBound(36));
+    EXPECT_EQ(1, *tree.lowerBound(-5));
+    EXPECT_TRUE(tree.lowerBound(61) == tree.end());
+    EXPECT_TRUE(tree.upperBound(60) == tree.end());
+
+    std::pair<RBTreeInt::ConstIterator, RBTreeInt::ConstIterator> eq = tree.equalRange(40);
+    EXPECT_EQ(40, *eq.first);
+    EXPECT_EQ(45, *eq.second);
+    eq = tree.equalRange(41);
+    EXPECT_TRUE(eq.first == eq.second);
+
+    // [17, 37) = 17 20 21 27 30 35
+    const int expected[] = { 17, 20, 21, 27, 30, 35 };
+    std::vector<int> got;
+    RBTreeInt::Range rg = tree.range(17, 37);
+    for (RBTreeInt::ConstIterator it = rg.begin(); it != rg.end(); ++it)
+        got.push_back(*it);
+    EXPECT_EQ(std::vector<int>(expected, expected + 6), got);
+
+    EXPECT_TRUE(tree.range(37, 17).isEmpty());
+    EXPECT_TRUE(tree.range(22, 27).isEmpty());
+}
+
+
+// границы по const char* через прозрачный компаратор
+TEST_F(RBTreePubTest, transparentBounds1)
+{
+    RBTree<std::string, TransparentStrLess> tree;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(std::to_string(STRUCT2_SEQ[i]));
+
+    // строки упорядочены лексикографически: ... 35 37 4 40 ...
+    EXPECT_EQ("37", *tree.upperBound("35"));
+    EXPECT_EQ("4", *tree.lowerBound("38"));
+    EXPECT_EQ(2, std::distance(tree.range("35", "4").begin(), tree.range("35", "4").end()));
+}
+
+
+// пакетная вставка: статусы в исходном порядке, повторы в пакете и в дереве
+TEST_F(RBTreePubTest, insertBatch1)
+{
+    RBTreeInt tree;
+    const int first[] = { 30, 10, 20, 10, 40 };
+    std::vector<bool> res = tree.insertBatch(first, first + 5);
+    const bool firstExpected[] = { true, true, true, false, true };
+    EXPECT_EQ(std::vector<bool>(firstExpected, firstExpected + 5), res);
+    checkSubtree(tree.getRoot());
+
+    const int second[] = { 25, 40, 5, 25, 45, 10, 35 };
+    res = tree.insertBatch(second, second + 7);
+    const bool secondExpected[] = { true, false, true, false, true, false, true };
+    EXPECT_EQ(std::vector<bool>(secondExpected, secondExpected + 7), res);
+    checkSubtree(tree.getRoot());
+
+    const int all[] = { 5, 10, 20, 25, 30, 35, 40, 45 };
+    EXPECT_TRUE(std::equal(all, all + 8, tree.begin()));
+    EXPECT_EQ(8, std::distance(tree.begin(), tree.end()));
+    EXPECT_TRUE(tree.insertBatch(all, all).empty());
+}
+
+
+// упорядоченный пакет вставляется за гораздо меньшее число сравнений, чем поштучно:
+// соизмеримый с деревом — слиянием, небольшой плотный — "с пальцем"
+TEST_F(RBTreePubTest, insertBatch2)
+{
+    int batchCalls = 0;
+    int singleCalls = 0;
+    RBTree<int, CountingIntLess> batched((CountingIntLess(&batchCalls)));
+    RBTree<int, CountingIntLess> single((CountingIntLess(&singleCalls)));
+
+    std::vector<int> keys;
+    for (int i = 0; i < 2000; i += 2)
+        keys.push_back(i);
+    batched.insertBatch(keys.begin(), keys.end());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        single.insert(keys[i]);
+
+    for (int round = 0; round < 2; ++round)
+    {
+        // первый раунд: 1000 нечетных ключей в дерево из 1000; второй: 100 ключей в дерево из 2000
+        keys.clear();
+        for (int i = (round == 0 ? 1 : 3000); i < (round == 0 ? 2000 : 3100); i += (round == 0 ? 2 : 1))
+            keys.push_back(i);
+
+        batchCalls = singleCalls = 0;
+        std::vector<bool> res = batched.insertBatch(keys.begin(), keys.end());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            single.insert(keys[i]);
+
+        EXPECT_EQ(keys.size(), (std::size_t)std::count(res.begin(), res.end(), true));
+        EXPECT_LT(batchCalls * 2, singleCalls);
+    }
+
+    EXPECT_TRUE(std::equal(single.begin(), single.end(), batched.begin()));
+    EXPECT_EQ(std::distance(single.begin(), single.end()), std::distance(batched.begin(), batched.end()));
+}
+
+
+// параллельная сборка из неупорядоченного входа с повторами
+TEST_F(RBTreePubTest, buildUnsorted1)
+{
+    std::vector<int> keys;
+    for (int i = 0; i < 100000; ++i)
+        keys.push_back((i * 7919) % 50000);         // каждое значение из [0, 50000) дважды
+
+    for (unsigned threads = 1; threads <= 4; threads += 3)
+    {
+        RBTreeInt tree;
+        tree.insert(-5);                            // прежнее содержимое заменяется
+        tree.buildFromUnsorted(keys.begin(), keys.end(), threads);
+
+        EXPECT_EQ(50000, std::distance(tree.begin(), tree.end()));
+        EXPECT_EQ(0, *tree.begin());
+        EXPECT_EQ(49999, *tree.rbegin());
+        EXPECT_TRUE(std::is_sorted(tree.begin(), tree.end()));
+        EXPECT_EQ(nullptr, tree.find(-5));
+        checkSubtree(tree.getRoot());
+
+        tree.buildFromUnsorted(keys.end(), keys.end(), threads);
+        EXPECT_TRUE(tree.isEmpty());
+    }
+}
+
+
 #ifdef RBTREE_WITH_DELETION
 
 // удаление нод
@@ -151,4 +599,686 @@ TEST_F(RBTreePubTest, delete1)
        tree.remove(STRUCT2_SEQ[i]);
 
 }
-#endif // RBTREE_WITH_DELETION
\ No newline at end of file
+
+
+// поиск и удаление строк по const char* через прозрачный компаратор
+TEST_F(RBTreePubTest, transparentFind1)
+{
+    int cStrCalls = 0;
+    RBTree<std::string, TransparentStrLess> tree((TransparentStrLess(&cStrCalls)));
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(std::to_string(STRUCT2_SEQ[i]));
+
+    EXPECT_EQ("35", tree.find("35")->getKey());
+    EXPECT_EQ(nullptr, tree.find("36"));
+    EXPECT_LT(0, cStrCalls);
+
+    tree.remove("35");
+    EXPECT_EQ(nullptr, tree.find("35"));
+    EXPECT_THROW(tree.remove("35"), std::logic_error);
+}
+
+
+// вставка перемещением и конструированием на месте не копирует элементы
+TEST_F(RBTreePubTest, emplace1)
+{
+    RBTree<CopyCounted> tree;
+    CopyCounted::copies = 0;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; i += 2)
+        EXPECT_TRUE(tree.emplace(STRUCT2_SEQ[i]).second);
+
+    for (int i = 1; i < STRUCT2_SEQ_NUM; i += 2)
+        tree.insert(CopyCounted(STRUCT2_SEQ[i]));
+
+    // дубликат не вставляется, а найденный узел возвращается
+    std::pair<const RBTree<CopyCounted>::Node*, bool> res = tree.emplace(35);
+    EXPECT_FALSE(res.second);
+    EXPECT_EQ(35, res.first->getKey().value);
+    EXPECT_THROW(tree.insert(CopyCounted(35)), std::logic_error);
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.remove(CopyCounted(STRUCT2_SEQ[i]));
+
+    EXPECT_TRUE(tree.isEmpty());
+    EXPECT_EQ(0, CopyCounted::copies);
+}
+
+
+// узел, построенный на месте, разрушается, если компаратор бросит исключение при спуске
+TEST_F(RBTreePubTest, emplaceThrow1)
+{
+    std::atomic<int> budget(-1);
+    {
+        RBTree<LiveCounted, ThrowingLess<LiveCounted> > tree((ThrowingLess<LiveCounted>(&budget)));
+        for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+            tree.emplace(STRUCT2_SEQ[i]);
+
+        const int live = LiveCounted::live;
+        budget = 2;
+        EXPECT_THROW(tree.emplace(1000), std::runtime_error);
+        budget = -1;
+
+        EXPECT_EQ(live, LiveCounted::live.load());
+        EXPECT_TRUE(tree.find(LiveCounted(1000)) == nullptr);
+    }
+    EXPECT_EQ(0, LiveCounted::live.load());
+}
+
+
+// удаление не трогает остальные узлы: ранее найденные указатели на них остаются в силе
+TEST_F(RBTreePubTest, delete2)
+{
+    RBTreeInt tree;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+
+    const RBTreeInt::Node* nodes[STRUCT2_SEQ_NUM];
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        nodes[i] = tree.find(STRUCT2_SEQ[i]);
+
+    // начинаем с корня: у него двое детей
+    int order[STRUCT2_SEQ_NUM];
+    order[0] = 6;                           // 20
+    for (int i = 1, j = 0; i < STRUCT2_SEQ_NUM; ++j)
+        if (j != 6)
+            order[i++] = j;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+    {
+        tree.remove(STRUCT2_SEQ[order[i]]);
+
+        for (int j = i + 1; j < STRUCT2_SEQ_NUM; ++j)
+        {
+            EXPECT_EQ(nodes[order[j]], tree.find(STRUCT2_SEQ[order[j]]));
+            EXPECT_EQ(STRUCT2_SEQ[order[j]], nodes[order[j]]->getKey());
+        }
+    }
+
+    EXPECT_TRUE(tree.isEmpty());
+}
+
+
+// обход итераторами в прямом и обратном порядке
+TEST_F(RBTreePubTest, iterate1)
+{
+    RBTreeInt tree;
+    EXPECT_TRUE(tree.begin() == tree.end());
+    EXPECT_TRUE(tree.rbegin() == tree.rend());
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+
+    std::vector<int> sorted(STRUCT2_SEQ, STRUCT2_SEQ + STRUCT2_SEQ_NUM);
+    std::sort(sorted.begin(), sorted.end());
+
+    EXPECT_TRUE(std::equal(sorted.begin(), sorted.end(), tree.begin()));
+    EXPECT_TRUE(std::equal(sorted.rbegin(), sorted.rend(), tree.rbegin()));
+    EXPECT_EQ(STRUCT2_SEQ_NUM, std::distance(tree.begin(), tree.end()));
+
+    // крайние элементы после удаления минимума и максимума
+    tree.remove(1);
+    tree.remove(60);
+    EXPECT_EQ(4, *tree.begin());
+    EXPECT_EQ(50, *tree.rbegin());
+    EXPECT_EQ(50, *--tree.end());
+
+    // шаг от найденного узла
+    RBTreeInt::ConstIterator it = tree.makeIterator(tree.find(35));
+    EXPECT_EQ(37, *++it);
+    EXPECT_EQ(30, *----it);
+}
+
+
+// порядковые статистики поддерживаются вставками, удалениями и поворотами
+TEST_F(RBTreePubTest, orderStat1)
+{
+    typedef RBTree<int, std::less<int>, std::allocator<int>, OrderStatAugment> RBTreeOS;
+    RBTreeOS tree;
+    EXPECT_EQ(0u, tree.getSize());
+    EXPECT_TRUE(tree.select(0) == tree.end());
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+
+    std::vector<int> sorted(STRUCT2_SEQ, STRUCT2_SEQ + STRUCT2_SEQ_NUM);
+    std::sort(sorted.begin(), sorted.end());
+
+    EXPECT_EQ(sorted.size(), tree.getSize());
+    for (std::size_t k = 0; k < sorted.size(); ++k)
+    {
+        EXPECT_EQ(sorted[k], *tree.select(k));
+        EXPECT_EQ(k, tree.rank(sorted[k]));
+    }
+    EXPECT_TRUE(tree.select(sorted.size()) == tree.end());
+
+    // [17, 37) = 17 20 21 27 30 35
+    EXPECT_EQ(6u, tree.countInRange(17, 37));
+    EXPECT_EQ(0u, tree.countInRange(37, 17));
+    EXPECT_EQ(2u, tree.rank(5));
+
+    // удаляем узлы с двумя детьми и листья
+    tree.remove(40);
+    tree.remove(1);
+    tree.remove(20);
+    sorted.erase(std::remove(sorted.begin(), sorted.end(), 40), sorted.end());
+    sorted.erase(sorted.begin());
+    sorted.erase(std::remove(sorted.begin(), sorted.end(), 20), sorted.end());
+
+    EXPECT_EQ(sorted.size(), tree.getRoot()->getAugment());
+    for (std::size_t k = 0; k < sorted.size(); ++k)
+        EXPECT_EQ(sorted[k], *tree.select(k));
+}
+
+
+// агрегаты по диапазонам с пользовательскими политиками
+TEST_F(RBTreePubTest, aggregate1)
+{
+    typedef RBTree<int, std::less<int>, std::allocator<int>, SumAugment> RBTreeSum;
+    RBTreeSum sums;
+    RBTree<int, std::less<int>, std::allocator<int>, ConcatAugment> cats;
+    EXPECT_EQ(0, sums.aggregate(0, 100));
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+    {
+        sums.insert(STRUCT2_SEQ[i]);
+        cats.insert(STRUCT2_SEQ[i]);
+    }
+    sums.remove(40);
+    cats.remove(40);
+
+    // все пары границ против прямого обхода
+    for (int lo = 0; lo <= 61; ++lo)
+        for (int hi = 0; hi <= 61; ++hi)
+        {
+            long long expected = 0;
+            for (RBTreeSum::ConstIterator it = sums.lowerBound(lo); lo < hi && it != sums.end() && *it < hi; ++it)
+                expected += *it;
+            EXPECT_EQ(expected, sums.aggregate(lo, hi));
+        }
+
+    EXPECT_EQ("17 20 21 27 30 35", cats.aggregate(17, 37));
+    EXPECT_EQ("1 4 10 17 20 21 27 30 35 37 45 50 60", cats.getRoot()->getAugment());
+    EXPECT_EQ("", cats.aggregate(22, 27));
+}
+
+
+// построение из упорядоченной последовательности за линейное время
+TEST_F(RBTreePubTest, buildSorted1)
+{
+    for (int n = 0; n <= 70; ++n)
+    {
+        std::vector<int> keys;
+        for (int i = 0; i < n; ++i)
+            keys.push_back(i * 2);
+
+        RBTreeInt tree(keys.begin(), keys.end());
+        if (n > 0)
+        {
+            EXPECT_TRUE(tree.getRoot()->isBlack());
+        }
+        checkSubtree(tree.getRoot());
+        EXPECT_TRUE(std::equal(keys.begin(), keys.end(), tree.begin()));
+        EXPECT_EQ(n, std::distance(tree.begin(), tree.end()));
+
+        // после построения дерево — обычное КЧД
+        tree.insert(-1);
+        tree.insert(2 * n + 1);
+        if (n > 2)
+            tree.remove(2);
+        checkSubtree(tree.getRoot());
+    }
+
+    // построение заменяет содержимое; неупорядоченный вход оставляет дерево пустым
+    RBTreeInt tree;
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+
+    const int unsorted[] = { 1, 2, 3, 5, 4, 6 };
+    EXPECT_THROW(tree.buildFromSorted(unsorted, unsorted + 6), std::invalid_argument);
+    EXPECT_TRUE(tree.isEmpty());
+
+    const int dups[] = { 1, 2, 2, 3 };
+    EXPECT_THROW(tree.buildFromSorted(dups, dups + 4), std::invalid_argument);
+    EXPECT_TRUE(tree.isEmpty());
+
+    tree.buildFromSorted(unsorted, unsorted + 3);
+    EXPECT_EQ(3, std::distance(tree.begin(), tree.end()));
+    EXPECT_EQ(1, *tree.begin());
+    EXPECT_EQ(3, *tree.rbegin());
+}
+
+
+// разрезание и соединение: части остаются КЧД, а узлы переходят между деревьями без копирования
+TEST_F(RBTreePubTest, joinSplit1)
+{
+    RBTreeInt tree;
+    for (int i = 0; i < 200; ++i)
+        tree.insert(i * 2);
+    const RBTreeInt::Node* n150 = tree.find(150);
+
+    RBTreeInt greater;
+    greater.insert(-1);                             // прежнее содержимое заменяется
+    EXPECT_TRUE(tree.split(100, greater));
+
+    EXPECT_EQ(50, std::distance(tree.begin(), tree.end()));
+    EXPECT_EQ(149, std::distance(greater.begin(), greater.end()));
+    EXPECT_EQ(98, *tree.rbegin());
+    EXPECT_EQ(102, *greater.begin());
+    EXPECT_EQ(n150, greater.find(150));
+    EXPECT_TRUE(tree.getRoot()->isBlack() && greater.getRoot()->isBlack());
+    checkSubtree(tree.getRoot());
+    checkSubtree(greater.getRoot());
+
+    EXPECT_THROW(tree.join(50, greater), std::invalid_argument);
+    EXPECT_THROW(tree.join(tree), std::invalid_argument);
+
+    tree.join(100, greater);
+    EXPECT_TRUE(greater.isEmpty());
+    EXPECT_EQ(n150, tree.find(150));
+    checkSubtree(tree.getRoot());
+
+    // соединение без разделителя с маленьким деревом и разрезание по отсутствующему ключу
+    RBTreeInt tail;
+    for (int i = 0; i < 5; ++i)
+        tail.insert(1000 + i);
+    tree.join(tail);
+    EXPECT_EQ(205, std::distance(tree.begin(), tree.end()));
+    EXPECT_EQ(1004, *tree.rbegin());
+    checkSubtree(tree.getRoot());
+
+    EXPECT_FALSE(tree.split(101, greater));
+    EXPECT_EQ(51, std::distance(tree.begin(), tree.end()));
+    EXPECT_EQ(154, std::distance(greater.begin(), greater.end()));
+
+    // части живут независимо, в том числе в общем пуле
+    tree.insert(99);
+    greater.remove(1000);
+    checkSubtree(tree.getRoot());
+    checkSubtree(greater.getRoot());
+
+    // узлы могут переходить только между деревьями с равными аллокаторами
+    int blocks1 = 0, blocks2 = 0;
+    {
+        RBTree<int, std::less<int>, CountingAlloc<int> > a((CountingAlloc<int>(&blocks1)));
+        RBTree<int, std::less<int>, CountingAlloc<int> > b((CountingAlloc<int>(&blocks2)));
+        a.insert(1);
+        b.insert(3);
+        EXPECT_THROW(a.join(2, b), std::invalid_argument);
+    }
+    EXPECT_EQ(0, blocks1);
+    EXPECT_EQ(0, blocks2);
+}
+
+
+// объединение, пересечение и разность — последовательно и с ветвлением на потоки
+TEST_F(RBTreePubTest, setOps1)
+{
+    for (unsigned threads = 1; threads <= 4; threads += 3)
+    {
+        // a: кратные 2, b: кратные 3 из [0, 6000)
+        RBTreeInt a, b, c, d;
+        for (int i = 0; i < 6000; ++i)
+        {
+            if (i % 2 == 0)
+            {
+                a.insert(i);
+                c.insert(i);
+            }
+            if (i % 3 == 0)
+            {
+                b.insert(i);
+                d.insert(i);
+            }
+        }
+        const RBTreeInt::Node* n6 = a.find(6);
+
+        a.unite(b, threads);
+        EXPECT_TRUE(b.isEmpty());
+        EXPECT_EQ(4000, std::distance(a.begin(), a.end()));
+        EXPECT_EQ(n6, a.find(6));                   // из эквивалентных остается узел этого дерева
+        EXPECT_EQ(5998, *a.rbegin());
+        checkSubtree(a.getRoot());
+
+        RBTreeInt a2(a.begin(), a.end());
+        a2.subtract(c, threads);                    // остаются нечетные кратные 3
+        EXPECT_EQ(1000, std::distance(a2.begin(), a2.end()));
+        EXPECT_EQ(3, *a2.begin());
+        checkSubtree(a2.getRoot());
+
+        a.intersect(d, threads);                    // кратные 3
+        EXPECT_EQ(2000, std::distance(a.begin(), a.end()));
+        EXPECT_EQ(nullptr, a.find(4));
+        EXPECT_NE(nullptr, a.find(9));
+        checkSubtree(a.getRoot());
+
+        a.intersect(b, threads);                    // с пустым
+        EXPECT_TRUE(a.isEmpty());
+        EXPECT_THROW(a2.unite(a2), std::invalid_argument);
+    }
+}
+
+
+// операция над множествами, прерванная исключением компаратора, оставляет правильное дерево
+// между точным результатом и исходным деревом (для объединения — между исходным и результатом),
+// узлы other при этом не теряются
+TEST_F(RBTreePubTest, setOpsThrow1)
+{
+    typedef RBTree<LiveCounted, ThrowingLess<LiveCounted> > TTree;
+    const int N = 6000;
+    std::atomic<int> budget(-1);
+
+    for (int op = 0; op < 3; ++op)
+    {
+        for (unsigned threads = 1; threads <= 4; threads += 3)
+        {
+            bool threw = true;
+            for (int fail = 0; threw; fail += 499)
+            {
+                // a: кратные 2, b: кратные 3
+                TTree a((ThrowingLess<LiveCounted>(&budget))), b((ThrowingLess<LiveCounted>(&budget)));
+                std::set<int> both, onlyA, onlyB;
+                for (int i = 0; i < N; ++i)
+                {
+                    if (i % 2 == 0)
+                        a.insert(LiveCounted(i));
+                    if (i % 3 == 0)
+                        b.insert(LiveCounted(i));
+                    if (i % 6 == 0)
+                        both.insert(i);
+                    else if (i % 2 == 0)
+                        onlyA.insert(i);
+                    else if (i % 3 == 0)
+                        onlyB.insert(i);
+                }
+
+                // нижняя граница — то, что операция не убирает, верхняя — то, что может добавить
+                std::set<int> lower = op == 1 ? both : onlyA;
+                std::set<int> upper = both;
+                upper.insert(onlyA.begin(), onlyA.end());
+                if (op == 0)
+                {
+                    lower.insert(both.begin(), both.end());
+                    upper.insert(onlyB.begin(), onlyB.end());
+                }
+
+                budget = fail;
+                threw = false;
+                try
+                {
+                    if (op == 0)
+                        a.unite(b, threads);
+                    else if (op == 1)
+                        a.intersect(b, threads);
+                    else
+                        a.subtract(b, threads);
+                }
+                catch (const std::runtime_error&)
+                {
+                    threw = true;
+                }
+                budget = -1;
+
+                EXPECT_TRUE(b.isEmpty());
+                checkSubtree(a.getRoot());
+
+                std::set<int> got;
+                for (TTree::ConstIterator it = a.begin(); it != a.end(); ++it)
+                    got.insert(it->value);
+                EXPECT_TRUE(std::includes(got.begin(), got.end(), lower.begin(), lower.end()));
+                EXPECT_TRUE(std::includes(upper.begin(), upper.end(), got.begin(), got.end()));
+                if (!threw)
+                {
+                    EXPECT_EQ(op == 0 ? upper : lower, got);
+                }
+
+                // крайние узлы пересчитаны и после исключения
+                ASSERT_FALSE(got.empty());
+                EXPECT_EQ(*got.begin(), a.begin()->value);
+                EXPECT_EQ(*got.rbegin(), (*a.rbegin()).value);
+            }
+        }
+    }
+    EXPECT_EQ(0, LiveCounted::live.load());
+}
+
+
+// многократные удаления и вставки одних и тех же ключей
+TEST_F(RBTreePubTest, churn1)
+{
+    RBTreeInt tree;
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insert(STRUCT2_SEQ[i]);
+
+    for (int round = 0; round < 100; ++round)
+    {
+        for (int i = 0; i < STRUCT2_SEQ_NUM; i += 2)
+            tree.remove(STRUCT2_SEQ[i]);
+
+        for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+            EXPECT_EQ(i % 2 != 0, tree.find(STRUCT2_SEQ[i]) != nullptr);
+
+        for (int i = 0; i < STRUCT2_SEQ_NUM; i += 2)
+            tree.insert(STRUCT2_SEQ[i]);
+    }
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.remove(STRUCT2_SEQ[i]);
+
+    EXPECT_TRUE(tree.isEmpty());
+}
+
+
+// ослабленная балансировка: вставки и удаления откладывают повороты, а разбор порциями чинит дерево
+TEST_F(RBTreePubTest, relaxed1)
+{
+    RBTreeInt tree;
+    tree.setRelaxed(true);
+    EXPECT_TRUE(tree.isRelaxed());
+
+    // возрастающая серия без балансировки вытягивается в цепочку красных
+    for (int i = 0; i < 1000; ++i)
+        tree.insert(i);
+    EXPECT_GT(tree.getPendingCount(), 0u);
+    EXPECT_NE(nullptr, tree.find(500));
+    EXPECT_EQ(1000, std::distance(tree.begin(), tree.end()));
+
+    // каждая порция оставляет дерево деревом поиска с одинаковой черной высотой, а очередь
+    // становится короче не больше чем на бюджет
+    std::size_t left = tree.getPendingCount();
+    while (left)
+    {
+        std::size_t next = tree.rebalancePending(16);
+        EXPECT_GE(next + 16, left);
+        EXPECT_TRUE(tree.getRoot()->isBlack());
+        checkSubtree(tree.getRoot(), true);
+        left = next;
+    }
+    checkSubtree(tree.getRoot());
+
+    // удаление тоже откладывает починку и очередь целиком не разбирает
+    for (int i = 0; i < 2000; ++i)
+        tree.tryInsert((i * 7919) % 3000);
+    std::size_t pending = tree.getPendingCount();
+    EXPECT_GT(pending, 0u);
+    tree.remove(tree.getRoot()->getKey());
+    EXPECT_GE(tree.getPendingCount(), pending);
+
+    for (int i = 0; i < 3000; i += 3)
+    {
+        if (tree.find(i))
+            tree.remove(i);
+        if (i % 64 == 0)
+            checkSubtree(tree.getRoot(), true);
+    }
+    EXPECT_GT(tree.getPendingCount(), 0u);
+    checkSubtree(tree.getRoot(), true);
+    EXPECT_TRUE(std::is_sorted(tree.begin(), tree.end()));
+    EXPECT_EQ(nullptr, tree.find(3));
+    EXPECT_NE(nullptr, tree.find(4));
+
+    tree.insert(-1);
+    tree.insert(-2);
+    tree.insert(-3);
+    tree.setRelaxed(false);
+    EXPECT_EQ(0u, tree.getPendingCount());
+    checkSubtree(tree.getRoot());
+    EXPECT_TRUE(std::is_sorted(tree.begin(), tree.end()));
+}
+
+
+// ослабленная балансировка: случайные вставки и удаления сверяются с std::set
+TEST_F(RBTreePubTest, relaxed2)
+{
+    RBTreeInt tree;
+    std::set<int> ref;
+    for (int i = 0; i < 512; i += 2)
+    {
+        tree.insert(i);
+        ref.insert(i);
+    }
+
+    tree.setRelaxed(true);
+    unsigned seed = 17;
+    for (int round = 0; round < 40; ++round)
+    {
+        for (int j = 0; j < 50; ++j)
+        {
+            seed = seed * 1103515245 + 12345;
+            int key = (seed >> 8) % 512;
+            if (ref.erase(key))
+                tree.remove(key);
+            else
+            {
+                tree.insert(key);
+                ref.insert(key);
+            }
+        }
+        checkSubtree(tree.getRoot(), true);
+        tree.rebalancePending(round % 8);
+    }
+    EXPECT_TRUE(std::equal(ref.begin(), ref.end(), tree.begin()));
+    EXPECT_EQ(ref.size(), static_cast<std::size_t>(std::distance(tree.begin(), tree.end())));
+
+    // узлы, удаленные с записью в очереди, разрушает разбор очереди или очистка дерева
+    tree.clear();
+    EXPECT_EQ(0u, tree.getPendingCount());
+    tree.insert(1);
+    tree.setRelaxed(false);
+    checkSubtree(tree.getRoot());
+}
+
+
+// компактная раскладка узлов: то же поведение, что и у обычной, при меньших узлах
+TEST_F(RBTreePubTest, compactLayout1)
+{
+    typedef RBTree<int, std::less<int>, std::allocator<int>, NoAugment, CompactNodes> TCompactTree;
+    EXPECT_LT(sizeof(TCompactTree::Node), sizeof(RBTree<int>::Node));
+
+    TCompactTree tree;
+    std::set<int> ref;
+    unsigned seed = 29;
+    for (int round = 0; round < 40; ++round)
+    {
+        // ослабленная балансировка задействует и флаги узла, хранимые в связях
+        tree.setRelaxed(round % 2 != 0);
+        for (int j = 0; j < 100; ++j)
+        {
+            seed = seed * 1103515245 + 12345;
+            int key = (seed >> 8) % 1024;
+            if (ref.erase(key))
+                tree.remove(key);
+            else
+            {
+                tree.insert(key);
+                ref.insert(key);
+            }
+        }
+        checkSubtree(tree.getRoot(), tree.isRelaxed());
+    }
+    tree.setRelaxed(false);
+    checkSubtree(tree.getRoot());
+    EXPECT_TRUE(std::equal(ref.begin(), ref.end(), tree.begin()));
+    EXPECT_EQ(ref.size(), static_cast<std::size_t>(std::distance(tree.begin(), tree.end())));
+}
+
+
+// нисходящие вставка и удаление вперемешку с обычными
+TEST_F(RBTreePubTest, topDown1)
+{
+    RBTreeInt tree;
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.insertTopDown(STRUCT2_SEQ[i]);
+    checkSubtree(tree.getRoot());
+
+    EXPECT_FALSE(tree.tryInsertTopDown(STRUCT2_SEQ[0]).second);
+    EXPECT_THROW(tree.insertTopDown(STRUCT2_SEQ[1]), std::logic_error);
+    EXPECT_THROW(tree.removeTopDown(1000), std::logic_error);
+    checkSubtree(tree.getRoot());
+
+    // узлы не копируются: найденный раньше узел переживает удаление соседей
+    const RBTreeInt::Node* n27 = tree.find(27);
+    for (int i = 0; i < 1000; ++i)
+    {
+        int key = (i * 7919) % 500 + 100;
+        if (i % 3)
+            tree.tryInsertTopDown(key);
+        else
+            tree.tryInsert(key);
+    }
+    for (int i = 0; i < 500; i += 2)
+    {
+        if (tree.find(i + 100))
+            tree.removeTopDown(i + 100);
+        tree.removeTopDown(STRUCT2_SEQ[i % STRUCT2_SEQ_NUM]);
+        tree.insertTopDown(STRUCT2_SEQ[i % STRUCT2_SEQ_NUM]);
+        checkSubtree(tree.getRoot());
+    }
+    EXPECT_EQ(n27, tree.find(27));
+    EXPECT_TRUE(std::is_sorted(tree.begin(), tree.end()));
+    EXPECT_EQ(1, *tree.begin());
+    EXPECT_EQ(599, *tree.rbegin());
+
+    for (int i = 0; i < STRUCT2_SEQ_NUM; ++i)
+        tree.removeTopDown(STRUCT2_SEQ[i]);
+    for (int i = 1; i < 500; i += 2)
+        tree.removeTopDown(i + 100);
+    EXPECT_TRUE(tree.isEmpty());
+}
+
+
+// исключение компаратора посреди нисходящего удаления оставляет правильное дерево с черным корнем
+TEST_F(RBTreePubTest, topDownThrow1)
+{
+    typedef RBTree<LiveCounted, ThrowingLess<LiveCounted> > TTree;
+    std::atomic<int> budget(-1);
+    TTree tree((ThrowingLess<LiveCounted>(&budget)));
+    for (int i = 0; i < 200; ++i)
+        tree.insert(LiveCounted(i));
+
+    for (int key = 0; key < 200; key += 7)
+    {
+        for (int fail = 0; fail < 12; ++fail)
+        {
+            budget = fail;
+            try
+            {
+                tree.removeTopDown(LiveCounted(key));
+                budget = -1;
+                tree.insert(LiveCounted(key));
+            }
+            catch (const std::runtime_error&)
+            {
+            }
+            budget = -1;
+
+            EXPECT_TRUE(tree.getRoot()->isBlack());
+            checkSubtree(tree.getRoot());
+            EXPECT_EQ(200, std::distance(tree.begin(), tree.end()));
+        }
+    }
+}
+#endif // RBTREE_WITH_DELETION
@@ -0,0 +1,163 @@
+////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit tests for xi::ShardedRBTree interfaces
+/// \author    Sergey Shershakov
+/// \version   0.1.0
+/// \date      01.05.2017
+///            This is a part of the course "Algorithms and Data Structures"
+///            provided by  the School of Software Engineering of the Faculty
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "shardedrbtree.h"
+
+
+using namespace xi;
+
+// Тестируем на целых числах.
+typedef ShardedRBTree<int> ShardedRBTreeInt;
+
+
+/** \brief Трехзначный компаратор целых. */
+struct IntCompar3 {
+    typedef void is_three_way;
+
+    int operator()(int a, int b) const { return a < b ? -1 : (b < a ? 1 : 0); }
+}; // struct IntCompar3
+
+
+/** \brief Тестовый класс для открытых интерфейсов шардированного КЧД. */
+class ShardedRBTreePubTest : public ::testing::Test {
+protected:
+    /** \brief Возвращает элементы множества по порядку. */
+    static std::vector<int> elements(const ShardedRBTreeInt& tree)
+    {
+        std::vector<int> res;
+        tree.forEach([&res](int e) { res.push_back(e); });
+        return res;
+    }
+}; // class ShardedRBTreePubTest
+
+
+
+TEST_F(ShardedRBTreePubTest, Simplest)
+{
+    const int BOUNDS[] = { 10, 20, 30 };
+    ShardedRBTreeInt tree(BOUNDS, BOUNDS + 3);
+    EXPECT_EQ(4u, tree.getShardCount());
+    EXPECT_EQ(0u, tree.getSize());
+
+    const int KEYS[] = { 35, 5, 20, 19, 10, -1 };
+    for (int i = 0; i < 6; ++i)
+        tree.insert(KEYS[i]);
+    EXPECT_FALSE(tree.tryInsert(20));
+    EXPECT_THROW(tree.insert(5), std::logic_error);
+
+    EXPECT_TRUE(tree.contains(19));
+    EXPECT_FALSE(tree.contains(21));
+
+    tree.remove(19);
+    EXPECT_THROW(tree.remove(19), std::logic_error);
+
+    const int EXPECTED[] = { -1, 5, 10, 20, 35 };
+    EXPECT_EQ(std::vector<int>(EXPECTED, EXPECTED + 5), elements(tree));
+
+    const int BAD_BOUNDS[] = { 10, 10 };
+    EXPECT_THROW(ShardedRBTreeInt(BAD_BOUNDS, BAD_BOUNDS + 2), std::invalid_argument);
+}
+
+
+// переросшие шарды делятся, а порядок обхода через их границы сохраняется
+TEST_F(ShardedRBTreePubTest, split1)
+{
+    ShardedRBTreeInt tree(64);
+    for (int i = 0; i < 1000; ++i)
+        tree.insert((i * 7919) % 1000);
+
+    EXPECT_GT(tree.getShardCount(), 1000u / 64);
+    EXPECT_EQ(1000u, tree.getSize());
+
+    std::vector<int> all = elements(tree);
+    ASSERT_EQ(1000u, all.size());
+    for (int i = 0; i < 1000; ++i)
+        EXPECT_EQ(i, all[i]);
+}
+
+
+// маршрутизация и границы шардов сравнивают ключи так же, как сами шарды
+TEST_F(ShardedRBTreePubTest, threeWayCompar1)
+{
+    ShardedRBTree<int, IntCompar3> tree(16);
+    for (int i = 0; i < 100; ++i)
+        tree.insert((i * 37) % 100);
+    EXPECT_GT(tree.getShardCount(), 1u);
+
+    for (int i = 0; i < 100; ++i)
+        EXPECT_TRUE(tree.contains(i));
+    EXPECT_FALSE(tree.contains(100));
+    EXPECT_FALSE(tree.tryInsert(50));
+
+    const int BAD_BOUNDS[] = { 10, 10 };
+    EXPECT_THROW((ShardedRBTree<int, IntCompar3>(BAD_BOUNDS, BAD_BOUNDS + 2)), std::invalid_argument);
+}
+
+
+// писатели в свои диапазоны параллельно с делениями шардов и обходом
+TEST_F(ShardedRBTreePubTest, writers1)
+{
+    const int WRITERS = 4;
+    const int PER_WRITER = 5000;
+    ShardedRBTreeInt tree(128);
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> failures(0);
+    std::thread scanner([&tree, &stop, &failures]() {
+        while (!stop.load())
+        {
+            std::vector<int> all = elements(tree);
+            for (std::size_t i = 1; i < all.size(); ++i)
+                if (!(all[i - 1] < all[i]))
+                    ++failures;
+        }
+    });
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < WRITERS; ++w)
+    {
+        writers.push_back(std::thread([&tree, &failures, w, PER_WRITER]() {
+            for (int i = 0; i < PER_WRITER; ++i)
+            {
+                int key = w * PER_WRITER + i;
+                tree.insert(key);
+                if (!tree.contains(key))
+                    ++failures;
+                if (i % 2)
+                    tree.remove(key);
+            }
+        }));
+    }
+
+    for (std::size_t i = 0; i < writers.size(); ++i)
+        writers[i].join();
+    stop.store(true);
+    scanner.join();
+
+    EXPECT_EQ(0, failures.load());
+    std::vector<int> all = elements(tree);
+    ASSERT_EQ(static_cast<std::size_t>(WRITERS * PER_WRITER / 2), all.size());
+    for (std::size_t i = 0; i < all.size(); ++i)
+        EXPECT_EQ(static_cast<int>(2 * i), all[i]);
+}